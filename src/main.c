@@ -19,8 +19,12 @@
 
 #include "config.h"
 
+#include "rb_arena.h"
 #include "rb_sensor.h"
+#include "rb_sensor_monitor_array.h"
 #include "rb_sensor_queue.h"
+#include "rb_sensor_scheduler.h"
+#include "rb_snmp_engine.h"
 #include "snmp/traps.h"
 
 #include "utils.h"
@@ -73,6 +77,8 @@ static const char *str_default_config = /* "conf:" */ "{"
 	"\"max_snmp_fails\": 2,"
 	"\"sleep_main\": 10,"
 	"\"sleep_worker\": 2,"
+	"\"scheduler_tick_ms\": 100,"
+	"\"sensors_queue_size\": 4096,"
 "}";
 // clang-format on
 
@@ -92,9 +98,11 @@ struct _worker_info {
 	rd_kafka_topic_t *rkt;
 	rd_kafka_conf_t *rk_conf;
 	rd_kafka_topic_conf_t *rkt_conf;
-	int64_t sleep_worker, max_snmp_fails, timeout, debug_output_flags;
+	int64_t sleep_worker, timeout, debug_output_flags;
 	int64_t kafka_timeout;
-	rd_fifoq_t *queue;
+	sensor_queue_t *queue;
+	/// Asynchronous SNMP engine. If NULL, workers wait for SNMP responses
+	struct rb_snmp_engine *snmp_engine;
 #ifdef HAVE_RBHTTP
 	int64_t http_mode;
 	int64_t http_insecure;
@@ -106,9 +114,25 @@ struct _worker_info {
 #endif
 };
 
+/// Worker thread information
+struct _worker_thread {
+	pthread_t thread;		  ///< Worker thread
+	struct _worker_info *worker_info; ///< Shared worker info
+	size_t worker_id;		  ///< Worker id in sensors queue
+};
+
 struct _main_info {
 	const char *syslog_indent;
 	uint64_t sleep_main, threads;
+	/// Default sensor polling interval. If 0, sleep_main will be used.
+	uint64_t poll_interval_ms;
+	uint64_t scheduler_tick_ms; ///< Sensors scheduler resolution
+	/// How to distribute sensors along polling interval
+	enum rb_sensor_scheduler_dispatch_mode dispatch_mode;
+	/// Workers sensors queue implementation
+	enum sensor_queue_backend sensors_queue;
+	uint64_t sensors_queue_size; ///< Max queued sensors in ring queue
+	bool async_snmp; ///< Use asynchronous SNMP engine
 #ifdef HAVE_ZOOKEEPER
 	struct rb_monitor_zk *zk;
 #endif
@@ -285,8 +309,16 @@ static json_bool parse_json_config(json_object *config,
 		} else if (0 == strcmp(key, "timeout")) {
 			worker_info->timeout = json_object_get_int64(val);
 		} else if (0 == strcmp(key, "max_snmp_fails")) {
-			worker_info->max_snmp_fails =
+			const int64_t max_snmp_fails =
 					json_object_get_int64(val);
+			if (max_snmp_fails < 0) {
+				rdlog(LOG_WARNING,
+				      "Invalid max_snmp_fails %" PRId64,
+				      max_snmp_fails);
+			} else {
+				rb_sensor_set_default_max_snmp_fails(
+						(uint64_t)max_snmp_fails);
+			}
 		} else if (0 == strcmp(key, "max_kafka_fails")) {
 			worker_info->max_kafka_fails =
 					json_object_get_string(val);
@@ -299,15 +331,70 @@ static json_bool parse_json_config(json_object *config,
 			} else {
 				main_info->sleep_main = (uint64_t)sleep_s;
 			}
+		} else if (0 == strcmp(key, "poll_interval_ms")) {
+			int64_t interval_ms = json_object_get_int64(val);
+			if (interval_ms <= 0) {
+				rdlog(LOG_WARNING,
+				      "Can't poll every %" PRId64 "ms",
+				      interval_ms);
+			} else {
+				main_info->poll_interval_ms =
+						(uint64_t)interval_ms;
+			}
+		} else if (0 == strcmp(key, "scheduler_tick_ms")) {
+			int64_t tick_ms = json_object_get_int64(val);
+			if (tick_ms <= 0) {
+				rdlog(LOG_WARNING,
+				      "Can't use a scheduler tick of %" PRId64
+				      "ms",
+				      tick_ms);
+			} else {
+				main_info->scheduler_tick_ms =
+						(uint64_t)tick_ms;
+			}
+		} else if (0 == strcmp(key, "dispatch_mode")) {
+			const char *sval = json_object_get_string(val);
+			if (!rb_sensor_scheduler_dispatch_mode_parse(
+					    sval, &main_info->dispatch_mode)) {
+				rdlog(LOG_ERR,
+				      "Invalid dispatch_mode %s",
+				      sval ? sval : "(null)");
+			}
+		} else if (0 == strcmp(key, "sensors_queue")) {
+			const char *sval = json_object_get_string(val);
+			if (!sensor_queue_backend_parse(
+					    sval, &main_info->sensors_queue)) {
+				rdlog(LOG_ERR,
+				      "Invalid sensors_queue %s",
+				      sval ? sval : "(null)");
+			}
+		} else if (0 == strcmp(key, "sensors_queue_size")) {
+			int64_t queue_size = json_object_get_int64(val);
+			if (queue_size <= 0) {
+				rdlog(LOG_WARNING,
+				      "Can't use a sensors queue of %" PRId64
+				      " elements",
+				      queue_size);
+			} else {
+				main_info->sensors_queue_size =
+						(uint64_t)queue_size;
+			}
+		} else if (0 == strcmp(key, "async_snmp")) {
+			main_info->async_snmp = json_object_get_boolean(val);
 		} else if (0 == strcmp(key, "kafka_broker")) {
 			worker_info->kafka_broker = json_object_get_string(val);
 		} else if (0 == strcmp(key, "kafka_topic")) {
 			worker_info->kafka_topic = json_object_get_string(val);
+		} else if (0 == strcmp(key, "kafka_message_key")) {
+			monitor_value_set_key_template(
+					json_object_get_string(val));
 		} else if (0 == strcmp(key, "kafka_timeout")) {
 			worker_info->kafka_timeout = json_object_get_int64(val);
 		} else if (0 == strcmp(key, "sleep_worker")) {
 			worker_info->sleep_worker = json_object_get_int64(val);
-		} else if (0 == strcmp(key, CONFIG_RDKAFKA_KEY)) {
+		} else if (0 == strncmp(key,
+					CONFIG_RDKAFKA_KEY,
+					strlen(CONFIG_RDKAFKA_KEY))) {
 			parse_rdkafka_config_json(worker_info, key, val);
 #ifdef HAVE_RBHTTP
 		} else if (0 == strcmp(key, "http_endpoint")) {
@@ -526,45 +613,29 @@ static void process_rb_http_options(struct _worker_info *worker_info) {
 
 #endif
 
-static int worker_process_sensor_send_array(struct _worker_info *worker_info,
-					    rb_message_array_t *msgs) {
-	for (size_t i = 0; i < msgs->count; ++i) {
-		char *msg = msgs->msgs[i].payload;
-		size_t len = msgs->msgs[i].len;
-
-		if (worker_info->kafka_broker) {
-			rdlog(LOG_DEBUG, "[Kafka] %s", msg);
-			const int produce_rc = rd_kafka_produce(
-					worker_info->rkt,
-					RD_KAFKA_PARTITION_UA,
-					RD_KAFKA_MSG_F_COPY,
-					/* Payload and length */
-					msg,
-					len,
-					/* Optional key and its length */
-					NULL,
-					0,
-					/* Message opaque, provided in delivery
-					 * report
-					 * callback as
-					 * msg_opaque. */
-					NULL);
-			if (0 != produce_rc) {
-				rdlog(LOG_ERR,
-				      "[Kafka] Cannot produce kafka message: "
-				      "%s",
-				      rd_kafka_err2str(rd_kafka_last_error()));
-			}
-		} /* if kafka */
-
 #ifdef HAVE_RBHTTP
-		if (worker_info->http_handler) {
+/** Send sensor messages via HTTP. HTTP handler copies them, so they are still
+  valid after this call.
+  @param worker_info Common information to all workers
+  @param msgs Messages to send
+  */
+static void worker_process_sensor_send_http(struct _worker_info *worker_info,
+					    rb_message_list *msgs) {
+	rb_message_array_t *array = NULL;
+	rb_message_list_foreach(array, msgs) {
+		for (size_t i = 0; i < array->count; ++i) {
 			char err[BUFSIZ];
+			char *msg = array->msgs[i].payload;
+			if (unlikely(NULL == msg)) {
+				// Couldn't print it
+				continue;
+			}
+
 			rdlog(LOG_DEBUG, "[HTTP] %s", msg);
 			const int produce_rc = rb_http_produce(
 					worker_info->http_handler,
 					msg,
-					len,
+					array->msgs[i].len,
 					RB_HTTP_MESSAGE_F_COPY,
 					err,
 					sizeof(err),
@@ -575,39 +646,147 @@ static int worker_process_sensor_send_array(struct _worker_info *worker_info,
 				      err);
 			}
 		}
+	}
+}
 #endif
-		free(msg);
+
+/** Send all sensor messages to kafka in one batch. Kafka takes ownership of
+  the payloads it accepts, and the payload of every message of msgs is set to
+  NULL.
+  @param worker_info Common information to all workers
+  @param msgs Messages to send
+  @param count Number of messages in msgs
+  */
+static void worker_process_sensor_send_kafka(struct _worker_info *worker_info,
+					     rb_message_list *msgs,
+					     size_t count) {
+	rb_message *batch = calloc(count, sizeof(batch[0]));
+	if (alloc_unlikely(NULL == batch)) {
+		rdlog(LOG_ERR,
+		      "[Kafka] Couldn't allocate messages batch (OOM?)");
+		return;
 	}
 
-	message_array_done(msgs);
-	return 0;
+	size_t batch_count = 0;
+	rb_message_array_t *array = NULL;
+	rb_message_list_foreach(array, msgs) {
+		for (size_t i = 0; i < array->count; ++i) {
+			char *msg = array->msgs[i].payload;
+			if (unlikely(NULL == msg)) {
+				// Couldn't print it
+				continue;
+			}
+
+			rdlog(LOG_DEBUG, "[Kafka] %s", msg);
+			batch[batch_count].payload = msg;
+			batch[batch_count].len = array->msgs[i].len;
+			batch[batch_count].key = array->msgs[i].key;
+			batch[batch_count].key_len = array->msgs[i].key_len;
+			batch_count++;
+			array->msgs[i].payload = NULL;
+		}
+	}
+
+	const int msgs_ok = rd_kafka_produce_batch(worker_info->rkt,
+						   RD_KAFKA_PARTITION_UA,
+						   RD_KAFKA_MSG_F_FREE,
+						   batch,
+						   (int)batch_count);
+
+	// Rejected messages are still ours
+	for (size_t i = 0; (size_t)msgs_ok < batch_count && i < batch_count;
+	     ++i) {
+		if (batch[i].err) {
+			rdlog(LOG_ERR,
+			      "[Kafka] Cannot produce kafka message [%.*s]: "
+			      "%s",
+			      (int)batch[i].len,
+			      (char *)batch[i].payload,
+			      rd_kafka_err2str(batch[i].err));
+			free(batch[i].payload);
+		}
+	}
+
+	free(batch);
 }
 
 static int worker_process_sensor_send_messages(struct _worker_info *worker_info,
 					       rb_message_list *msgs) {
+	size_t count = 0;
+	rb_message_array_t *array = NULL;
+	rb_message_list_foreach(array, msgs) {
+		count += array->count;
+	}
+
+#ifdef HAVE_RBHTTP
+	// Before kafka, that takes ownership of payloads
+	if (worker_info->http_handler) {
+		worker_process_sensor_send_http(worker_info, msgs);
+	}
+#endif
+
+	if (worker_info->kafka_broker && count > 0) {
+		worker_process_sensor_send_kafka(worker_info, msgs, count);
+	}
+
 	while (!(rb_message_list_empty(msgs))) {
-		rb_message_array_t *array = rb_message_list_first(msgs);
+		array = rb_message_list_first(msgs);
 		rb_message_list_remove(msgs, array);
-		worker_process_sensor_send_array(worker_info, array);
+		for (size_t i = 0; i < array->count; ++i) {
+			// Not sent to kafka
+			free(array->msgs[i].payload);
+		}
+		message_array_done(array);
 	}
 
 	return 0;
 }
 
+/** Asynchronous SNMP responses of a sensor are ready. Queue the sensor again,
+  so a worker can process them.
+  @param sensor Sensor
+  @param vworker_info Common information to all workers
+  */
+static void worker_sensor_snmp_ready(rb_sensor_t *sensor, void *vworker_info) {
+	struct _worker_info *worker_info = vworker_info;
+
+	if (unlikely(!queue_sensor(worker_info->queue, sensor))) {
+		rb_sensor_snmp_async_discard(sensor);
+		rb_sensor_cycle_end(sensor);
+		rb_sensor_put(sensor);
+	}
+}
+
 /** Process sensor
   @param worker_info Common information to all workers
+  @param arena Worker allocator for the temporaries of the cycle
   @param sensor Sensor to process
   @return OK
   */
-static int
-worker_process_sensor(struct _worker_info *worker_info, rb_sensor_t *sensor) {
+static int worker_process_sensor(struct _worker_info *worker_info,
+				 struct rb_arena *arena,
+				 rb_sensor_t *sensor) {
 	rb_message_list messages;
 	rb_message_list_init(&messages);
 
 	assert(sensor);
 	assert_rb_sensor(sensor);
 
-	process_rb_sensor(sensor, &messages);
+	if (worker_info->snmp_engine && !rb_sensor_snmp_async_ready(sensor)) {
+		const bool prefetch_rc = rb_sensor_snmp_async_prefetch(
+				sensor,
+				worker_info->snmp_engine,
+				worker_sensor_snmp_ready,
+				worker_info);
+		if (prefetch_rc) {
+			// Sensor will be queued again when responses arrive
+			return 0;
+		}
+	}
+
+	process_rb_sensor(sensor, arena, &messages);
+	rb_arena_reset(arena);
+	rb_sensor_cycle_end(sensor);
 	rb_sensor_put(sensor);
 
 	worker_process_sensor_send_messages(worker_info, &messages);
@@ -616,38 +795,32 @@ worker_process_sensor(struct _worker_info *worker_info, rb_sensor_t *sensor) {
 }
 
 /** Worker main function thread
-  @param _info worker info
+  @param _info worker thread info
   @return provided _info
   */
 static void *worker(void *_info) {
-	struct _worker_info *worker_info = _info;
+	struct _worker_thread *worker_thread = _info;
+	struct _worker_info *worker_info = worker_thread->worker_info;
+	struct rb_arena arena;
 
+	rb_arena_init(&arena);
 	rdlog(LOG_INFO, "Worker connected successfuly.");
 	while (run) {
 		rb_sensor_t *sensor = NULL;
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-		while ((sensor = pop_sensor(worker_info->queue, 100)) && run) {
-			worker_process_sensor(worker_info, sensor);
+		while ((sensor = pop_sensor(worker_info->queue,
+					    worker_thread->worker_id,
+					    100)) &&
+		       run) {
+			worker_process_sensor(worker_info, &arena, sensor);
 		}
 		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	}
 
+	rb_arena_done(&arena);
 	return _info; // just avoiding warning.
 }
 
-/** Queue sensors from array to sensors queue, increasing 1 it's reference
-  counter
-  @param sarray Sensors array
-  @param squeue Sensors queue
-  */
-static void queue_sensors(rb_sensors_array_t *sarray, rd_fifoq_t *squeue) {
-	for (size_t i = 0; i < sarray->count; ++i) {
-		rb_sensor_t *sensor = sarray->elms[i];
-		rb_sensor_get(sensor);
-		queue_sensor(squeue, sensor);
-	}
-}
-
 static void *rdkafka_delivery_reports_poll_f(void *void_worker_info) {
 	struct _worker_info *worker_info = void_worker_info;
 
@@ -712,7 +885,7 @@ static void print_lib_versions(void) {
 #define STRINGIFY0(x) #x
 #define STRINGIFY(x) STRINGIFY0(x)
 
-#ifdef LIBMATHEVAL_VERSION
+#ifdef LIBRD_VERSION
 	rdlog(LOG_INFO,
 	      "Compiled & running with librd version " STRINGIFY(
 			      LIBRD_VERSION));
@@ -732,12 +905,6 @@ static void print_lib_versions(void) {
 #endif
 	      netsnmp_get_version());
 
-#ifdef LIBMATHEVAL_VERSION
-	rdlog(LOG_INFO,
-	      "Compiled & running with libmatheval "
-	      "version " STRINGIFY(LIBMATHEVAL_VERSION));
-#endif
-
 	rdlog(LOG_INFO,
 	      "Compiled with librdkafka version %X, running with %s",
 	      RD_KAFKA_VERSION,
@@ -764,9 +931,10 @@ int main(int argc, char *argv[]) {
 	// Default to librdkafka pre-0.11 behavior:
 	rd_kafka_conf_set(worker_info.rk_conf, "linger.ms", "1000", NULL, 0);
 
-	pthread_t *pd_thread = NULL;
-	rd_fifoq_t queue;
-	sensor_queue_init(&queue);
+	struct _worker_thread *pd_thread = NULL;
+	struct rb_sensor_scheduler scheduler;
+	bool scheduler_ok = false;
+	sensor_queue_t queue;
 
 	assert(default_config);
 
@@ -853,6 +1021,17 @@ int main(int argc, char *argv[]) {
 					       // values.
 	}
 
+	if (!sensor_queue_init(&queue,
+			       main_info.sensors_queue,
+			       main_info.threads,
+			       main_info.sensors_queue_size)) {
+		exit(1);
+	}
+
+	// Need MIBs loaded to resolve monitors oids, and zookeeper sensors are
+	// parsed as soon as they arrive
+	init_snmp("redBorder-monitor");
+
 	if (FALSE != json_object_object_get_ex(config_file, "zookeeper", &zk)) {
 #ifndef HAVE_ZOOKEEPER
 		rdlog(LOG_ERR, "This monitor does not have zookeeper enabled.");
@@ -937,14 +1116,20 @@ int main(int argc, char *argv[]) {
 
 	rb_sensors_array_t *sensors_array = parse_sensors(config_file);
 
-	init_snmp("redBorder-monitor");
 	if (main_info.snmp_traps.handler.server_name) {
 		main_info.snmp_traps.handler.send_topic = worker_info.rkt;
 		trap_handler_init(&main_info.snmp_traps.handler);
 	}
 
+	if (main_info.async_snmp) {
+		worker_info.snmp_engine = rb_snmp_engine_new();
+		if (NULL == worker_info.snmp_engine) {
+			exit(1);
+		}
+	}
+
 	if (sensors_array) {
-		pd_thread = malloc(sizeof(pthread_t) * main_info.threads);
+		pd_thread = calloc(main_info.threads, sizeof(pd_thread[0]));
 		if (!pd_thread) {
 			rdlog(LOG_CRIT,
 			      "[EE] Unable to allocate threads memory. "
@@ -957,30 +1142,62 @@ int main(int argc, char *argv[]) {
 		      "Starting workers threads.");
 
 		for (size_t i = 0; i < main_info.threads; ++i) {
-			pthread_create(&pd_thread[i],
+			pd_thread[i].worker_info = &worker_info;
+			pd_thread[i].worker_id = i;
+			pthread_create(&pd_thread[i].thread,
 				       NULL,
 				       worker,
-				       (void *)&worker_info);
+				       &pd_thread[i]);
 		}
 	}
 
+	if (sensors_array) {
+		const uint64_t default_interval_ms =
+				main_info.poll_interval_ms
+						? main_info.poll_interval_ms
+						: main_info.sleep_main * 1000;
+		scheduler_ok = rb_sensor_scheduler_init(
+				&scheduler,
+				sensors_array,
+				&queue,
+				main_info.scheduler_tick_ms,
+				default_interval_ms,
+				main_info.dispatch_mode,
+				rb_monotonic_ms());
+	}
+
 	while (run) {
-		if (sensors_array) {
-			queue_sensors(sensors_array, &queue);
+		if (scheduler_ok) {
+			const uint64_t now_ms = rb_monotonic_ms();
+			rb_sensor_scheduler_dispatch(&scheduler, now_ms);
+			rb_sleep_ms(rb_sensor_scheduler_wait_ms(&scheduler,
+								now_ms));
+		} else {
+			sleep(main_info.sleep_main);
 		}
-		sleep(main_info.sleep_main);
 	}
 
 	rdlog(LOG_INFO, "Leaving, wait for workers...");
 	if (sensors_array) {
 		for (size_t i = 0; sensors_array && i < main_info.threads;
 		     ++i) {
-			pthread_join(pd_thread[i], NULL);
+			pthread_join(pd_thread[i].thread, NULL);
 		}
 		free(pd_thread);
+		if (scheduler_ok) {
+			rb_sensor_scheduler_done(&scheduler);
+		}
 		rb_sensors_array_done(sensors_array);
 	}
 
+	rb_monitors_dag_pool_done();
+
+	if (worker_info.snmp_engine) {
+		rb_snmp_engine_done(worker_info.snmp_engine);
+	}
+
+	snmp_oid_cache_done();
+
 	if (worker_info.kafka_broker) {
 		int msg_left = 0;
 		pthread_join(rdkafka_delivery_reports_poll_thread, NULL);
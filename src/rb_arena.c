@@ -0,0 +1,166 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_arena.h"
+
+#include "utils.h"
+
+#include <librd/rd.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Size of the first chunk of an arena
+#define RB_ARENA_MIN_CHUNK_SIZE (16 * 1024)
+
+/// Alignment of all allocations
+#define RB_ARENA_ALIGN (_Alignof(max_align_t))
+
+/// Memory chunk of an arena
+struct rb_arena_chunk {
+	struct rb_arena_chunk *next; ///< Previous chunk
+	size_t size;		     ///< Usable bytes
+	size_t used;		     ///< Used bytes
+	max_align_t data[];	  ///< Chunk memory
+};
+
+void rb_arena_init(struct rb_arena *arena) {
+	memset(arena, 0, sizeof(*arena));
+	arena->chunk_size = RB_ARENA_MIN_CHUNK_SIZE;
+}
+
+/** Release all chunks of an arena
+  @param arena Arena
+  @return Sum of released chunks size
+  */
+static size_t arena_chunks_done(struct rb_arena *arena) {
+	size_t ret = 0;
+	struct rb_arena_chunk *chunk = arena->chunks;
+
+	while (chunk) {
+		struct rb_arena_chunk *next = chunk->next;
+		ret += chunk->size;
+		free(chunk);
+		chunk = next;
+	}
+
+	arena->chunks = NULL;
+	return ret;
+}
+
+void rb_arena_done(struct rb_arena *arena) {
+	struct rb_arena *next = arena->next;
+	arena_chunks_done(arena);
+
+	while (next) {
+		struct rb_arena *aux = next->next;
+		arena_chunks_done(next);
+		free(next);
+		next = aux;
+	}
+
+	arena->next = NULL;
+}
+
+/** Add a new chunk to an arena
+  @param arena Arena
+  @param size Minimum usable size of the chunk
+  @return New chunk, or NULL if OOM
+  */
+static struct rb_arena_chunk *arena_chunk_new(struct rb_arena *arena,
+					      size_t size) {
+	const size_t chunk_size =
+			size > arena->chunk_size ? size : arena->chunk_size;
+	struct rb_arena_chunk *ret = malloc(sizeof(*ret) + chunk_size);
+	if (alloc_unlikely(NULL == ret)) {
+		return NULL;
+	}
+
+	ret->size = chunk_size;
+	ret->used = 0;
+	ret->next = arena->chunks;
+	arena->chunks = ret;
+
+	// Next chunks grow, so a big cycle does not need many of them
+	arena->chunk_size = chunk_size * 2;
+	return ret;
+}
+
+void *rb_arena_alloc(struct rb_arena *arena, size_t size) {
+	if (unlikely(size > SIZE_MAX - RB_ARENA_ALIGN)) {
+		return NULL;
+	}
+	size = (size + RB_ARENA_ALIGN - 1) & ~(RB_ARENA_ALIGN - 1);
+
+	struct rb_arena_chunk *chunk = arena->chunks;
+	if (NULL == chunk || chunk->size - chunk->used < size) {
+		chunk = arena_chunk_new(arena, size);
+		if (alloc_unlikely(NULL == chunk)) {
+			return NULL;
+		}
+	}
+
+	void *ret = (char *)chunk->data + chunk->used;
+	chunk->used += size;
+	return ret;
+}
+
+void *rb_arena_calloc(struct rb_arena *arena, size_t nmemb, size_t size) {
+	if (unlikely(size && nmemb > SIZE_MAX / size)) {
+		return NULL;
+	}
+
+	void *ret = rb_arena_alloc(arena, nmemb * size);
+	if (alloc_likely(ret)) {
+		memset(ret, 0, nmemb * size);
+	}
+
+	return ret;
+}
+
+void rb_arena_reset(struct rb_arena *arena) {
+	for (; arena; arena = arena->next) {
+		if (NULL == arena->chunks) {
+			continue;
+		}
+
+		if (NULL == arena->chunks->next) {
+			// Steady state: just rewind the only chunk
+			arena->chunks->used = 0;
+			continue;
+		}
+
+		// Cycle needed many chunks. Next cycle will use only one chunk
+		// with room for all of them.
+		arena->chunk_size = arena_chunks_done(arena);
+	}
+}
+
+struct rb_arena *rb_arena_next(struct rb_arena *arena) {
+	if (NULL == arena->next) {
+		arena->next = malloc(sizeof(*arena->next));
+		if (alloc_unlikely(NULL == arena->next)) {
+			return NULL;
+		}
+
+		rb_arena_init(arena->next);
+	}
+
+	return arena->next;
+}
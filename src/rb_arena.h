@@ -0,0 +1,73 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+struct rb_arena_chunk;
+
+/// Bump allocator for temporaries of a sensor polling cycle. Allocations
+/// can't be freed one by one: all of them are released at once when the
+/// arena is reset at the end of the cycle. It is not thread safe, so every
+/// thread needs its own arena.
+struct rb_arena {
+	// Private data - Do not use directly
+	struct rb_arena_chunk *chunks; ///< Chunks, current one first
+	size_t chunk_size;	     ///< Size of the next chunk to allocate
+	/// Arena of the next thread working in the same cycle. It is reset and
+	/// released with this one.
+	struct rb_arena *next;
+};
+
+/** Initialize an arena. It does not allocate anything until first use.
+  @param arena Arena
+  */
+void rb_arena_init(struct rb_arena *arena);
+
+/** Release all arena resources, including next arenas
+  @param arena Arena
+  */
+void rb_arena_done(struct rb_arena *arena);
+
+/** Allocate memory from an arena, suitably aligned for any type
+  @param arena Arena
+  @param size Bytes to allocate
+  @return Allocated memory, valid until next rb_arena_reset, or NULL if OOM
+  */
+void *rb_arena_alloc(struct rb_arena *arena, size_t size);
+
+/** Allocate zeroed memory for an array from an arena
+  @param arena Arena
+  @param nmemb Number of elements
+  @param size Size of each element
+  @return Allocated memory, valid until next rb_arena_reset, or NULL if OOM
+  */
+void *rb_arena_calloc(struct rb_arena *arena, size_t nmemb, size_t size);
+
+/** Release all allocations of an arena and of its next arenas. Arenas keep
+  enough memory to serve a cycle like the last one without calling malloc.
+  @param arena Arena
+  */
+void rb_arena_reset(struct rb_arena *arena);
+
+/** Arena for another thread of the same cycle, created if needed
+  @param arena Arena
+  @return Next arena, or NULL if OOM
+  */
+struct rb_arena *rb_arena_next(struct rb_arena *arena);
@@ -19,6 +19,8 @@
 
 #include "rb_array.h"
 
+#include "rb_arena.h"
+
 struct rb_array *rb_array_new(size_t size) {
 	struct rb_array *ret = NULL;
 	ret = calloc(1, sizeof(*ret) + size * sizeof(ret->elms[0]));
@@ -29,3 +31,14 @@ struct rb_array *rb_array_new(size_t size) {
 
 	return ret;
 }
+
+struct rb_array *rb_array_arena_new(struct rb_arena *arena, size_t size) {
+	struct rb_array *ret = rb_arena_calloc(
+			arena, 1, sizeof(*ret) + size * sizeof(ret->elms[0]));
+
+	if (ret) {
+		ret->size = size;
+	}
+
+	return ret;
+}
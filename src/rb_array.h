@@ -35,6 +35,12 @@ struct rb_array {
 /** Create a new array with count capacity */
 struct rb_array *rb_array_new(size_t count);
 
+struct rb_arena;
+
+/** Create a new array with count capacity in an arena. It must not be
+  destroyed, it is valid until arena reset. */
+struct rb_array *rb_array_arena_new(struct rb_arena *arena, size_t count);
+
 /** Destroy a sensors array */
 static void rb_array_done(struct rb_array *array) __attribute__((unused));
 static void rb_array_done(struct rb_array *array) {
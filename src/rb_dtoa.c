@@ -0,0 +1,460 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// Double to decimal string conversion, using Florian Loitsch's Grisu2
+/// algorithm ("Printing Floating-Point Numbers Quickly and Accurately with
+/// Integers", PLDI 2010). Output always reads back as the same double, and it
+/// is the shortest one in the vast majority of cases.
+
+#include "rb_dtoa.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+/// Do-it-yourself floating point: f * 2^e
+struct diy_fp {
+	uint64_t f;
+	int e;
+};
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT (-DP_EXPONENT_BIAS)
+#define DP_EXPONENT_MASK UINT64_C(0x7FF0000000000000)
+#define DP_SIGNIFICAND_MASK UINT64_C(0x000FFFFFFFFFFFFF)
+#define DP_HIDDEN_BIT UINT64_C(0x0010000000000000)
+
+/// Normalized powers of ten 10^-348, 10^-340, ..., 10^340
+static const struct diy_fp cached_powers[] = {
+		{UINT64_C(0xfa8fd5a0081c0288), -1220},
+		{UINT64_C(0xbaaee17fa23ebf76), -1193},
+		{UINT64_C(0x8b16fb203055ac76), -1166},
+		{UINT64_C(0xcf42894a5dce35ea), -1140},
+		{UINT64_C(0x9a6bb0aa55653b2d), -1113},
+		{UINT64_C(0xe61acf033d1a45df), -1087},
+		{UINT64_C(0xab70fe17c79ac6ca), -1060},
+		{UINT64_C(0xff77b1fcbebcdc4f), -1034},
+		{UINT64_C(0xbe5691ef416bd60c), -1007},
+		{UINT64_C(0x8dd01fad907ffc3c), -980},
+		{UINT64_C(0xd3515c2831559a83), -954},
+		{UINT64_C(0x9d71ac8fada6c9b5), -927},
+		{UINT64_C(0xea9c227723ee8bcb), -901},
+		{UINT64_C(0xaecc49914078536d), -874},
+		{UINT64_C(0x823c12795db6ce57), -847},
+		{UINT64_C(0xc21094364dfb5637), -821},
+		{UINT64_C(0x9096ea6f3848984f), -794},
+		{UINT64_C(0xd77485cb25823ac7), -768},
+		{UINT64_C(0xa086cfcd97bf97f4), -741},
+		{UINT64_C(0xef340a98172aace5), -715},
+		{UINT64_C(0xb23867fb2a35b28e), -688},
+		{UINT64_C(0x84c8d4dfd2c63f3b), -661},
+		{UINT64_C(0xc5dd44271ad3cdba), -635},
+		{UINT64_C(0x936b9fcebb25c996), -608},
+		{UINT64_C(0xdbac6c247d62a584), -582},
+		{UINT64_C(0xa3ab66580d5fdaf6), -555},
+		{UINT64_C(0xf3e2f893dec3f126), -529},
+		{UINT64_C(0xb5b5ada8aaff80b8), -502},
+		{UINT64_C(0x87625f056c7c4a8b), -475},
+		{UINT64_C(0xc9bcff6034c13053), -449},
+		{UINT64_C(0x964e858c91ba2655), -422},
+		{UINT64_C(0xdff9772470297ebd), -396},
+		{UINT64_C(0xa6dfbd9fb8e5b88f), -369},
+		{UINT64_C(0xf8a95fcf88747d94), -343},
+		{UINT64_C(0xb94470938fa89bcf), -316},
+		{UINT64_C(0x8a08f0f8bf0f156b), -289},
+		{UINT64_C(0xcdb02555653131b6), -263},
+		{UINT64_C(0x993fe2c6d07b7fac), -236},
+		{UINT64_C(0xe45c10c42a2b3b06), -210},
+		{UINT64_C(0xaa242499697392d3), -183},
+		{UINT64_C(0xfd87b5f28300ca0e), -157},
+		{UINT64_C(0xbce5086492111aeb), -130},
+		{UINT64_C(0x8cbccc096f5088cc), -103},
+		{UINT64_C(0xd1b71758e219652c), -77},
+		{UINT64_C(0x9c40000000000000), -50},
+		{UINT64_C(0xe8d4a51000000000), -24},
+		{UINT64_C(0xad78ebc5ac620000), 3},
+		{UINT64_C(0x813f3978f8940984), 30},
+		{UINT64_C(0xc097ce7bc90715b3), 56},
+		{UINT64_C(0x8f7e32ce7bea5c70), 83},
+		{UINT64_C(0xd5d238a4abe98068), 109},
+		{UINT64_C(0x9f4f2726179a2245), 136},
+		{UINT64_C(0xed63a231d4c4fb27), 162},
+		{UINT64_C(0xb0de65388cc8ada8), 189},
+		{UINT64_C(0x83c7088e1aab65db), 216},
+		{UINT64_C(0xc45d1df942711d9a), 242},
+		{UINT64_C(0x924d692ca61be758), 269},
+		{UINT64_C(0xda01ee641a708dea), 295},
+		{UINT64_C(0xa26da3999aef774a), 322},
+		{UINT64_C(0xf209787bb47d6b85), 348},
+		{UINT64_C(0xb454e4a179dd1877), 375},
+		{UINT64_C(0x865b86925b9bc5c2), 402},
+		{UINT64_C(0xc83553c5c8965d3d), 428},
+		{UINT64_C(0x952ab45cfa97a0b3), 455},
+		{UINT64_C(0xde469fbd99a05fe3), 481},
+		{UINT64_C(0xa59bc234db398c25), 508},
+		{UINT64_C(0xf6c69a72a3989f5c), 534},
+		{UINT64_C(0xb7dcbf5354e9bece), 561},
+		{UINT64_C(0x88fcf317f22241e2), 588},
+		{UINT64_C(0xcc20ce9bd35c78a5), 614},
+		{UINT64_C(0x98165af37b2153df), 641},
+		{UINT64_C(0xe2a0b5dc971f303a), 667},
+		{UINT64_C(0xa8d9d1535ce3b396), 694},
+		{UINT64_C(0xfb9b7cd9a4a7443c), 720},
+		{UINT64_C(0xbb764c4ca7a44410), 747},
+		{UINT64_C(0x8bab8eefb6409c1a), 774},
+		{UINT64_C(0xd01fef10a657842c), 800},
+		{UINT64_C(0x9b10a4e5e9913129), 827},
+		{UINT64_C(0xe7109bfba19c0c9d), 853},
+		{UINT64_C(0xac2820d9623bf429), 880},
+		{UINT64_C(0x80444b5e7aa7cf85), 907},
+		{UINT64_C(0xbf21e44003acdd2d), 933},
+		{UINT64_C(0x8e679c2f5e44ff8f), 960},
+		{UINT64_C(0xd433179d9c8cb841), 986},
+		{UINT64_C(0x9e19db92b4e31ba9), 1013},
+		{UINT64_C(0xeb96bf6ebadf77d9), 1039},
+		{UINT64_C(0xaf87023b9bf0ee6b), 1066},
+};
+
+/// Powers of ten that fit in 64 bits
+static const uint64_t pow10_u64[] = {
+		UINT64_C(1),
+		UINT64_C(10),
+		UINT64_C(100),
+		UINT64_C(1000),
+		UINT64_C(10000),
+		UINT64_C(100000),
+		UINT64_C(1000000),
+		UINT64_C(10000000),
+		UINT64_C(100000000),
+		UINT64_C(1000000000),
+		UINT64_C(10000000000),
+		UINT64_C(100000000000),
+		UINT64_C(1000000000000),
+		UINT64_C(10000000000000),
+		UINT64_C(100000000000000),
+		UINT64_C(1000000000000000),
+		UINT64_C(10000000000000000),
+		UINT64_C(100000000000000000),
+		UINT64_C(1000000000000000000),
+		UINT64_C(10000000000000000000),
+};
+
+static struct diy_fp diy_fp_from_double(double value) {
+	uint64_t u64;
+	memcpy(&u64, &value, sizeof(u64));
+
+	const int biased_e = (int)((u64 & DP_EXPONENT_MASK) >>
+				   DP_SIGNIFICAND_SIZE);
+	const uint64_t significand = u64 & DP_SIGNIFICAND_MASK;
+	if (biased_e) {
+		return (struct diy_fp){significand + DP_HIDDEN_BIT,
+				       biased_e - DP_EXPONENT_BIAS};
+	}
+
+	// Subnormal
+	return (struct diy_fp){significand, DP_MIN_EXPONENT + 1};
+}
+
+static struct diy_fp diy_fp_normalize(struct diy_fp x) {
+	const int s = __builtin_clzll(x.f);
+	return (struct diy_fp){x.f << s, x.e - s};
+}
+
+/// Product of two diy_fp, rounded to 64 bits
+static struct diy_fp diy_fp_multiply(struct diy_fp x, struct diy_fp y) {
+	const unsigned __int128 p = (unsigned __int128)x.f * y.f;
+	uint64_t h = (uint64_t)(p >> 64);
+	const uint64_t l = (uint64_t)p;
+	if (l & (UINT64_C(1) << 63)) {
+		h++; // Round
+	}
+
+	return (struct diy_fp){h, x.e + y.e + 64};
+}
+
+/** Boundaries of a double: halfway points to its neighbours
+  @param v Double as diy_fp
+  @param minus Lower boundary
+  @param plus Upper boundary, normalized. Lower boundary has the same exponent.
+  */
+static void diy_fp_boundaries(struct diy_fp v,
+			      struct diy_fp *minus,
+			      struct diy_fp *plus) {
+	struct diy_fp pl = {(v.f << 1) + 1, v.e - 1};
+	while (!(pl.f & (DP_HIDDEN_BIT << 1))) {
+		pl.f <<= 1;
+		pl.e--;
+	}
+	pl.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+	pl.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+
+	// Lower neighbour is closer if v is a power of two
+	const bool power_of_two = v.f == DP_HIDDEN_BIT;
+	struct diy_fp mi = {(v.f << (power_of_two ? 2 : 1)) - 1,
+			    v.e - (power_of_two ? 2 : 1)};
+	mi.f <<= mi.e - pl.e;
+	mi.e = pl.e;
+
+	*minus = mi;
+	*plus = pl;
+}
+
+/** Cached power of ten that brings a binary exponent to [-60, -32]
+  @param e Binary exponent
+  @param k Decimal exponent of returned power, negated
+  @return Cached power
+  */
+static struct diy_fp cached_power(int e, int *k) {
+	const double dk = (-61 - e) * 0.30102999566398114 + 347;
+	int ik = (int)dk;
+	if (dk - ik > 0.0) {
+		ik++;
+	}
+
+	const unsigned index = (unsigned)((ik >> 3) + 1);
+	*k = -(-348 + (int)(index << 3));
+	return cached_powers[index];
+}
+
+/** Move last generated digit towards the real value while it stays inside
+  the rounding interval
+  */
+static void grisu_round(char *buffer,
+			size_t len,
+			uint64_t delta,
+			uint64_t rest,
+			uint64_t ten_kappa,
+			uint64_t wp_w) {
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+	       (rest + ten_kappa < wp_w ||
+		wp_w - rest > rest + ten_kappa - wp_w)) {
+		buffer[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+/// Number of decimal digits of a 32 bits number
+static int count_decimal_digits32(uint32_t n) {
+	int ret = 1;
+	while (ret < 10 && n >= pow10_u64[ret]) {
+		ret++;
+	}
+	return ret;
+}
+
+/** Generate the shortest digits inside the rounding interval
+  @param w Scaled value
+  @param mp Scaled upper boundary
+  @param delta Rounding interval width
+  @param buffer Digits
+  @param len Number of digits
+  @param k Decimal exponent, updated with the digits generation exponent
+  */
+static void digit_gen(struct diy_fp w,
+		      struct diy_fp mp,
+		      uint64_t delta,
+		      char *buffer,
+		      size_t *len,
+		      int *k) {
+	const struct diy_fp one = {UINT64_C(1) << -mp.e, mp.e};
+	const uint64_t wp_w = mp.f - w.f;
+	uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+	uint64_t p2 = mp.f & (one.f - 1);
+	int kappa = count_decimal_digits32(p1);
+
+	*len = 0;
+	while (kappa > 0) {
+		const uint32_t div = (uint32_t)pow10_u64[kappa - 1];
+		const uint32_t d = p1 / div;
+		p1 %= div;
+		if (d || *len) {
+			buffer[(*len)++] = (char)('0' + d);
+		}
+		kappa--;
+
+		const uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+		if (rest <= delta) {
+			*k += kappa;
+			grisu_round(buffer,
+				    *len,
+				    delta,
+				    rest,
+				    pow10_u64[kappa] << -one.e,
+				    wp_w);
+			return;
+		}
+	}
+
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		const char d = (char)(p2 >> -one.e);
+		if (d || *len) {
+			buffer[(*len)++] = (char)('0' + d);
+		}
+		p2 &= one.f - 1;
+		kappa--;
+		if (p2 < delta) {
+			*k += kappa;
+			const int index = -kappa;
+			grisu_round(buffer,
+				    *len,
+				    delta,
+				    p2,
+				    one.f,
+				    wp_w * (index < 20 ? pow10_u64[index] : 0));
+			return;
+		}
+	}
+}
+
+/** Shortest digits of a positive double
+  @param value Value
+  @param buffer Digits
+  @param len Number of digits
+  @param k Decimal exponent: value is digits * 10^k
+  */
+static void grisu2(double value, char *buffer, size_t *len, int *k) {
+	const struct diy_fp v = diy_fp_from_double(value);
+	struct diy_fp w_m, w_p;
+	diy_fp_boundaries(v, &w_m, &w_p);
+
+	const struct diy_fp c_mk = cached_power(w_p.e, k);
+	const struct diy_fp w = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+	struct diy_fp wp = diy_fp_multiply(w_p, c_mk);
+	struct diy_fp wm = diy_fp_multiply(w_m, c_mk);
+
+	// Be conservative with multiplications rounding
+	wm.f++;
+	wp.f--;
+	digit_gen(w, wp, wp.f - wm.f, buffer, len, k);
+}
+
+size_t rb_utoa(uint64_t value, char *buf) {
+	char digits[20];
+	size_t len = 0;
+	do {
+		digits[len++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+
+	for (size_t i = 0; i < len; ++i) {
+		buf[i] = digits[len - 1 - i];
+	}
+
+	return len;
+}
+
+size_t rb_itoa(int64_t value, char *buf) {
+	if (value >= 0) {
+		return rb_utoa((uint64_t)value, buf);
+	}
+
+	buf[0] = '-';
+	// Negate in unsigned, so INT64_MIN does not overflow
+	return 1 + rb_utoa(-(uint64_t)value, &buf[1]);
+}
+
+/** Write decimal exponent of scientific notation
+  @param buf Buffer
+  @param exponent Exponent
+  @return Written chars
+  */
+static size_t dtoa_exponent(char *buf, int exponent) {
+	size_t ret = 0;
+	buf[ret++] = 'e';
+	if (exponent < 0) {
+		buf[ret++] = '-';
+		exponent = -exponent;
+	}
+
+	return ret + rb_utoa((uint64_t)exponent, &buf[ret]);
+}
+
+/** Format digits * 10^k as a JSON number, like JavaScript does: plain
+  notation if the decimal exponent is in [-6, 21), scientific in other case.
+  @param buf Buffer, with digits at the beginning
+  @param len Number of digits
+  @param k Decimal exponent
+  @return Number length
+  */
+static size_t dtoa_prettify(char *buf, size_t len, int k) {
+	const int ilen = (int)len;
+	const int kk = ilen + k; // 10^(kk-1) <= value < 10^kk
+
+	if (k >= 0 && kk <= 21) {
+		// Integer: 1234e7 -> 12340000000
+		memset(&buf[len], '0', (size_t)k);
+		return (size_t)kk;
+	}
+
+	if (kk > 0 && kk <= 21) {
+		// 1234e-2 -> 12.34
+		memmove(&buf[kk + 1], &buf[kk], (size_t)(ilen - kk));
+		buf[kk] = '.';
+		return len + 1;
+	}
+
+	if (kk > -6 && kk <= 0) {
+		// 1234e-6 -> 0.001234
+		const size_t offset = (size_t)(2 - kk);
+		memmove(&buf[offset], buf, len);
+		buf[0] = '0';
+		buf[1] = '.';
+		memset(&buf[2], '0', (size_t)-kk);
+		return len + offset;
+	}
+
+	if (1 == len) {
+		// 1e30
+		return len + dtoa_exponent(&buf[1], kk - 1);
+	}
+
+	// 1234e30 -> 1.234e33
+	memmove(&buf[2], &buf[1], len - 1);
+	buf[1] = '.';
+	return len + 1 + dtoa_exponent(&buf[len + 1], kk - 1);
+}
+
+size_t rb_dtoa(double value, char *buf) {
+	if (!isfinite(value)) {
+		return 0;
+	}
+
+	size_t ret = 0;
+	if (signbit(value)) {
+		buf[ret++] = '-';
+		value = -value;
+	}
+
+	if (0 == value) {
+		buf[ret++] = '0';
+		return ret;
+	}
+
+	// Fast path: integers are exact in a double below 2^53
+	if (value < 9007199254740992.0 && value == (double)(uint64_t)value) {
+		return ret + rb_utoa((uint64_t)value, &buf[ret]);
+	}
+
+	size_t len = 0;
+	int k = 0;
+	grisu2(value, &buf[ret], &len, &k);
+	return ret + dtoa_prettify(&buf[ret], len, k);
+}
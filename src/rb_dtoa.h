@@ -0,0 +1,52 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Buffer size big enough for any rb_dtoa or rb_itoa output
+#define RB_DTOA_BUFSIZE 32
+
+/** Print a double as a JSON number, with the shortest digits that read back
+  as the same double. Integers are printed without fraction, and very big or
+  very small numbers in scientific notation (1e+21 is printed as 1e21).
+  @param value Value to print
+  @param buf Buffer, of at least RB_DTOA_BUFSIZE bytes. It is not NULL
+  terminated.
+  @return Printed length, or 0 if value is not finite (JSON can't represent
+  it)
+  */
+size_t rb_dtoa(double value, char *buf);
+
+/** Print an integer in decimal
+  @param value Value to print
+  @param buf Buffer, of at least RB_DTOA_BUFSIZE bytes. It is not NULL
+  terminated.
+  @return Printed length
+  */
+size_t rb_itoa(int64_t value, char *buf);
+
+/** Print an unsigned integer in decimal
+  @param value Value to print
+  @param buf Buffer, of at least RB_DTOA_BUFSIZE bytes. It is not NULL
+  terminated.
+  @return Printed length
+  */
+size_t rb_utoa(uint64_t value, char *buf);
@@ -0,0 +1,747 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_expr.h"
+
+#include "utils.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Rows evaluated in each bytecode pass. Every stack slot holds a block of
+/// rows, so instructions are simple loops over contiguous arrays that the
+/// compiler can vectorize.
+#define RB_EXPR_BLOCK_ROWS 256
+
+/// Max nesting of parenthesis, functions and unary operators
+#define RB_EXPR_MAX_NESTING 64
+
+enum rb_expr_opcode {
+	RB_EXPR_OP_CONST, ///< Push a constant
+	RB_EXPR_OP_VAR,   ///< Push a variable column
+	RB_EXPR_OP_NEG,   ///< Negate top of the stack
+	RB_EXPR_OP_FN,    ///< Apply a function to top of the stack
+	RB_EXPR_OP_ADD,   ///< Pop two operands and push the result
+	RB_EXPR_OP_SUB,
+	RB_EXPR_OP_MUL,
+	RB_EXPR_OP_DIV,
+	RB_EXPR_OP_POW,
+};
+
+struct rb_expr_insn {
+	enum rb_expr_opcode opcode;
+	union {
+		double value;	      ///< RB_EXPR_OP_CONST constant
+		size_t var;	      ///< RB_EXPR_OP_VAR variable position
+		double (*fn)(double); ///< RB_EXPR_OP_FN function
+	};
+};
+
+struct rb_expr {
+	struct rb_expr_insn *code; ///< Bytecode
+	size_t code_len;	   ///< Bytecode instructions
+	size_t code_size;	   ///< Bytecode capacity
+	char **vars;		   ///< Variables names
+	size_t vars_count;	   ///< Number of variables
+	size_t depth;		   ///< Stack depth at the end of bytecode
+	size_t max_depth;	   ///< Max stack depth
+};
+
+/*
+ * FUNCTIONS & CONSTANTS
+ */
+
+static double expr_cot(double x) {
+	return 1 / tan(x);
+}
+
+static double expr_sec(double x) {
+	return 1 / cos(x);
+}
+
+static double expr_csc(double x) {
+	return 1 / sin(x);
+}
+
+static double expr_acot(double x) {
+	return atan(1 / x);
+}
+
+static double expr_asec(double x) {
+	return acos(1 / x);
+}
+
+static double expr_acsc(double x) {
+	return asin(1 / x);
+}
+
+static double expr_coth(double x) {
+	return 1 / tanh(x);
+}
+
+static double expr_sech(double x) {
+	return 1 / cosh(x);
+}
+
+static double expr_csch(double x) {
+	return 1 / sinh(x);
+}
+
+static double expr_acoth(double x) {
+	return atanh(1 / x);
+}
+
+static double expr_asech(double x) {
+	return acosh(1 / x);
+}
+
+static double expr_acsch(double x) {
+	return asinh(1 / x);
+}
+
+static double expr_step(double x) {
+	return x < 0 ? 0 : 1;
+}
+
+static double expr_delta(double x) {
+	return 0 == x ? INFINITY : 0;
+}
+
+static double expr_nandelta(double x) {
+	return 0 == x ? NAN : 0;
+}
+
+static const struct {
+	const char *name;
+	double (*fn)(double);
+} expr_functions[] = {
+		{"exp", exp},
+		{"log", log},
+		{"sqrt", sqrt},
+		{"sin", sin},
+		{"cos", cos},
+		{"tan", tan},
+		{"cot", expr_cot},
+		{"sec", expr_sec},
+		{"csc", expr_csc},
+		{"asin", asin},
+		{"acos", acos},
+		{"atan", atan},
+		{"acot", expr_acot},
+		{"asec", expr_asec},
+		{"acsc", expr_acsc},
+		{"sinh", sinh},
+		{"cosh", cosh},
+		{"tanh", tanh},
+		{"coth", expr_coth},
+		{"sech", expr_sech},
+		{"csch", expr_csch},
+		{"asinh", asinh},
+		{"acosh", acosh},
+		{"atanh", atanh},
+		{"acoth", expr_acoth},
+		{"asech", expr_asech},
+		{"acsch", expr_acsch},
+		{"abs", fabs},
+		{"step", expr_step},
+		{"delta", expr_delta},
+		{"nandelta", expr_nandelta},
+		{"erf", erf},
+};
+
+static const struct {
+	const char *name;
+	double value;
+} expr_constants[] = {
+		{"e", M_E},
+		{"log2e", M_LOG2E},
+		{"log10e", M_LOG10E},
+		{"ln2", M_LN2},
+		{"ln10", M_LN10},
+		{"pi", M_PI},
+		{"pi_2", M_PI_2},
+		{"pi_4", M_PI_4},
+		{"1_pi", M_1_PI},
+		{"2_pi", M_2_PI},
+		{"2_sqrtpi", M_2_SQRTPI},
+		{"sqrt2", M_SQRT2},
+		{"sqrt1_2", M_SQRT1_2},
+};
+
+/// Search a name of length len in a functions or constants table
+#define expr_table_search(table, t_name, len)                                  \
+	({                                                                     \
+		ssize_t expr_table_search_ret = -1;                            \
+		for (size_t i = 0; i < RD_ARRAYSIZE(table); ++i) {             \
+			if (strlen(table[i].name) == (len) &&                  \
+			    0 == strncmp(table[i].name, t_name, len)) {        \
+				expr_table_search_ret = (ssize_t)i;            \
+				break;                                         \
+			}                                                      \
+		}                                                              \
+		expr_table_search_ret;                                         \
+	})
+
+/*
+ * BYTECODE GENERATION
+ */
+
+static double
+expr_binary_op(enum rb_expr_opcode opcode, double a, double b) {
+	switch (opcode) {
+	case RB_EXPR_OP_ADD:
+		return a + b;
+	case RB_EXPR_OP_SUB:
+		return a - b;
+	case RB_EXPR_OP_MUL:
+		return a * b;
+	case RB_EXPR_OP_DIV:
+		return a / b;
+	case RB_EXPR_OP_POW:
+	default:
+		return pow(a, b);
+	};
+}
+
+static bool expr_emit(struct rb_expr *expr, const struct rb_expr_insn *insn) {
+	if (expr->code_len == expr->code_size) {
+		const size_t new_size = expr->code_size ? 2 * expr->code_size
+							: 16;
+		struct rb_expr_insn *new_code = realloc(
+				expr->code, new_size * sizeof(new_code[0]));
+		if (alloc_unlikely(NULL == new_code)) {
+			rdlog(LOG_CRIT, "Couldn't allocate bytecode (OOM?)");
+			return false;
+		}
+
+		expr->code = new_code;
+		expr->code_size = new_size;
+	}
+
+	expr->code[expr->code_len++] = *insn;
+	return true;
+}
+
+/// Emit an instruction that pushes a value in the stack
+static bool expr_emit_push(struct rb_expr *expr,
+			   const struct rb_expr_insn *insn) {
+	if (!expr_emit(expr, insn)) {
+		return false;
+	}
+
+	if (++expr->depth > expr->max_depth) {
+		expr->max_depth = expr->depth;
+	}
+	return true;
+}
+
+/// Last emitted instruction if it pushes a constant, NULL in other case
+static struct rb_expr_insn *expr_last_const(struct rb_expr *expr,
+					    size_t from_last) {
+	if (expr->code_len <= from_last) {
+		return NULL;
+	}
+
+	struct rb_expr_insn *ret = &expr->code[expr->code_len - 1 - from_last];
+	return RB_EXPR_OP_CONST == ret->opcode ? ret : NULL;
+}
+
+/// Emit an unary instruction, folding it if operand is a constant
+static bool expr_emit_unary(struct rb_expr *expr,
+			    const struct rb_expr_insn *insn) {
+	struct rb_expr_insn *operand = expr_last_const(expr, 0);
+	if (NULL == operand) {
+		return expr_emit(expr, insn);
+	}
+
+	operand->value = RB_EXPR_OP_NEG == insn->opcode
+				 ? -operand->value
+				 : insn->fn(operand->value);
+	return true;
+}
+
+/// Emit a binary instruction, folding it if both operands are constants
+static bool expr_emit_binary(struct rb_expr *expr,
+			     enum rb_expr_opcode opcode) {
+	struct rb_expr_insn *b = expr_last_const(expr, 0);
+	struct rb_expr_insn *a = expr_last_const(expr, 1);
+
+	expr->depth--;
+	if (NULL == a || NULL == b) {
+		const struct rb_expr_insn insn = {.opcode = opcode};
+		return expr_emit(expr, &insn);
+	}
+
+	a->value = expr_binary_op(opcode, a->value, b->value);
+	expr->code_len--;
+	return true;
+}
+
+/** Variable position, adding it if it's the first time it's used
+  @param expr Expression
+  @param name Variable name
+  @param len Variable name length
+  @return Variable position, or -1 if error
+  */
+static ssize_t expr_var(struct rb_expr *expr, const char *name, size_t len) {
+	for (size_t i = 0; i < expr->vars_count; ++i) {
+		if (strlen(expr->vars[i]) == len &&
+		    0 == strncmp(expr->vars[i], name, len)) {
+			return (ssize_t)i;
+		}
+	}
+
+	char **new_vars = realloc(expr->vars,
+				  (expr->vars_count + 1) * sizeof(new_vars[0]));
+	if (alloc_unlikely(NULL == new_vars)) {
+		rdlog(LOG_CRIT, "Couldn't allocate variables (OOM?)");
+		return -1;
+	}
+	expr->vars = new_vars;
+
+	expr->vars[expr->vars_count] = strndup(name, len);
+	if (alloc_unlikely(NULL == expr->vars[expr->vars_count])) {
+		rdlog(LOG_CRIT, "Couldn't allocate variable name (OOM?)");
+		return -1;
+	}
+
+	return (ssize_t)expr->vars_count++;
+}
+
+/*
+ * PARSER
+ */
+
+/// Recursive descent parser, with libmatheval precedences
+struct expr_parser {
+	const char *str; ///< Expression string, for error messages
+	const char *pos; ///< Current position
+	unsigned nesting;
+	struct rb_expr *expr;
+};
+
+static bool expr_parse_sum(struct expr_parser *parser);
+static bool expr_parse_unary(struct expr_parser *parser);
+
+static bool expr_parse_error(const struct expr_parser *parser,
+			     const char *err) {
+	rdlog(LOG_ERR,
+	      "Couldn't compile operation [%s]: %s at position %td",
+	      parser->str,
+	      err,
+	      parser->pos - parser->str);
+	return false;
+}
+
+/// Skip spaces and return current character
+static char expr_parse_peek(struct expr_parser *parser) {
+	while (isspace((unsigned char)*parser->pos)) {
+		parser->pos++;
+	}
+
+	return *parser->pos;
+}
+
+static bool expr_is_ident_char(char c) {
+	return isalnum((unsigned char)c) || '_' == c;
+}
+
+static bool expr_parse_number(struct expr_parser *parser) {
+	const char *end = parser->pos;
+	while (isdigit((unsigned char)*end)) {
+		end++;
+	}
+	if ('.' == *end) {
+		end++;
+		while (isdigit((unsigned char)*end)) {
+			end++;
+		}
+	}
+	if ('e' == *end || 'E' == *end) {
+		const char *exponent = end + 1;
+		if ('+' == *exponent || '-' == *exponent) {
+			exponent++;
+		}
+		if (isdigit((unsigned char)*exponent)) {
+			while (isdigit((unsigned char)*exponent)) {
+				exponent++;
+			}
+			end = exponent;
+		}
+	}
+
+	char *strtod_end = NULL;
+	const struct rb_expr_insn insn = {
+			.opcode = RB_EXPR_OP_CONST,
+			.value = strtod(parser->pos, &strtod_end),
+	};
+	if (strtod_end != end) {
+		return expr_parse_error(parser, "Invalid number");
+	}
+
+	parser->pos = end;
+	return expr_emit_push(parser->expr, &insn);
+}
+
+/// Parse a function call, a constant or a variable
+static bool expr_parse_identifier(struct expr_parser *parser) {
+	const char *name = parser->pos;
+	while (expr_is_ident_char(*parser->pos)) {
+		parser->pos++;
+	}
+	const size_t len = (size_t)(parser->pos - name);
+
+	const ssize_t fn = expr_table_search(expr_functions, name, len);
+	if (fn >= 0) {
+		if ('(' != expr_parse_peek(parser)) {
+			return expr_parse_error(parser, "Expected '('");
+		}
+		parser->pos++;
+
+		if (!expr_parse_sum(parser)) {
+			return false;
+		}
+
+		if (')' != expr_parse_peek(parser)) {
+			return expr_parse_error(parser, "Expected ')'");
+		}
+		parser->pos++;
+
+		const struct rb_expr_insn insn = {
+				.opcode = RB_EXPR_OP_FN,
+				.fn = expr_functions[fn].fn,
+		};
+		return expr_emit_unary(parser->expr, &insn);
+	}
+
+	if ('(' == expr_parse_peek(parser)) {
+		return expr_parse_error(parser, "Unknown function");
+	}
+
+	const ssize_t constant = expr_table_search(expr_constants, name, len);
+	if (constant >= 0) {
+		const struct rb_expr_insn insn = {
+				.opcode = RB_EXPR_OP_CONST,
+				.value = expr_constants[constant].value,
+		};
+		return expr_emit_push(parser->expr, &insn);
+	}
+
+	if (isdigit((unsigned char)*name)) {
+		parser->pos = name;
+		return expr_parse_number(parser);
+	}
+
+	const ssize_t var = expr_var(parser->expr, name, len);
+	if (var < 0) {
+		return false;
+	}
+
+	const struct rb_expr_insn insn = {
+			.opcode = RB_EXPR_OP_VAR, .var = (size_t)var,
+	};
+	return expr_emit_push(parser->expr, &insn);
+}
+
+static bool expr_parse_primary(struct expr_parser *parser) {
+	const char c = expr_parse_peek(parser);
+
+	if ('(' == c) {
+		parser->pos++;
+		if (!expr_parse_sum(parser)) {
+			return false;
+		}
+		if (')' != expr_parse_peek(parser)) {
+			return expr_parse_error(parser, "Expected ')'");
+		}
+		parser->pos++;
+		return true;
+	} else if ('.' == c) {
+		return expr_parse_number(parser);
+	} else if (expr_is_ident_char(c)) {
+		return expr_parse_identifier(parser);
+	} else if ('\0' == c) {
+		return expr_parse_error(parser, "Unexpected end");
+	} else {
+		return expr_parse_error(parser, "Unexpected character");
+	}
+}
+
+/// power := primary ['^' unary]
+static bool expr_parse_power(struct expr_parser *parser) {
+	if (!expr_parse_primary(parser)) {
+		return false;
+	}
+
+	if ('^' != expr_parse_peek(parser)) {
+		return true;
+	}
+
+	parser->pos++;
+	return expr_parse_unary(parser) &&
+	       expr_emit_binary(parser->expr, RB_EXPR_OP_POW);
+}
+
+/// unary := '-' unary | power
+static bool expr_parse_unary(struct expr_parser *parser) {
+	if (++parser->nesting > RB_EXPR_MAX_NESTING) {
+		return expr_parse_error(parser, "Too nested expression");
+	}
+
+	bool ret = false;
+	if ('-' == expr_parse_peek(parser)) {
+		parser->pos++;
+		const struct rb_expr_insn insn = {.opcode = RB_EXPR_OP_NEG};
+		ret = expr_parse_unary(parser) &&
+		      expr_emit_unary(parser->expr, &insn);
+	} else {
+		ret = expr_parse_power(parser);
+	}
+
+	parser->nesting--;
+	return ret;
+}
+
+/// product := unary (('*' | '/') unary)*
+static bool expr_parse_product(struct expr_parser *parser) {
+	if (!expr_parse_unary(parser)) {
+		return false;
+	}
+
+	for (;;) {
+		const char c = expr_parse_peek(parser);
+		if ('*' != c && '/' != c) {
+			return true;
+		}
+
+		parser->pos++;
+		if (!expr_parse_unary(parser) ||
+		    !expr_emit_binary(parser->expr,
+				      '*' == c ? RB_EXPR_OP_MUL
+					       : RB_EXPR_OP_DIV)) {
+			return false;
+		}
+	}
+}
+
+/// sum := product (('+' | '-') product)*
+static bool expr_parse_sum(struct expr_parser *parser) {
+	if (!expr_parse_product(parser)) {
+		return false;
+	}
+
+	for (;;) {
+		const char c = expr_parse_peek(parser);
+		if ('+' != c && '-' != c) {
+			return true;
+		}
+
+		parser->pos++;
+		if (!expr_parse_product(parser) ||
+		    !expr_emit_binary(parser->expr,
+				      '+' == c ? RB_EXPR_OP_ADD
+					       : RB_EXPR_OP_SUB)) {
+			return false;
+		}
+	}
+}
+
+struct rb_expr *rb_expr_compile(const char *str) {
+	struct rb_expr *ret = calloc(1, sizeof(*ret));
+	if (alloc_unlikely(NULL == ret)) {
+		rdlog(LOG_CRIT, "Couldn't allocate expression (OOM?)");
+		return NULL;
+	}
+
+	struct expr_parser parser = {
+			.str = str, .pos = str, .expr = ret,
+	};
+
+	if (!expr_parse_sum(&parser)) {
+		goto err;
+	}
+
+	if ('\0' != expr_parse_peek(&parser)) {
+		expr_parse_error(&parser, "Unexpected character");
+		goto err;
+	}
+
+	assert(1 == ret->depth);
+	return ret;
+
+err:
+	rb_expr_done(ret);
+	return NULL;
+}
+
+void rb_expr_done(struct rb_expr *expr) {
+	for (size_t i = 0; i < expr->vars_count; ++i) {
+		free(expr->vars[i]);
+	}
+	free(expr->vars);
+	free(expr->code);
+	free(expr);
+}
+
+size_t rb_expr_vars_count(const struct rb_expr *expr) {
+	return expr->vars_count;
+}
+
+const char *rb_expr_var_name(const struct rb_expr *expr, size_t i) {
+	assert(i < expr->vars_count);
+	return expr->vars[i];
+}
+
+/*
+ * EVALUATION
+ */
+
+static void expr_eval_fill(double *dst, size_t n, double value) {
+	for (size_t i = 0; i < n; ++i) {
+		dst[i] = value;
+	}
+}
+
+static void expr_eval_unary(const struct rb_expr_insn *insn,
+			    double *dst,
+			    const double *a,
+			    size_t n) {
+	if (RB_EXPR_OP_NEG == insn->opcode) {
+		for (size_t i = 0; i < n; ++i) {
+			dst[i] = -a[i];
+		}
+	} else {
+		for (size_t i = 0; i < n; ++i) {
+			dst[i] = insn->fn(a[i]);
+		}
+	}
+}
+
+/// dst can be the same as a
+static void expr_eval_binary(enum rb_expr_opcode opcode,
+			     double *dst,
+			     const double *a,
+			     const double *b,
+			     size_t n) {
+	switch (opcode) {
+	case RB_EXPR_OP_ADD:
+		for (size_t i = 0; i < n; ++i) {
+			dst[i] = a[i] + b[i];
+		}
+		break;
+	case RB_EXPR_OP_SUB:
+		for (size_t i = 0; i < n; ++i) {
+			dst[i] = a[i] - b[i];
+		}
+		break;
+	case RB_EXPR_OP_MUL:
+		for (size_t i = 0; i < n; ++i) {
+			dst[i] = a[i] * b[i];
+		}
+		break;
+	case RB_EXPR_OP_DIV:
+		for (size_t i = 0; i < n; ++i) {
+			dst[i] = a[i] / b[i];
+		}
+		break;
+	case RB_EXPR_OP_POW:
+	default:
+		for (size_t i = 0; i < n; ++i) {
+			dst[i] = pow(a[i], b[i]);
+		}
+		break;
+	};
+}
+
+size_t rb_expr_scratch_size(const struct rb_expr *expr) {
+	return expr->max_depth *
+	       (RB_EXPR_BLOCK_ROWS * sizeof(double) + sizeof(double *));
+}
+
+void rb_expr_eval(const struct rb_expr *expr,
+		  const double *const *vars,
+		  const bool *scalars,
+		  size_t rows,
+		  void *vscratch,
+		  double *out) {
+	// Every stack slot points to a variable column or to its own scratch
+	// block, where instructions leave their results
+	double *scratch = vscratch;
+	const double **stack =
+			(void *)&scratch[expr->max_depth * RB_EXPR_BLOCK_ROWS];
+
+	for (size_t row = 0; row < rows; row += RB_EXPR_BLOCK_ROWS) {
+		const size_t n = rows - row < RB_EXPR_BLOCK_ROWS
+					 ? rows - row
+					 : RB_EXPR_BLOCK_ROWS;
+		size_t sp = 0;
+
+		for (size_t i = 0; i < expr->code_len; ++i) {
+			const struct rb_expr_insn *insn = &expr->code[i];
+			double *dst = NULL;
+
+			switch (insn->opcode) {
+			case RB_EXPR_OP_CONST:
+				dst = &scratch[sp * RB_EXPR_BLOCK_ROWS];
+				expr_eval_fill(dst, n, insn->value);
+				stack[sp++] = dst;
+				break;
+
+			case RB_EXPR_OP_VAR:
+				if (scalars && scalars[insn->var]) {
+					// Broadcast scalar to all rows
+					dst = &scratch[sp * RB_EXPR_BLOCK_ROWS];
+					expr_eval_fill(dst,
+						       n,
+						       vars[insn->var][0]);
+					stack[sp++] = dst;
+				} else {
+					stack[sp++] = &vars[insn->var][row];
+				}
+				break;
+
+			case RB_EXPR_OP_NEG:
+			case RB_EXPR_OP_FN:
+				dst = &scratch[(sp - 1) * RB_EXPR_BLOCK_ROWS];
+				expr_eval_unary(insn, dst, stack[sp - 1], n);
+				stack[sp - 1] = dst;
+				break;
+
+			default:
+				dst = &scratch[(sp - 2) * RB_EXPR_BLOCK_ROWS];
+				expr_eval_binary(insn->opcode,
+						 dst,
+						 stack[sp - 2],
+						 stack[sp - 1],
+						 n);
+				stack[sp - 2] = dst;
+				sp--;
+				break;
+			};
+		}
+
+		assert(1 == sp);
+		memcpy(&out[row], stack[0], n * sizeof(out[0]));
+	}
+}
@@ -0,0 +1,79 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Arithmetic expression compiled to a stack bytecode. It understands the
+/// same syntax, functions and constants than libmatheval. Variables are
+/// referenced by position, and the expression is evaluated over whole
+/// columns of values at once. A compiled expression is never modified by
+/// evaluation, so many threads can evaluate it at the same time.
+struct rb_expr;
+
+/** Compile an expression
+  @param str Expression string
+  @return New compiled expression, or NULL if it is not valid. Need to be
+  freed with rb_expr_done
+  */
+struct rb_expr *rb_expr_compile(const char *str);
+
+/** Release a compiled expression
+  @param expr Expression
+  */
+void rb_expr_done(struct rb_expr *expr);
+
+/** Number of variables of an expression
+  @param expr Expression
+  @return Number of variables
+  */
+size_t rb_expr_vars_count(const struct rb_expr *expr);
+
+/** Variable name
+  @param expr Expression
+  @param i Variable position, in order of first appearance in the expression
+  @return Variable name
+  */
+const char *rb_expr_var_name(const struct rb_expr *expr, size_t i);
+
+/** Size of the scratch memory needed to evaluate an expression, no matter
+  the number of rows
+  @param expr Expression
+  @return Scratch size, in bytes
+  */
+size_t rb_expr_scratch_size(const struct rb_expr *expr);
+
+/** Evaluate an expression over columns of values
+  @param expr Expression
+  @param vars Variables values, in rb_expr_var_name order. Every variable is a
+  column of rows values, or a single value if it is a scalar.
+  @param scalars If scalars[i], vars[i] only has one value, and it is used in
+  every row. Can be NULL if there are no scalars.
+  @param rows Number of rows to evaluate
+  @param scratch Evaluation stack, of rb_expr_scratch_size bytes and aligned
+  for doubles and pointers
+  @param out Result of every row. Need to have room for rows values.
+  */
+void rb_expr_eval(const struct rb_expr *expr,
+		  const double *const *vars,
+		  const bool *scalars,
+		  size_t rows,
+		  void *scratch,
+		  double *out);
@@ -53,3 +53,5 @@ typedef TAILQ_HEAD(, rb_message_array_s) rb_message_list;
 #define rb_message_list_empty(msg_list) TAILQ_EMPTY(msg_list)
 #define rb_message_list_first(msg_list)                                        \
 	((rb_message_array_t *)TAILQ_FIRST(msg_list))
+#define rb_message_list_foreach(msg_array, msg_list)                           \
+	TAILQ_FOREACH(msg_array, msg_list, entry)
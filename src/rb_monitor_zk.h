@@ -23,15 +23,16 @@
 
 #ifdef HAVE_ZOOKEEPER
 
+#include "rb_sensor_queue.h"
+
 #include <json/json.h>
-#include <librd/rdqueue.h>
 
 struct rb_monitor_zk;
 struct rb_monitor_zk *init_rbmon_zk(char *host,
 				    uint64_t pop_watcher_timeout,
 				    uint64_t push_timeout,
 				    json_object *zk_sensors,
-				    rd_fifoq_t *workers_queue);
+				    sensor_queue_t *workers_queue);
 
 void stop_zk(struct rb_monitor_zk *zk);
 
@@ -0,0 +1,178 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include "rb_mpmc_ring.h"
+
+#include "utils.h"
+
+#include <librd/rd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+/// Atomic load
+#define RING_LOAD(ptr) ATOMIC_OP(add, fetch, ptr, 0)
+
+/// wake_seq bit that signals there are consumers waiting
+#define RING_WAITERS_BIT UINT32_C(1)
+
+bool rb_mpmc_ring_init(struct rb_mpmc_ring *ring, size_t size) {
+	size_t capacity = 2;
+	while (capacity < size) {
+		capacity <<= 1;
+	}
+
+	memset(ring, 0, sizeof(*ring));
+	ring->cells = calloc(capacity, sizeof(ring->cells[0]));
+	if (alloc_unlikely(NULL == ring->cells)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < capacity; ++i) {
+		ring->cells[i].sequence = i;
+	}
+
+	ring->mask = capacity - 1;
+	return true;
+}
+
+void rb_mpmc_ring_done(struct rb_mpmc_ring *ring) {
+	free(ring->cells);
+	ring->cells = NULL;
+}
+
+static long futex(uint32_t *uaddr,
+		  int op,
+		  uint32_t val,
+		  const struct timespec *timeout) {
+	return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+bool rb_mpmc_ring_push(struct rb_mpmc_ring *ring, void *elm) {
+	struct rb_mpmc_ring_cell *cell = NULL;
+	size_t pos = RING_LOAD(&ring->enqueue_pos);
+
+	for (;;) {
+		cell = &ring->cells[pos & ring->mask];
+		const size_t seq = RING_LOAD(&cell->sequence);
+		const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (0 == diff) {
+			if (__sync_bool_compare_and_swap(
+					    &ring->enqueue_pos, pos, pos + 1)) {
+				break;
+			}
+			pos = RING_LOAD(&ring->enqueue_pos);
+		} else if (diff < 0) {
+			// Cell not consumed yet from the previous lap
+			return false;
+		} else {
+			pos = RING_LOAD(&ring->enqueue_pos);
+		}
+	}
+
+	cell->data = elm;
+	// Publish the cell: sequence pos -> pos + 1
+	ATOMIC_OP(add, fetch, &cell->sequence, 1);
+
+	// Only the producer that clears the waiters bit pays the syscall, so
+	// the rest of a burst of pushes does not enter the kernel
+	uint32_t wake_seq = RING_LOAD(&ring->wake_seq);
+	while (wake_seq & RING_WAITERS_BIT) {
+		const uint32_t next_seq = (wake_seq + 2 * RING_WAITERS_BIT) &
+					  ~RING_WAITERS_BIT;
+		if (__sync_bool_compare_and_swap(
+				    &ring->wake_seq, wake_seq, next_seq)) {
+			futex(&ring->wake_seq,
+			      FUTEX_WAKE_PRIVATE,
+			      INT_MAX,
+			      NULL);
+			break;
+		}
+		wake_seq = RING_LOAD(&ring->wake_seq);
+	}
+
+	return true;
+}
+
+void *rb_mpmc_ring_pop(struct rb_mpmc_ring *ring) {
+	struct rb_mpmc_ring_cell *cell = NULL;
+	size_t pos = RING_LOAD(&ring->dequeue_pos);
+
+	for (;;) {
+		cell = &ring->cells[pos & ring->mask];
+		const size_t seq = RING_LOAD(&cell->sequence);
+		const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (0 == diff) {
+			if (__sync_bool_compare_and_swap(
+					    &ring->dequeue_pos, pos, pos + 1)) {
+				break;
+			}
+			pos = RING_LOAD(&ring->dequeue_pos);
+		} else if (diff < 0) {
+			// Cell not produced yet
+			return NULL;
+		} else {
+			pos = RING_LOAD(&ring->dequeue_pos);
+		}
+	}
+
+	void *ret = cell->data;
+	// Release the cell for the next lap: sequence pos + 1 -> pos + capacity
+	ATOMIC_OP(add, fetch, &cell->sequence, ring->mask);
+	return ret;
+}
+
+void *rb_mpmc_ring_pop_wait(struct rb_mpmc_ring *ring, int tmo_ms) {
+	const uint64_t deadline_ms = rb_monotonic_ms() + (uint64_t)tmo_ms;
+	void *ret = NULL;
+
+	while (NULL == (ret = rb_mpmc_ring_pop(ring))) {
+		const uint64_t now_ms = rb_monotonic_ms();
+		if (now_ms >= deadline_ms) {
+			break;
+		}
+
+		const uint64_t wait_ms = deadline_ms - now_ms;
+		const struct timespec tmo = {
+				.tv_sec = (time_t)(wait_ms / 1000),
+				.tv_nsec = (long)(wait_ms % 1000) * 1000000,
+		};
+
+		// Announce ourselves before checking the ring again, so any
+		// producer that pushes after our check will see us waiting and
+		// will change wake_seq
+		const uint32_t wake_seq = ATOMIC_OP32(
+				or, fetch, &ring->wake_seq, RING_WAITERS_BIT);
+		ret = rb_mpmc_ring_pop(ring);
+		if (NULL == ret) {
+			futex(&ring->wake_seq,
+			      FUTEX_WAIT_PRIVATE,
+			      wake_seq,
+			      &tmo);
+		}
+	}
+
+	return ret;
+}
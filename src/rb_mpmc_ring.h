@@ -0,0 +1,91 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Cache line size, to avoid false sharing between producers and consumers
+#define RB_MPMC_RING_CACHELINE 64
+
+/// Ring cell
+struct rb_mpmc_ring_cell {
+	size_t sequence; ///< Cell turn
+	void *data;      ///< Cell element
+};
+
+/// Lock-free bounded multi-producer multi-consumer ring of pointers. Idle
+/// consumers can sleep in a futex until a producer pushes an element.
+struct rb_mpmc_ring {
+	// Private data - Do not use directly
+	struct rb_mpmc_ring_cell *cells; ///< Ring cells
+	size_t mask;			 ///< Ring capacity - 1
+
+	/// Next position to push
+	size_t enqueue_pos __attribute__((aligned(RB_MPMC_RING_CACHELINE)));
+	/// Next position to pop
+	size_t dequeue_pos __attribute__((aligned(RB_MPMC_RING_CACHELINE)));
+
+	/// Consumers futex. Bit 0 is set if there are consumers waiting, and
+	/// the rest of bits are incremented every time producers wake them.
+	uint32_t wake_seq __attribute__((aligned(RB_MPMC_RING_CACHELINE)));
+};
+
+/** Initialize a ring
+  @param ring Ring
+  @param size Ring capacity. It will be rounded up to a power of 2.
+  @return true if success, false in other case
+  */
+bool rb_mpmc_ring_init(struct rb_mpmc_ring *ring, size_t size);
+
+/** Release ring resources. Elements still in the ring are not released.
+  @param ring Ring
+  */
+void rb_mpmc_ring_done(struct rb_mpmc_ring *ring);
+
+/** Ring capacity
+  @param ring Ring
+  @return Max number of elements ring can hold
+  */
+static size_t rb_mpmc_ring_capacity(const struct rb_mpmc_ring *ring)
+		__attribute__((unused));
+static size_t rb_mpmc_ring_capacity(const struct rb_mpmc_ring *ring) {
+	return ring->mask + 1;
+}
+
+/** Push an element in the ring, and wake up waiting consumers if any
+  @param ring Ring
+  @param elm Element to push
+  @return true if pushed, false if ring was full
+  */
+bool rb_mpmc_ring_push(struct rb_mpmc_ring *ring, void *elm);
+
+/** Pop an element from the ring without waiting
+  @param ring Ring
+  @return Popped element, or NULL if ring was empty
+  */
+void *rb_mpmc_ring_pop(struct rb_mpmc_ring *ring);
+
+/** Pop an element from the ring, waiting for it if ring is empty
+  @param ring Ring
+  @param tmo_ms Max time to wait, in milliseconds
+  @return Popped element, or NULL if timeout expired
+  */
+void *rb_mpmc_ring_pop_wait(struct rb_mpmc_ring *ring, int tmo_ms);
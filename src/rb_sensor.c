@@ -34,6 +34,36 @@
 static const char SENSOR_NAME_ENRICHMENT_KEY[] = "sensor_name";
 static const char SENSOR_ID_ENRICHMENT_KEY[] = "sensor_id";
 
+/// Default max oids asked in the same SNMP request
+#define SENSOR_DEFAULT_MAX_OIDS_PER_PDU 32
+
+/// Name of the self-metric with the SNMP agent round trip time estimation
+static const char SENSOR_SNMP_RTT_MONITOR[] = "snmp_rtt_ms";
+/// Name of the self-metric with the SNMP agent health state changes
+static const char SENSOR_SNMP_HEALTH_MONITOR[] = "snmp_health";
+/// Name of the self-metric with the time needed to poll the sensor
+static const char SENSOR_POLL_DURATION_MONITOR[] = "poll_duration_ms";
+/// Name of the self-metric with the polling cycles skipped because of overrun
+static const char SENSOR_SKIPPED_CYCLES_MONITOR[] = "skipped_cycles";
+
+/// Max polling cycles to skip when SNMP agent does not answer
+#define SENSOR_SNMP_MAX_BACKOFF_CYCLES 64
+
+/// Consecutive failed cycles needed to stop polling a sensor, if sensor does
+/// not say otherwise
+static uint64_t sensor_default_max_snmp_fails = 2;
+
+/// SNMP agent health
+enum sensor_snmp_health {
+	/// Agent answered all requests of last cycle
+	SENSOR_SNMP_HEALTHY,
+	/// Some requests of last cycles timed out
+	SENSOR_SNMP_DEGRADED,
+	/// Agent did not answer in max_snmp_fails cycles, polling it only in
+	/// exponential backoff
+	SENSOR_SNMP_OPEN,
+};
+
 /// Sensor to monitor
 struct rb_sensor_s {
 #ifndef NDEBUG
@@ -41,11 +71,55 @@ struct rb_sensor_s {
 	uint64_t magic;
 #endif
 
-	struct monitor_snmp_session snmp_sess; ///< SNMP session
-	rb_monitors_array_t *monitors;	 ///< Monitors to ask for
+	/// SNMP sessions, one per monitor that can be evaluated in parallel
+	struct monitor_snmp_session *snmp_sess;
+	/// SNMP agent RTT estimator shared by all sessions. NULL if sensor
+	/// uses static timeouts.
+	struct snmp_rtt *snmp_rtt;
+	rb_monitor_t *snmp_rtt_monitor; ///< Self-metric to report snmp_rtt
+
+	/// SNMP agent circuit breaker. Only accessed with the sensor in flight.
+	struct {
+		/// Outcome of current cycle requests
+		struct snmp_requests_stats stats;
+		enum sensor_snmp_health state; ///< Current state
+		uint64_t max_fails; ///< Failed cycles to open (0 = never)
+		uint64_t fails;     ///< Consecutive failed cycles
+		uint64_t backoff;   ///< Cycles skipped the last time
+		uint64_t skip;      ///< Cycles still to skip
+		rb_monitor_t *monitor; ///< Self-metric to report state changes
+	} snmp_health;
+	rb_monitors_array_t *monitors; ///< Monitors to ask for
 	ssize_t **op_vars; ///< Operation variables that needs each monitor
+	struct rb_monitors_dag *monitors_dag; ///< Monitors dependency graph
+	size_t max_parallel_monitors; ///< Max monitors evaluated in parallel
+	size_t max_oids_per_pdu;      ///< Max oids in the same SNMP request
 	json_object *enrichment; ///< Enrichment to use in monitors
-	int refcnt;		 ///< Reference counting
+	/// Precision of messages timestamp
+	enum monitor_timestamp_precision timestamp_precision;
+	rb_monitor_t *poll_duration_monitor; ///< Self-metric of cycle duration
+	uint64_t poll_interval_ms; ///< Polling interval (0 = use default)
+	int in_flight;		   ///< A polling cycle is queued or running
+	/// Current cycle start, as messages timestamp. Only accessed with the
+	/// sensor in flight.
+	struct monitor_timestamp cycle_ts;
+	/// Current cycle start, in monotonic microseconds. 0 if the cycle was
+	/// not started with rb_sensor_cycle_begin.
+	uint64_t cycle_start_us;
+	uint64_t skipped_cycles;   ///< Cycles skipped because of overrun
+	/// Skipped cycles already reported. Only accessed with the sensor in
+	/// flight.
+	uint64_t reported_skipped_cycles;
+	rb_monitor_t *skipped_cycles_monitor; ///< Self-metric of skipped cycles
+	size_t last_worker; ///< Last worker that processed the sensor (atomic)
+	int refcnt;		   ///< Reference counting
+
+	/// SNMP responses of oid monitors obtained by the asynchronous engine,
+	/// waiting to be processed
+	struct monitor_value **snmp_async_values;
+	/// Asynchronous SNMP responses callback
+	void (*snmp_async_cb)(rb_sensor_t *sensor, void *opaque);
+	void *snmp_async_opaque; ///< Asynchronous SNMP responses opaque
 };
 
 #ifdef RB_SENSOR_MAGIC
@@ -74,14 +148,37 @@ const char *rb_sensor_name(const rb_sensor_t *sensor) {
 	return json_object_get_string(jsensor_name);
 }
 
+int64_t rb_sensor_id(const rb_sensor_t *sensor) {
+	assert(sensor);
+
+	json_object *jsensor_id = NULL;
+	const bool get_rc = json_object_object_get_ex(
+			sensor->enrichment, SENSOR_ID_ENRICHMENT_KEY, &jsensor_id);
+
+	return get_rc ? json_object_get_int64(jsensor_id) : 0;
+}
+
 /** Sensor enrichment information */
 struct sensor_enrichment {
 	const char *sensor_name; ///< Sensor name
 	int64_t sensor_id;       ///< Sensor id
 };
 
-monitor_snmp_session *rb_sensor_snmp_session(rb_sensor_t *sensor) {
-	return &sensor->snmp_sess;
+monitor_snmp_session *rb_sensor_snmp_session(rb_sensor_t *sensor, size_t i) {
+	assert(i < sensor->max_parallel_monitors);
+	return &sensor->snmp_sess[i];
+}
+
+size_t rb_sensor_max_parallel_monitors(const rb_sensor_t *sensor) {
+	return sensor->max_parallel_monitors;
+}
+
+size_t rb_sensor_max_oids_per_pdu(const rb_sensor_t *sensor) {
+	return sensor->max_oids_per_pdu;
+}
+
+uint64_t rb_sensor_poll_interval_ms(const rb_sensor_t *sensor) {
+	return sensor->poll_interval_ms;
 }
 
 /**
@@ -149,6 +246,50 @@ sensor_common_attrs_parse_json(rb_sensor_t *sensor,
 		goto err;
 	}
 
+	const int64_t poll_interval_ms = PARSE_CJSON_CHILD_INT64(
+			sensor_info, "poll_interval_ms", 0);
+	if (poll_interval_ms < 0) {
+		rdlog(LOG_ERR,
+		      "Invalid poll_interval_ms %" PRId64 " in sensor %s",
+		      poll_interval_ms,
+		      sensor_enrichment.sensor_name);
+		goto err;
+	}
+	sensor->poll_interval_ms = (uint64_t)poll_interval_ms;
+
+	const int64_t max_parallel_monitors = PARSE_CJSON_CHILD_INT64(
+			sensor_info, "max_parallel_monitors", 1);
+	if (max_parallel_monitors <= 0) {
+		rdlog(LOG_ERR,
+		      "Invalid max_parallel_monitors %" PRId64 " in sensor %s",
+		      max_parallel_monitors,
+		      sensor_enrichment.sensor_name);
+		goto err;
+	}
+	sensor->max_parallel_monitors = (size_t)max_parallel_monitors;
+
+	const int64_t max_oids_per_pdu = PARSE_CJSON_CHILD_INT64(
+			sensor_info,
+			"max_oids_per_pdu",
+			SENSOR_DEFAULT_MAX_OIDS_PER_PDU);
+	if (max_oids_per_pdu <= 0) {
+		rdlog(LOG_ERR,
+		      "Invalid max_oids_per_pdu %" PRId64 " in sensor %s",
+		      max_oids_per_pdu,
+		      sensor_enrichment.sensor_name);
+		goto err;
+	}
+	sensor->max_oids_per_pdu = (size_t)max_oids_per_pdu;
+
+	sensor->snmp_sess = calloc(sensor->max_parallel_monitors,
+				   sizeof(sensor->snmp_sess[0]));
+	if (alloc_unlikely(NULL == sensor->snmp_sess)) {
+		rdlog(LOG_CRIT,
+		      "Couldn't allocate sensor %s SNMP sessions (OOM?)",
+		      sensor_enrichment.sensor_name);
+		goto err;
+	}
+
 	json_object_object_get_ex(sensor_info, "monitors", &sensor_monitors);
 	if (NULL == sensor_monitors) {
 		rdlog(LOG_ERR,
@@ -184,6 +325,11 @@ sensor_common_attrs_parse_json(rb_sensor_t *sensor,
 		goto err;
 	}
 
+	if (NULL != sensor->op_vars) {
+		sensor->monitors_dag = rb_monitors_dag_new(sensor->monitors,
+							   sensor->op_vars);
+	}
+
 	return true;
 
 err:
@@ -208,9 +354,161 @@ static void sensor_set_defaults(rb_sensor_t *sensor) {
 #ifdef RB_SENSOR_MAGIC
 	sensor->magic = RB_SENSOR_MAGIC;
 #endif
+	sensor->last_worker = RB_SENSOR_NO_WORKER;
 	sensor->refcnt = 1;
 }
 
+/** Create sensor SNMP RTT estimator, so requests timeout follow agent
+  response times, and the self-metric that reports it if asked.
+  @param sensor Sensor, with SNMP sessions already created
+  @param report Report the estimation in every polling cycle
+  @return true if success, false in other case
+  */
+static bool sensor_snmp_rtt_init(rb_sensor_t *sensor, bool report) {
+	if (report) {
+		sensor->snmp_rtt_monitor = create_sensor_self_rb_monitor(
+				SENSOR_SNMP_RTT_MONITOR,
+				"ms",
+				sensor->enrichment);
+		if (alloc_unlikely(NULL == sensor->snmp_rtt_monitor)) {
+			goto err;
+		}
+	}
+
+	sensor->snmp_rtt = malloc(sizeof(*sensor->snmp_rtt));
+	if (alloc_unlikely(NULL == sensor->snmp_rtt)) {
+		goto err;
+	}
+
+	snmp_rtt_init(sensor->snmp_rtt,
+		      snmp_session_timeout_us(&sensor->snmp_sess[0]));
+	for (size_t i = 0; i < sensor->max_parallel_monitors; ++i) {
+		sensor->snmp_sess[i].rtt = sensor->snmp_rtt;
+	}
+
+	return true;
+
+err:
+	rdlog(LOG_CRIT,
+	      "Couldn't allocate sensor %s RTT estimator (OOM?)",
+	      rb_sensor_name(sensor));
+	return false;
+}
+
+/** Set up sensor SNMP circuit breaker
+  @param sensor Sensor, with SNMP sessions already created
+  @param sensor_info Sensor JSON
+  @return true if success, false in other case
+  */
+static bool sensor_snmp_health_init(rb_sensor_t *sensor,
+				    json_object *sensor_info) {
+	const int64_t max_snmp_fails = PARSE_CJSON_CHILD_INT64(
+			sensor_info,
+			"max_snmp_fails",
+			(int64_t)sensor_default_max_snmp_fails);
+	if (max_snmp_fails < 0) {
+		rdlog(LOG_WARNING,
+		      "Invalid max_snmp_fails %" PRId64 " in sensor %s, "
+		      "using %" PRIu64,
+		      max_snmp_fails,
+		      rb_sensor_name(sensor),
+		      sensor_default_max_snmp_fails);
+	}
+
+	sensor->snmp_health.max_fails = max_snmp_fails < 0
+						? sensor_default_max_snmp_fails
+						: (uint64_t)max_snmp_fails;
+	sensor->snmp_health.monitor = create_sensor_self_rb_monitor(
+			SENSOR_SNMP_HEALTH_MONITOR, NULL, sensor->enrichment);
+	if (alloc_unlikely(NULL == sensor->snmp_health.monitor)) {
+		rdlog(LOG_CRIT,
+		      "Couldn't allocate sensor %s health monitor (OOM?)",
+		      rb_sensor_name(sensor));
+		return false;
+	}
+
+	for (size_t i = 0; i < sensor->max_parallel_monitors; ++i) {
+		sensor->snmp_sess[i].stats = &sensor->snmp_health.stats;
+	}
+
+	return true;
+}
+
+/** Parse sensor messages timestamp precision, and create the poll duration
+  self-metric if sensor asks for it
+  @param sensor Sensor
+  @param sensor_info Sensor JSON
+  @return true if success, false in other case
+  */
+static bool sensor_parse_timestamp(rb_sensor_t *sensor,
+				   json_object *sensor_info) {
+	static const struct {
+		const char *name;
+		enum monitor_timestamp_precision precision;
+	} precisions[] = {
+			{"s", MONITOR_TIMESTAMP_S},
+			{"ms", MONITOR_TIMESTAMP_MS},
+			{"us", MONITOR_TIMESTAMP_US},
+	};
+
+	const char *precision = PARSE_CJSON_CHILD_STR(
+			sensor_info, "timestamp_precision", "s");
+	size_t i;
+	for (i = 0; i < RD_ARRAYSIZE(precisions); ++i) {
+		if (0 == strcmp(precisions[i].name, precision)) {
+			break;
+		}
+	}
+
+	if (i == RD_ARRAYSIZE(precisions)) {
+		rdlog(LOG_WARNING,
+		      "Invalid timestamp_precision %s in sensor %s, using "
+		      "seconds",
+		      precision,
+		      rb_sensor_name(sensor));
+		i = 0;
+	}
+	sensor->timestamp_precision = precisions[i].precision;
+
+	const bool poll_duration = PARSE_CJSON_CHILD_INT64(
+			sensor_info, "poll_duration", 0);
+	if (!poll_duration) {
+		return true;
+	}
+
+	sensor->poll_duration_monitor = create_sensor_self_rb_monitor(
+			SENSOR_POLL_DURATION_MONITOR, "ms", sensor->enrichment);
+	if (alloc_unlikely(NULL == sensor->poll_duration_monitor)) {
+		rdlog(LOG_CRIT,
+		      "Couldn't allocate sensor %s poll duration monitor "
+		      "(OOM?)",
+		      rb_sensor_name(sensor));
+		return false;
+	}
+
+	return true;
+}
+
+/** Create the self-metric that reports skipped polling cycles
+  @param sensor Sensor
+  @return true if success, false in other case
+  */
+static bool sensor_skipped_cycles_init(rb_sensor_t *sensor) {
+	sensor->skipped_cycles_monitor = create_sensor_self_rb_monitor(
+			SENSOR_SKIPPED_CYCLES_MONITOR,
+			NULL,
+			sensor->enrichment);
+	if (alloc_unlikely(NULL == sensor->skipped_cycles_monitor)) {
+		rdlog(LOG_CRIT,
+		      "Couldn't allocate sensor %s skipped cycles monitor "
+		      "(OOM?)",
+		      rb_sensor_name(sensor));
+		return false;
+	}
+
+	return true;
+}
+
 static bool sensor_parse_snmp(rb_sensor_t *sensor, json_object *sensor_info) {
 	const char *community =
 			PARSE_CJSON_CHILD_STR(sensor_info, "community", NULL);
@@ -260,7 +558,35 @@ static bool sensor_parse_snmp(rb_sensor_t *sensor, json_object *sensor_info) {
 		sess_config.peername = "localhost:161";
 	}
 
-	return new_snmp_session(&sensor->snmp_sess, &sess_config);
+	// Every monitor evaluated in parallel needs its own session
+	for (size_t i = 0; i < sensor->max_parallel_monitors; ++i) {
+		if (!new_snmp_session(&sensor->snmp_sess[i], &sess_config)) {
+			return false;
+		}
+	}
+
+	if (!sensor_snmp_health_init(sensor, sensor_info)) {
+		return false;
+	}
+
+	const bool adaptive_timeout = PARSE_CJSON_CHILD_INT64(
+			sensor_info, "adaptive_timeout", 0);
+	const bool snmp_rtt_metric = PARSE_CJSON_CHILD_INT64(
+			sensor_info, "snmp_rtt_metric", 0);
+	if (adaptive_timeout) {
+		return sensor_snmp_rtt_init(sensor, snmp_rtt_metric);
+	} else if (snmp_rtt_metric) {
+		rdlog(LOG_WARNING,
+		      "Sensor %s snmp_rtt_metric needs adaptive_timeout, "
+		      "ignoring it",
+		      rb_sensor_name(sensor));
+	}
+
+	return true;
+}
+
+void rb_sensor_set_default_max_snmp_fails(uint64_t max_snmp_fails) {
+	sensor_default_max_snmp_fails = max_snmp_fails;
 }
 
 /// @TODO make sensor_info const
@@ -278,6 +604,16 @@ rb_sensor_t *parse_rb_sensor(/* const */ json_object *sensor_info) {
 		goto sensor_common_attrs_err;
 	}
 
+	const bool timestamp_parser_ok =
+			sensor_parse_timestamp(ret, sensor_info);
+	if (unlikely(!timestamp_parser_ok)) {
+		goto timestamp_parse_err;
+	}
+
+	if (unlikely(!sensor_skipped_cycles_init(ret))) {
+		goto skipped_cycles_err;
+	}
+
 	const bool snmp_parser_ok = sensor_parse_snmp(ret, sensor_info);
 	if (unlikely(!snmp_parser_ok)) {
 		goto snmp_parse_err;
@@ -286,26 +622,323 @@ rb_sensor_t *parse_rb_sensor(/* const */ json_object *sensor_info) {
 	return ret;
 
 snmp_parse_err:
+skipped_cycles_err:
+timestamp_parse_err:
 sensor_common_attrs_err:
 	rb_sensor_put(ret);
 	return NULL;
 }
 
-/** Process a sensor
+/** Report a sensor self-metric numeric value
+  @param monitor Self-metric monitor
+  @param value Value to report
+  @param ts Messages timestamp
+  @param ret Messages returned
+  */
+static void sensor_report_self_metric(const rb_monitor_t *monitor,
+				      double value,
+				      const struct monitor_timestamp *ts,
+				      rb_message_list *ret) {
+	struct monitor_value *mv = new_monitor_value_double(value);
+	if (alloc_unlikely(NULL == mv)) {
+		rdlog(LOG_ERR,
+		      "Couldn't allocate %s value (OOM?)",
+		      rb_monitor_name(monitor));
+		return;
+	}
+
+	rb_message_array_t *msgs = print_monitor_value(mv, monitor, ts);
+	if (msgs) {
+		rb_message_list_push(ret, msgs);
+	}
+	rb_monitor_value_done(mv);
+}
+
+/** Report SNMP agent estimated round trip time
+  @param sensor Sensor
+  @param ts Messages timestamp
+  @param ret Messages returned
+  */
+static void sensor_report_snmp_rtt(rb_sensor_t *sensor,
+				   const struct monitor_timestamp *ts,
+				   rb_message_list *ret) {
+	uint64_t srtt_us = 0;
+	if (!snmp_rtt_srtt_us(sensor->snmp_rtt, &srtt_us)) {
+		// No response yet
+		return;
+	}
+
+	sensor_report_self_metric(sensor->snmp_rtt_monitor,
+				  (double)srtt_us / 1000,
+				  ts,
+				  ret);
+}
+
+/** Stop polling a sensor which SNMP agent does not answer, doubling the
+  cycles to skip every time
+  @param sensor Sensor
+  */
+static void sensor_snmp_health_open(rb_sensor_t *sensor) {
+	const uint64_t backoff = sensor->snmp_health.backoff;
+	sensor->snmp_health.state = SENSOR_SNMP_OPEN;
+	sensor->snmp_health.backoff = backoff ? 2 * backoff : 1;
+	if (sensor->snmp_health.backoff > SENSOR_SNMP_MAX_BACKOFF_CYCLES) {
+		sensor->snmp_health.backoff = SENSOR_SNMP_MAX_BACKOFF_CYCLES;
+	}
+	sensor->snmp_health.skip = sensor->snmp_health.backoff;
+	rdlog(LOG_WARNING,
+	      "Sensor %s does not answer SNMP requests, skipping its next "
+	      "%" PRIu64 " polling cycles",
+	      rb_sensor_name(sensor),
+	      sensor->snmp_health.skip);
+}
+
+static const char *sensor_snmp_health_str(enum sensor_snmp_health state) {
+	switch (state) {
+	case SENSOR_SNMP_HEALTHY:
+		return "healthy";
+	case SENSOR_SNMP_DEGRADED:
+		return "degraded";
+	case SENSOR_SNMP_OPEN:
+		return "open";
+	default:
+		return "unknown";
+	};
+}
+
+/** Report a SNMP agent health state change
+  @param sensor Sensor
+  @param ts Messages timestamp
+  @param ret Messages returned
+  */
+static void sensor_report_snmp_health(rb_sensor_t *sensor,
+				      const struct monitor_timestamp *ts,
+				      rb_message_list *ret) {
+	char *state_str = strdup(
+			sensor_snmp_health_str(sensor->snmp_health.state));
+	struct monitor_value *health_value =
+			state_str ? new_monitor_value_strn(state_str,
+							   strlen(state_str))
+				  : NULL;
+	if (alloc_unlikely(NULL == health_value)) {
+		rdlog(LOG_ERR, "Couldn't allocate health value (OOM?)");
+		free(state_str);
+		return;
+	}
+
+	rb_message_array_t *msgs = print_monitor_value(
+			health_value, sensor->snmp_health.monitor, ts);
+	if (msgs) {
+		rb_message_list_push(ret, msgs);
+	}
+	rb_monitor_value_done(health_value);
+}
+
+/** Update SNMP agent health with the requests of the cycle that has just
+  finished.
   @param sensor Sensor
+  @param ts Messages timestamp
   @param ret Messages returned
-  @return true if OK, false in other case
   */
-bool process_rb_sensor(rb_sensor_t *sensor, rb_message_list *ret) {
-	return process_monitors_array(
-			sensor, sensor->monitors, sensor->op_vars, ret);
+static void sensor_update_snmp_health(rb_sensor_t *sensor,
+				      const struct monitor_timestamp *ts,
+				      rb_message_list *ret) {
+	struct snmp_requests_stats *stats = &sensor->snmp_health.stats;
+	const uint64_t answered = ATOMIC_OP(fetch, and, &stats->answered, 0);
+	const uint64_t timeouts = ATOMIC_OP(fetch, and, &stats->timeouts, 0);
+	const enum sensor_snmp_health prev_state = sensor->snmp_health.state;
+
+	if (0 == answered && 0 == timeouts) {
+		// No SNMP requests in this cycle
+		return;
+	}
+
+	if (0 == timeouts) {
+		sensor->snmp_health.state = SENSOR_SNMP_HEALTHY;
+		sensor->snmp_health.fails = 0;
+		sensor->snmp_health.backoff = 0;
+	} else if (answered > 0) {
+		// Agent is alive, but it is losing requests
+		sensor->snmp_health.state = SENSOR_SNMP_DEGRADED;
+		sensor->snmp_health.fails = 0;
+		sensor->snmp_health.backoff = 0;
+	} else if (sensor->snmp_health.max_fails > 0 &&
+		   ++sensor->snmp_health.fails >=
+				   sensor->snmp_health.max_fails) {
+		sensor_snmp_health_open(sensor);
+	} else {
+		sensor->snmp_health.state = SENSOR_SNMP_DEGRADED;
+	}
+
+	if (prev_state != sensor->snmp_health.state) {
+		rdlog(LOG_INFO,
+		      "Sensor %s SNMP health changed from %s to %s",
+		      rb_sensor_name(sensor),
+		      sensor_snmp_health_str(prev_state),
+		      sensor_snmp_health_str(sensor->snmp_health.state));
+		sensor_report_snmp_health(sensor, ts, ret);
+	}
+}
+
+/** Take current time as the start of sensor polling cycle
+  @param sensor Sensor
+  */
+static void sensor_cycle_start(rb_sensor_t *sensor) {
+	monitor_timestamp_now(&sensor->cycle_ts, sensor->timestamp_precision);
+	sensor->cycle_start_us = rb_monotonic_us();
+}
+
+bool process_rb_sensor(rb_sensor_t *sensor,
+		       struct rb_arena *arena,
+		       rb_message_list *ret) {
+	struct monitor_value **snmp_values = sensor->snmp_async_values;
+	sensor->snmp_async_values = NULL;
+
+	if (0 == sensor->cycle_start_us) {
+		sensor_cycle_start(sensor);
+	}
+
+	// All messages of the cycle share the same timestamp, so they land in
+	// the same time bucket downstream
+	const struct monitor_timestamp *ts = &sensor->cycle_ts;
+	const bool process_rc = process_monitors_array(sensor,
+						       sensor->monitors,
+						       sensor->op_vars,
+						       sensor->monitors_dag,
+						       snmp_values,
+						       arena,
+						       ts,
+						       ret);
+
+	if (sensor->snmp_health.monitor) {
+		sensor_update_snmp_health(sensor, ts, ret);
+	}
+
+	if (sensor->snmp_rtt_monitor) {
+		sensor_report_snmp_rtt(sensor, ts, ret);
+	}
+
+	if (sensor->poll_duration_monitor) {
+		// Includes the time waiting for asynchronous SNMP responses
+		const uint64_t duration_us =
+				rb_monotonic_us() - sensor->cycle_start_us;
+		sensor_report_self_metric(sensor->poll_duration_monitor,
+					  (double)duration_us / 1000,
+					  ts,
+					  ret);
+	}
+
+	// Only report when there are new skipped cycles, so healthy sensors
+	// do not send anything
+	const uint64_t skipped_cycles =
+			ATOMIC_OP(add, fetch, &sensor->skipped_cycles, 0);
+	if (skipped_cycles != sensor->reported_skipped_cycles) {
+		sensor_report_self_metric(
+				sensor->skipped_cycles_monitor,
+				(double)(skipped_cycles -
+					 sensor->reported_skipped_cycles),
+				ts,
+				ret);
+		sensor->reported_skipped_cycles = skipped_cycles;
+	}
+
+	sensor->cycle_start_us = 0;
+	return process_rc;
+}
+
+/** Asynchronous SNMP responses callback
+  @param vsensor Sensor
+  */
+static void sensor_snmp_async_cb(void *vsensor) {
+	rb_sensor_t *sensor = vsensor;
+	sensor->snmp_async_cb(sensor, sensor->snmp_async_opaque);
+}
+
+bool rb_sensor_snmp_async_prefetch(
+		rb_sensor_t *sensor,
+		struct rb_snmp_engine *engine,
+		void (*cb)(rb_sensor_t *sensor, void *opaque),
+		void *opaque) {
+	if (NULL == sensor->monitors || NULL == sensor->snmp_sess) {
+		return false;
+	}
+
+	// Responses array need to be in sensor before the engine can answer
+	sensor->snmp_async_values = calloc(
+			sensor->monitors->count,
+			sizeof(sensor->snmp_async_values[0]));
+	if (alloc_unlikely(NULL == sensor->snmp_async_values)) {
+		rdlog(LOG_ERR,
+		      "Couldn't allocate sensor %s SNMP responses (OOM?)",
+		      rb_sensor_name(sensor));
+		return false;
+	}
+
+	sensor->snmp_async_cb = cb;
+	sensor->snmp_async_opaque = opaque;
+	const bool prefetch_rc =
+			monitors_snmp_async_prefetch(sensor,
+						     sensor->monitors,
+						     engine,
+						     sensor->snmp_async_values,
+						     sensor_snmp_async_cb,
+						     sensor);
+	if (!prefetch_rc) {
+		free(sensor->snmp_async_values);
+		sensor->snmp_async_values = NULL;
+	}
+
+	return prefetch_rc;
+}
+
+bool rb_sensor_snmp_async_ready(const rb_sensor_t *sensor) {
+	return NULL != sensor->snmp_async_values;
+}
+
+void rb_sensor_snmp_async_discard(rb_sensor_t *sensor) {
+	if (NULL == sensor->snmp_async_values) {
+		return;
+	}
+
+	for (size_t i = 0; i < sensor->monitors->count; ++i) {
+		if (sensor->snmp_async_values[i]) {
+			rb_monitor_value_done(sensor->snmp_async_values[i]);
+		}
+	}
+	free(sensor->snmp_async_values);
+	sensor->snmp_async_values = NULL;
 }
 
 /** Free allocated memory for sensor
   @param sensor Sensor to free
   */
 static void sensor_done(rb_sensor_t *sensor) {
-	destroy_snmp_session(&sensor->snmp_sess);
+	rb_sensor_snmp_async_discard(sensor);
+	for (size_t i = 0;
+	     sensor->snmp_sess && i < sensor->max_parallel_monitors;
+	     ++i) {
+		destroy_snmp_session(&sensor->snmp_sess[i]);
+	}
+	free(sensor->snmp_sess);
+	if (sensor->snmp_rtt) {
+		snmp_rtt_done(sensor->snmp_rtt);
+		free(sensor->snmp_rtt);
+	}
+	if (sensor->snmp_rtt_monitor) {
+		rb_monitor_done(sensor->snmp_rtt_monitor);
+	}
+	if (sensor->snmp_health.monitor) {
+		rb_monitor_done(sensor->snmp_health.monitor);
+	}
+	if (sensor->poll_duration_monitor) {
+		rb_monitor_done(sensor->poll_duration_monitor);
+	}
+	if (sensor->skipped_cycles_monitor) {
+		rb_monitor_done(sensor->skipped_cycles_monitor);
+	}
+	if (sensor->monitors_dag) {
+		rb_monitors_dag_done(sensor->monitors_dag);
+	}
 	if (sensor->op_vars) {
 		free_monitors_dependencies(sensor->op_vars,
 					   sensor->monitors->count);
@@ -319,6 +952,48 @@ static void sensor_done(rb_sensor_t *sensor) {
 	free(sensor);
 }
 
+bool rb_sensor_cycle_begin(rb_sensor_t *sensor) {
+	if (0 == ATOMIC_OP(fetch, or, &sensor->in_flight, 1)) {
+		if (sensor->snmp_health.skip > 0) {
+			// SNMP agent is not answering, wait for backoff
+			sensor->snmp_health.skip--;
+			rb_sensor_cycle_end(sensor);
+			return false;
+		}
+		sensor_cycle_start(sensor);
+		return true;
+	}
+
+	const uint64_t skipped =
+			ATOMIC_OP(add, fetch, &sensor->skipped_cycles, 1);
+	if (0 == (skipped & (skipped - 1))) {
+		// Only log when skipped cycles reach a power of two, so an
+		// overloaded deployment does not flood the log
+		rdlog(LOG_WARNING,
+		      "Sensor %s previous polling cycle is still in flight, "
+		      "skipping this one (%" PRIu64 " cycles skipped)",
+		      rb_sensor_name(sensor),
+		      skipped);
+	}
+	return false;
+}
+
+void rb_sensor_cycle_end(rb_sensor_t *sensor) {
+	ATOMIC_OP(fetch, and, &sensor->in_flight, 0);
+}
+
+uint64_t rb_sensor_cycle_start_us(const rb_sensor_t *sensor) {
+	return sensor->cycle_start_us;
+}
+
+size_t rb_sensor_last_worker(const rb_sensor_t *sensor) {
+	return __atomic_load_n(&sensor->last_worker, __ATOMIC_RELAXED);
+}
+
+void rb_sensor_set_last_worker(rb_sensor_t *sensor, size_t worker_id) {
+	__atomic_store_n(&sensor->last_worker, worker_id, __ATOMIC_RELAXED);
+}
+
 void rb_sensor_get(rb_sensor_t *sensor) {
 	ATOMIC_OP(add, fetch, &sensor->refcnt, 1);
 }
@@ -28,6 +28,7 @@
 #include <librdkafka/rdkafka.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct rb_sensor_s rb_sensor_t;
 
@@ -38,7 +39,28 @@ void assert_rb_sensor(rb_sensor_t *sensor);
 #endif
 
 rb_sensor_t *parse_rb_sensor(/* const */ json_object *sensor_info);
-bool process_rb_sensor(rb_sensor_t *sensor, rb_message_list *ret);
+
+struct rb_arena;
+
+/** Process a sensor polling cycle. Messages timestamp and poll duration are
+  relative to rb_sensor_cycle_begin call, or to this call if the cycle was not
+  started with it.
+  @param sensor Sensor
+  @param arena Allocator for the temporaries of the cycle. Caller needs to
+  reset it when the function returns.
+  @param ret Messages returned
+  @return true if OK, false in other case
+  */
+bool process_rb_sensor(rb_sensor_t *sensor,
+		       struct rb_arena *arena,
+		       rb_message_list *ret);
+
+/** Set how many consecutive polling cycles without any SNMP response are
+  needed to stop polling a sensor, for sensors that do not set their own
+  max_snmp_fails. Need to be called before parsing sensors.
+  @param max_snmp_fails Failed cycles. 0 means never stop polling.
+  */
+void rb_sensor_set_default_max_snmp_fails(uint64_t max_snmp_fails);
 
 /** Obtains sensor name
   @param sensor Sensor
@@ -46,6 +68,50 @@ bool process_rb_sensor(rb_sensor_t *sensor, rb_message_list *ret);
   */
 const char *rb_sensor_name(const rb_sensor_t *sensor);
 
+/** Obtains sensor id
+  @param sensor Sensor
+  @return Sensor id, or 0 if sensor has no id.
+  */
+int64_t rb_sensor_id(const rb_sensor_t *sensor);
+
+/** Mark a sensor polling cycle as started, if the previous one has finished.
+  In other case, increase sensor skipped cycles counter. Cycles are also
+  skipped while sensor SNMP agent is in backoff because it did not answer.
+  Start time is taken here, and used as timestamp of all cycle messages.
+  @param sensor Sensor
+  @return true if new cycle can start, false if previous one is still in
+  flight
+  */
+bool rb_sensor_cycle_begin(rb_sensor_t *sensor);
+
+/** Mark a sensor polling cycle as finished
+  @param sensor Sensor
+  */
+void rb_sensor_cycle_end(rb_sensor_t *sensor);
+
+/** Start time of current sensor polling cycle. Only valid while the cycle is
+  being processed.
+  @param sensor Sensor
+  @return Cycle start, in monotonic microseconds
+  */
+uint64_t rb_sensor_cycle_start_us(const rb_sensor_t *sensor);
+
+/// Sensor has not been processed by any worker yet
+#define RB_SENSOR_NO_WORKER SIZE_MAX
+
+/** Last worker that processed the sensor, so the sensor can be queued in the
+  same worker next time.
+  @param sensor Sensor
+  @return Worker id, or RB_SENSOR_NO_WORKER
+  */
+size_t rb_sensor_last_worker(const rb_sensor_t *sensor);
+
+/** Set last worker that processed the sensor
+  @param sensor Sensor
+  @param worker_id Worker id
+  */
+void rb_sensor_set_last_worker(rb_sensor_t *sensor, size_t worker_id);
+
 /** Increase by 1 the reference counter for sensor
   @param sensor Sensor
   @todo this is not needed if we use proper enrichment
@@ -78,5 +144,56 @@ rb_sensor_array_add(rb_sensors_array_t *array, rb_sensor_t *sensor) {
 	rb_array_add(array, sensor);
 }
 
-/** Sensor snmp session */
-monitor_snmp_session *rb_sensor_snmp_session(rb_sensor_t *sensor);
+/** Sensor snmp session
+  @param sensor Sensor
+  @param i Session index, in [0, rb_sensor_max_parallel_monitors)
+  @return SNMP session
+  */
+monitor_snmp_session *rb_sensor_snmp_session(rb_sensor_t *sensor, size_t i);
+
+/** Max number of monitors of a sensor that can be evaluated in parallel
+  @param sensor Sensor
+  @return Max parallel monitors
+  */
+size_t rb_sensor_max_parallel_monitors(const rb_sensor_t *sensor);
+
+/** Max number of oids of a sensor that can be asked in the same SNMP request
+  @param sensor Sensor
+  @return Max oids per PDU. If 1, every oid monitor does its own request.
+  */
+size_t rb_sensor_max_oids_per_pdu(const rb_sensor_t *sensor);
+
+struct rb_snmp_engine;
+
+/** Ask for all sensor oid monitors using the asynchronous SNMP engine. When
+  all responses are received, cb is called from engine thread, and the next
+  process_rb_sensor call will use them.
+  @param sensor Sensor
+  @param engine SNMP engine
+  @param cb Callback to call when responses are ready
+  @param opaque Callback opaque
+  @return true if requests are in flight, false if the sensor has nothing to
+  ask for asynchronously. If false, cb will not be called.
+  */
+bool rb_sensor_snmp_async_prefetch(
+		rb_sensor_t *sensor,
+		struct rb_snmp_engine *engine,
+		void (*cb)(rb_sensor_t *sensor, void *opaque),
+		void *opaque);
+
+/** Check if sensor has asynchronous SNMP responses waiting to be processed
+  @param sensor Sensor
+  @return true if next process_rb_sensor will use asynchronous responses
+  */
+bool rb_sensor_snmp_async_ready(const rb_sensor_t *sensor);
+
+/** Discard asynchronous SNMP responses not processed
+  @param sensor Sensor
+  */
+void rb_sensor_snmp_async_discard(rb_sensor_t *sensor);
+
+/** Sensor polling interval
+  @param sensor Sensor
+  @return Polling interval in milliseconds, or 0 if sensor did not specify it
+  */
+uint64_t rb_sensor_poll_interval_ms(const rb_sensor_t *sensor);
@@ -24,8 +24,10 @@
 #include "rb_sensor.h"
 
 #include "poller/system.h"
-#include "rb_libmatheval.h"
+#include "rb_arena.h"
+#include "rb_expr.h"
 #include "rb_snmp.h"
+#include "rb_split_op.h"
 
 #include "rb_json.h"
 
@@ -33,7 +35,10 @@
 #include <librd/rdlog.h>
 
 #include <math.h>
-#include <matheval.h>
+#include <string.h>
+
+/// Default max table rows asked in each walk request
+#define RB_MONITOR_DEFAULT_MAX_REPETITIONS 25
 
 /// X-macro to define monitor operations
 /// _X(menum,cmd,value_type,fn)
@@ -48,9 +53,30 @@
 	   "oid",                                                              \
 	   "snmp",                                                             \
 	   rb_monitor_get_snmp_external_value)                                 \
+	/* Will walk a SNMP table column, returning a vector */                \
+	_X(RB_MONITOR_T__WALK,                                                 \
+	   "walk",                                                             \
+	   "snmp",                                                             \
+	   rb_monitor_get_snmp_walk_value)                                     \
 	/* Will operate over previous results */                               \
 	_X(RB_MONITOR_T__OP, "op", "op", rb_monitor_get_op_result)
 
+/// Previous sample of a rate monitor value
+struct rb_monitor_rate_sample {
+	bool valid;		///< There is a previous sample
+	unsigned counter_bits;  ///< Previous value counter width
+	uint64_t counter;	///< Previous counter value
+	double value;		///< Previous value
+};
+
+/// State of a monitor that reports per-second rates
+struct rb_monitor_rate {
+	uint64_t ts_us; ///< Previous samples time
+	size_t count;   ///< Number of samples (1 if monitor is not a vector)
+	uint64_t index_hash; ///< Walk rows index hash of previous samples
+	struct rb_monitor_rate_sample *samples; ///< Previous samples
+};
+
 struct rb_monitor_s {
 	enum monitor_cmd_type {
 #define _X(menum, cmd, type, fn) menum,
@@ -66,10 +92,22 @@ struct rb_monitor_s {
 	const char *instance_prefix;
 	bool send;	    ///< Send the monitor to output or not
 	bool integer;	 ///< Response must be an integer
+	/// Send values as JSON numbers, not as strings
+	bool json_number;
 	const char *splittok; ///< How to split response
-	const char *splitop;  ///< Do a final operation with tokens
+	struct rb_split_ops *splitop; ///< Final operations over vectors
 	const char *cmd_arg;  ///< Argument given to command
+	/// Resolved cmd_arg, if monitor is a SNMP one
+	struct snmp_oid snmp_oid;
+	long max_repetitions; ///< Walk rows asked in each request
+	/// Previous samples, if monitor reports rates instead of values. Only
+	/// accessed by the worker that is processing the sensor.
+	struct rb_monitor_rate *rate;
+	/// Operation compiled at parse time, if monitor is an op one
+	struct rb_expr *op;
 	json_object *enrichment;
+	/// Messages immutable parts, rendered at parse time
+	struct monitor_value_template template;
 };
 
 static const char *rb_monitor_type(const rb_monitor_t *monitor) {
@@ -95,6 +133,11 @@ const json_object *rb_monitor_enrichment(const rb_monitor_t *monitor) {
 	return monitor->enrichment;
 }
 
+const struct monitor_value_template *
+rb_monitor_template(const rb_monitor_t *monitor) {
+	return &monitor->template;
+}
+
 const char *rb_monitor_instance_prefix(const rb_monitor_t *monitor) {
 	return monitor->instance_prefix;
 }
@@ -103,10 +146,18 @@ const char *rb_monitor_name_split_suffix(const rb_monitor_t *monitor) {
 	return monitor->name_split_suffix;
 }
 
+const struct rb_split_ops *rb_monitor_split_ops(const rb_monitor_t *monitor) {
+	return monitor->splitop;
+}
+
 bool rb_monitor_is_integer(const rb_monitor_t *monitor) {
 	return monitor->integer;
 }
 
+bool rb_monitor_json_number(const rb_monitor_t *monitor) {
+	return monitor->json_number;
+}
+
 bool rb_monitor_send(const rb_monitor_t *monitor) {
 	return monitor->send;
 }
@@ -115,53 +166,46 @@ const char *rb_monitor_get_cmd_data(const rb_monitor_t *monitor) {
 	return monitor->argument;
 }
 
+bool rb_monitor_is_oid(const rb_monitor_t *monitor) {
+	return RB_MONITOR_T__OID == monitor->type;
+}
+
+const struct snmp_oid *rb_monitor_oid(const rb_monitor_t *monitor) {
+	return rb_monitor_is_oid(monitor) ? &monitor->snmp_oid : NULL;
+}
+
 void rb_monitor_get_op_variables(const rb_monitor_t *monitor,
 				 char ***vars,
 				 size_t *vars_size) {
-	void *evaluator = NULL;
 	(*vars) = NULL;
 	*vars_size = 0;
 
-	struct {
-		char **vars;
-		int count;
-	} all_vars;
-
-	if (monitor->type != RB_MONITOR_T__OP) {
-		goto no_deps;
-	}
-
-	evaluator = evaluator_create((char *)monitor->cmd_arg);
-	if (NULL == evaluator) {
-		rdlog(LOG_ERR,
-		      "Couldn't create an evaluator from %s",
-		      monitor->cmd_arg);
+	const size_t vars_count = monitor->op ? rb_expr_vars_count(monitor->op)
+					      : 0;
+	if (0 == vars_count) {
 		goto no_deps;
 	}
 
-	evaluator_get_variables(evaluator, &all_vars.vars, &all_vars.count);
-	(*vars) = malloc((size_t)all_vars.count * sizeof((*vars)[0]));
+	(*vars) = malloc(vars_count * sizeof((*vars)[0]));
 	if (*vars == NULL) {
 		rdlog(LOG_CRIT,
-		      "Couldn't allocate memory for %d vars",
-		      all_vars.count);
+		      "Couldn't allocate memory for %zu vars",
+		      vars_count);
 		goto no_deps;
 	}
-	for (int i = 0; i < all_vars.count; ++i) {
-		(*vars)[i] = strdup(all_vars.vars[i]);
+	for (size_t i = 0; i < vars_count; ++i) {
+		const char *var = rb_expr_var_name(monitor->op, i);
+		(*vars)[i] = strdup(var);
 		if (NULL == (*vars)[i]) {
-			rdlog(LOG_ERR,
-			      "Couldn't strdup %s (OOM?)",
-			      all_vars.vars[i]);
-			for (int j = 0; j < i; ++j) {
+			rdlog(LOG_ERR, "Couldn't strdup %s (OOM?)", var);
+			for (size_t j = 0; j < i; ++j) {
 				free((*vars)[j]);
 				(*vars)[j] = NULL;
 			}
 			goto no_deps;
 		}
 	}
-	*vars_size = (size_t)all_vars.count;
-	evaluator_destroy(evaluator);
+	*vars_size = vars_count;
 	return;
 
 no_deps:
@@ -170,10 +214,6 @@ no_deps:
 	}
 	*vars = NULL;
 	*vars_size = 0;
-
-	if (evaluator) {
-		evaluator_destroy(evaluator);
-	}
 }
 
 void rb_monitor_free_op_variables(char **vars, size_t vars_size) {
@@ -192,17 +232,51 @@ static void free_const_str(const char *str) {
 	free(aux);
 }
 
+/** Create rate monitor state
+  @return New rate state, or NULL if error
+  */
+static struct rb_monitor_rate *rb_monitor_rate_new(void) {
+	struct rb_monitor_rate *ret = calloc(1, sizeof(*ret));
+	if (alloc_unlikely(NULL == ret)) {
+		return NULL;
+	}
+
+	ret->samples = calloc(1, sizeof(ret->samples[0]));
+	if (alloc_unlikely(NULL == ret->samples)) {
+		free(ret);
+		return NULL;
+	}
+
+	ret->count = 1;
+	return ret;
+}
+
+static void rb_monitor_rate_done(struct rb_monitor_rate *rate) {
+	free(rate->samples);
+	free(rate);
+}
+
 void rb_monitor_done(rb_monitor_t *monitor) {
 	free_const_str(monitor->name);
 	free_const_str(monitor->argument);
 	free_const_str(monitor->name_split_suffix);
 	free_const_str(monitor->instance_prefix);
 	free_const_str(monitor->splittok);
-	free_const_str(monitor->splitop);
+	if (monitor->splitop) {
+		rb_split_ops_done(monitor->splitop);
+	}
+	snmp_oid_done(&monitor->snmp_oid);
+	if (monitor->rate) {
+		rb_monitor_rate_done(monitor->rate);
+	}
+	if (monitor->op) {
+		rb_expr_done(monitor->op);
+	}
 	free_const_str(monitor->cmd_arg);
 	if (monitor->enrichment) {
 		json_object_put(monitor->enrichment);
 	}
+	monitor_value_template_done(&monitor->template);
 	free(monitor);
 }
 
@@ -232,20 +306,6 @@ extract_monitor_cmd(enum monitor_cmd_type *type,
 	return NULL;
 }
 
-/** Checks if a split operation is valid
-  @param split_op requested split op
-  @return true if valid, valse in other case
-  */
-static bool valid_split_op(const char *split_op) {
-	const char *ops[] = {"sum", "mean"};
-	for (size_t i = 0; i < RD_ARRAYSIZE(ops); ++i) {
-		if (0 == strcmp(ops[i], split_op)) {
-			return true;
-		}
-	}
-	return false;
-}
-
 /** Parse a JSON monitor
   @param type Type of monitor (oid, system, op...)
   @param cmd_arg Argument of monitor (desired oid, system command, operation...)
@@ -265,19 +325,20 @@ static rb_monitor_t *parse_rb_monitor0(enum monitor_cmd_type type,
 		return NULL;
 	}
 
-	char *aux_split_op = PARSE_CJSON_CHILD_DUP_STR(
-			json_monitor, "split_op", NULL);
 	char *unit = PARSE_CJSON_CHILD_DUP_STR(json_monitor, "unit", NULL);
 	char *group_name = PARSE_CJSON_CHILD_DUP_STR(
 			json_monitor, "group_name", NULL);
 
-	if (aux_split_op && !valid_split_op(aux_split_op)) {
+	int64_t max_repetitions = PARSE_CJSON_CHILD_INT64(
+			json_monitor,
+			"max_repetitions",
+			RB_MONITOR_DEFAULT_MAX_REPETITIONS);
+	if (max_repetitions <= 0) {
 		rdlog(LOG_WARNING,
-		      "Invalid split op %s of monitor %s",
-		      aux_split_op,
+		      "Invalid max_repetitions %" PRId64 " of monitor %s",
+		      max_repetitions,
 		      aux_name);
-		free(aux_split_op);
-		aux_split_op = NULL;
+		max_repetitions = RB_MONITOR_DEFAULT_MAX_REPETITIONS;
 	}
 
 	/// tmp monitor to locate all string parameters
@@ -285,13 +346,14 @@ static rb_monitor_t *parse_rb_monitor0(enum monitor_cmd_type type,
 	if (NULL == ret) {
 		rdlog(LOG_ERR, "Can't alloc sensor monitor (out of memory?)");
 		free(aux_name);
-		free(aux_split_op);
 		free(unit);
 		return NULL;
 	}
 
 	ret->splittok = PARSE_CJSON_CHILD_DUP_STR(json_monitor, "split", NULL);
-	ret->splitop = aux_split_op;
+	json_object *json_split_op = NULL;
+	json_object_object_get_ex(json_monitor, "split_op", &json_split_op);
+	ret->splitop = rb_split_ops_parse(json_split_op, aux_name);
 	ret->name = aux_name;
 	ret->name_split_suffix = PARSE_CJSON_CHILD_DUP_STR(
 			json_monitor, "name_split_suffix", NULL);
@@ -299,8 +361,20 @@ static rb_monitor_t *parse_rb_monitor0(enum monitor_cmd_type type,
 			json_monitor, "instance_prefix", NULL);
 	ret->send = PARSE_CJSON_CHILD_INT64(json_monitor, "send", 1);
 	ret->integer = PARSE_CJSON_CHILD_INT64(json_monitor, "integer", 0);
+	ret->json_number =
+			PARSE_CJSON_CHILD_INT64(json_monitor, "json_number", 0);
+	ret->max_repetitions = (long)max_repetitions;
 	ret->type = type;
 	ret->cmd_arg = strdup(cmd_arg);
+	if (PARSE_CJSON_CHILD_INT64(json_monitor, "rate", 0)) {
+		ret->rate = rb_monitor_rate_new();
+		if (alloc_unlikely(NULL == ret->rate)) {
+			rdlog(LOG_CRIT, "Couldn't allocate rate state (OOM?)");
+			rb_monitor_done(ret);
+			ret = NULL;
+			goto err;
+		}
+	}
 
 	ret->enrichment = json_object_object_copy(sensor_enrichment);
 	if (NULL == ret->enrichment) {
@@ -344,6 +418,36 @@ static rb_monitor_t *parse_rb_monitor0(enum monitor_cmd_type type,
 		rdlog(LOG_CRIT, "Couldn't allocate cmd_arg (OOM?)");
 		rb_monitor_done(ret);
 		ret = NULL;
+		goto err;
+	}
+
+	// Resolve oid only once, not in every poll
+	const bool snmp_monitor = RB_MONITOR_T__OID == ret->type ||
+				  RB_MONITOR_T__WALK == ret->type;
+	if (snmp_monitor && !snmp_oid_init(&ret->snmp_oid, ret->cmd_arg)) {
+		rdlog(LOG_ERR, "Ignoring monitor %s", ret->name);
+		rb_monitor_done(ret);
+		ret = NULL;
+		goto err;
+	}
+
+	// Compile operation only once, not in every poll
+	if (RB_MONITOR_T__OP == ret->type &&
+	    NULL == (ret->op = rb_expr_compile(ret->cmd_arg))) {
+		rdlog(LOG_ERR, "Ignoring monitor %s", ret->name);
+		rb_monitor_done(ret);
+		ret = NULL;
+		goto err;
+	}
+
+	// Name, instance and enrichment don't change, so render them once
+	if (!monitor_value_template_init(&ret->template,
+					 ret->name,
+					 ret->name_split_suffix,
+					 ret->instance_prefix,
+					 ret->enrichment)) {
+		rb_monitor_done(ret);
+		ret = NULL;
 	}
 
 err:
@@ -370,8 +474,13 @@ parse_rb_monitor(json_object *json_monitor,
 	return NULL;
 }
 
-rb_monitor_t *
-create_snmp_trap_rb_monitor(const char *name, json_object *enrichment) {
+/** Create a monitor that only prints values given to it
+  @param name Monitor name
+  @param enrichment Enrichment of monitor messages. Monitor takes ownership.
+  @return New monitor, or NULL if error
+  */
+static rb_monitor_t *create_print_rb_monitor(const char *name,
+					     json_object *enrichment) {
 	char *monitor_name = strdup(name);
 	if (alloc_unlikely(NULL == monitor_name)) {
 		rdlog(LOG_ERR, "Couldn't allocate monitor name");
@@ -385,6 +494,16 @@ create_snmp_trap_rb_monitor(const char *name, json_object *enrichment) {
 		return NULL;
 	}
 
+	if (!monitor_value_template_init(&ret->template,
+					 monitor_name,
+					 NULL,
+					 NULL,
+					 enrichment)) {
+		free(monitor_name);
+		free(ret);
+		return NULL;
+	}
+
 	ret->type = RB_MONITOR_T__OID;
 	ret->name = monitor_name;
 	ret->send = true;
@@ -392,74 +511,184 @@ create_snmp_trap_rb_monitor(const char *name, json_object *enrichment) {
 	return ret;
 }
 
+rb_monitor_t *
+create_snmp_trap_rb_monitor(const char *name, json_object *enrichment) {
+	return create_print_rb_monitor(name, enrichment);
+}
+
+rb_monitor_t *
+create_sensor_self_rb_monitor(const char *name,
+			      const char *unit,
+			      const json_object *sensor_enrichment) {
+	json_object *enrichment = json_object_object_copy(
+			(json_object *)sensor_enrichment);
+	if (alloc_unlikely(NULL == enrichment)) {
+		rdlog(LOG_ERR, "Couldn't allocate monitor enrichment (OOM?)");
+		return NULL;
+	}
+
+	json_object_object_add(
+			enrichment, "type", json_object_new_string("snmp"));
+	if (unit) {
+		json_object_object_add(enrichment,
+				       "unit",
+				       json_object_new_string(unit));
+	}
+
+	rb_monitor_t *ret = create_print_rb_monitor(name, enrichment);
+	if (alloc_unlikely(NULL == ret)) {
+		json_object_put(enrichment);
+	}
+
+	return ret;
+}
+
 /** Context of sensor monitors processing */
 struct process_sensor_monitor_ctx {
 	struct monitor_snmp_session *snmp_sessp; ///< Base SNMP session
+	uint64_t cycle_us;      ///< Polling cycle start, time base of rates
+	struct rb_arena *arena; ///< Cycle temporaries allocator
 };
 
 struct process_sensor_monitor_ctx *
-new_process_sensor_monitor_ctx(struct monitor_snmp_session *snmp_sessp) {
-	struct process_sensor_monitor_ctx *ret = calloc(1, sizeof(*ret));
+new_process_sensor_monitor_ctx(struct monitor_snmp_session *snmp_sessp,
+			       uint64_t cycle_us,
+			       struct rb_arena *arena) {
+	struct process_sensor_monitor_ctx *ret =
+			arena ? rb_arena_calloc(arena, 1, sizeof(*ret)) : NULL;
 	if (NULL == ret) {
 		rdlog(LOG_ERR, "Couldn't allocate process sensor monitors ctx");
 	} else {
 		ret->snmp_sessp = snmp_sessp;
+		ret->cycle_us = cycle_us;
+		ret->arena = arena;
 	}
 
 	return ret;
 }
 
-void destroy_process_sensor_monitor_ctx(
-		struct process_sensor_monitor_ctx *ctx) {
-	free(ctx);
+struct rb_arena *
+process_sensor_monitor_ctx_arena(struct process_sensor_monitor_ctx *ctx) {
+	return ctx->arena;
 }
 
-/** Base function to obtain an external value, and to manage it as a vector or
-  as an integer
-  @param monitor Monitor to process
-  @param get_value_cb Callback to get value
-  @param get_value_cb_ctx Context send to get_value_cb
-  @return Monitor values array
+/** Create the monitor value of split ops results
+  @param ops Split ops
+  @param results Split ops results
+  @return New monitor value. If split ops need to be tagged with their names,
+  it will be a vector with one element per split op.
   */
 static struct monitor_value *
-rb_monitor_get_external_value(const rb_monitor_t *monitor,
-			      struct monitor_value *(*get_value_cb)(
-					      const char *arg, void *ctx),
-			      void *get_value_cb_ctx) {
-	struct monitor_value *ret =
-			get_value_cb(monitor->cmd_arg, get_value_cb_ctx);
+rb_monitor_split_op_value(const struct rb_split_ops *ops,
+			  const double *results) {
+	if (!ops->named) {
+		return new_monitor_value_double(results[0]);
+	}
+
+	struct monitor_value *ret = new_monitor_value_vector(ops->count);
+	if (alloc_unlikely(NULL == ret)) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < ops->count; ++i) {
+		monitor_value_vector_set(ret, i, results[i]);
+	}
+
+	return ret;
+}
 
+/** Compute monitor split ops over vector values
+  @param process_ctx Process context
+  @param monitor Monitor
+  @param vector Vector
+  @return Split ops result, or NULL if monitor has no split op or there are no
+  values
+  */
+static struct monitor_value *
+rb_monitor_split_op_result(struct process_sensor_monitor_ctx *process_ctx,
+			   const rb_monitor_t *monitor,
+			   const struct monitor_value *vector) {
+	const struct rb_split_ops *ops = monitor->splitop;
+	if (NULL == ops) {
+		return NULL;
+	}
+
+	const size_t vector_count = vector->array.count;
+	double *values = rb_arena_alloc(process_ctx->arena,
+					(vector_count + ops->count) *
+							sizeof(values[0]));
+	if (alloc_unlikely(NULL == values)) {
+		rdlog(LOG_ERR, "Couldn't allocate split op values (OOM?)");
+		return NULL;
+	}
+	double *results = &values[vector_count];
+
+	// Split ops reorder values, so they need a copy of the vector ones
+	size_t count = 0;
+	for (size_t i = 0; i < vector_count; ++i) {
+		if (monitor_value_vector_valid(vector, i)) {
+			values[count++] = vector->array.values[i];
+		}
+	}
+
+	const bool compute_rc =
+			rb_split_ops_compute(ops, values, count, results);
+	return compute_rc ? rb_monitor_split_op_value(ops, results) : NULL;
+}
+
+struct monitor_value *
+rb_monitor_process_external_value(
+		struct process_sensor_monitor_ctx *process_ctx,
+		const rb_monitor_t *monitor,
+		struct monitor_value *ret) {
 	if (unlikely(!ret)) {
 		return NULL;
 	}
 
 	if (monitor->splittok) {
-		const bool array_rc = new_monitor_value_array_from_string(
-				ret, monitor->splittok, monitor->splitop);
-		if (unlikely(!array_rc)) {
-			rb_monitor_value_done(ret);
+		struct monitor_value *vector =
+				new_monitor_value_vector_from_string(
+						ret, monitor->splittok);
+		rb_monitor_value_done(ret);
+		if (unlikely(!vector)) {
 			return NULL;
 		}
+
+		vector->array.split_op_result = rb_monitor_split_op_result(
+				process_ctx, monitor, vector);
+		return vector;
 	}
 
 	return ret;
 }
 
+/** Base function to obtain an external value, and to manage it as a vector or
+  as an integer
+  @param process_ctx Process context
+  @param monitor Monitor to process
+  @param get_value_cb Callback to get value
+  @param get_value_cb_ctx Context send to get_value_cb
+  @return Monitor values array
+  */
+static struct monitor_value *
+rb_monitor_get_external_value(struct process_sensor_monitor_ctx *process_ctx,
+			      const rb_monitor_t *monitor,
+			      struct monitor_value *(*get_value_cb)(
+					      const char *arg, void *ctx),
+			      void *get_value_cb_ctx) {
+	struct monitor_value *value =
+			get_value_cb(monitor->cmd_arg, get_value_cb_ctx);
+	return rb_monitor_process_external_value(process_ctx, monitor, value);
+}
+
 /** Convenience function to obtain system values */
 static struct monitor_value *rb_monitor_get_system_external_value(
 		const rb_monitor_t *monitor,
 		struct process_sensor_monitor_ctx *process_ctx,
 		rb_monitor_value_array_t *ops_vars) {
-	(void)process_ctx;
 	(void)ops_vars;
 	return rb_monitor_get_external_value(
-			monitor, system_solve_response, NULL);
-}
-
-/// Wrapper function to transform void -> snmp_session
-static monitor_value *
-snmp_solve_response0(const char *oid_string, void *snmp_session) {
-	return snmp_query_response(oid_string, snmp_session);
+			process_ctx, monitor, system_solve_response, NULL);
 }
 
 /** Convenience function to obtain SNMP values */
@@ -468,202 +697,406 @@ static struct monitor_value *rb_monitor_get_snmp_external_value(
 		struct process_sensor_monitor_ctx *process_ctx,
 		rb_monitor_value_array_t *op_vars) {
 	(void)op_vars;
-	return rb_monitor_get_external_value(
-			monitor, snmp_solve_response0, process_ctx->snmp_sessp);
+	struct monitor_value *value = snmp_query_response(
+			&monitor->snmp_oid, process_ctx->snmp_sessp);
+	return rb_monitor_process_external_value(process_ctx, monitor, value);
 }
 
-/** Create a libmatheval vars using op_vars */
-static struct libmatheval_vars *
-op_libmatheval_vars(rb_monitor_value_array_t *op_vars, char **names) {
-	struct libmatheval_vars *libmatheval_vars =
-			new_libmatheval_vars(op_vars->count);
-	size_t expected_v_elms = 0;
-	if (NULL == libmatheval_vars) {
-		/// @todo error treatment
-		return NULL;
+/** Convenience function to walk SNMP tables */
+static struct monitor_value *
+rb_monitor_get_snmp_walk_value(const rb_monitor_t *monitor,
+			       struct process_sensor_monitor_ctx *process_ctx,
+			       rb_monitor_value_array_t *op_vars) {
+	(void)op_vars;
+	struct monitor_value *ret = snmp_walk_response(&monitor->snmp_oid,
+						       monitor->max_repetitions,
+						       process_ctx->snmp_sessp);
+	if (ret) {
+		ret->array.split_op_result = rb_monitor_split_op_result(
+				process_ctx, monitor, ret);
 	}
 
-	for (size_t i = 0; i < op_vars->count; ++i) {
-		assert(rb_monitor_value_array_at(op_vars, 0)->type ==
-		       rb_monitor_value_array_at(op_vars, i)->type);
+	return ret;
+}
 
-		struct monitor_value *mv =
-				rb_monitor_value_array_at(op_vars, i);
+/** Per-second rate of a value, and save it as the previous sample
+  @param prev Previous sample
+  @param valid There is a current value
+  @param value Current value
+  @param counter_bits If value is a counter, its width. 0 in other case. Only
+  32 bits counters wrap around: if a 64 bits one goes back, the agent has
+  restarted or the counter has been reset.
+  @param counter Current counter exact value
+  @param elapsed_s Seconds since previous sample
+  @param rate Computed rate
+  @return true if rate could be computed, false in other case
+  */
+static bool rb_monitor_rate_sample(struct rb_monitor_rate_sample *prev,
+				   bool valid,
+				   double value,
+				   unsigned counter_bits,
+				   uint64_t counter,
+				   double elapsed_s,
+				   double *rate) {
+	const struct rb_monitor_rate_sample last = *prev;
+
+	if (!valid) {
+		prev->valid = false;
+		return false;
+	}
 
-		if (mv) {
-			libmatheval_vars->names[i] = names[i];
-
-			if (0 == libmatheval_vars->count) {
-				if (MONITOR_VALUE_T__ARRAY == mv->type) {
-					expected_v_elms =
-							mv->array.children_count;
-				}
-			} else if (mv->type == MONITOR_VALUE_T__ARRAY &&
-				   mv->array.children_count !=
-						   expected_v_elms) {
-				rdlog(LOG_ERR,
-				      "trying to operate on vectors of "
-				      "different size:"
-				      "[(previous size):%zu] != [%s:%zu]",
-				      expected_v_elms,
-				      names[i],
-				      mv->array.children_count);
-				goto err;
-			}
+	prev->valid = true;
+	prev->counter_bits = counter_bits;
+	prev->counter = counter;
+	prev->value = value;
+
+	if (!last.valid || elapsed_s <= 0) {
+		return false;
+	}
 
-			libmatheval_vars->count++;
+	double delta = 0;
+	if (32 == counter_bits && counter_bits == last.counter_bits) {
+		// Unsigned arithmetic takes care of the counter wrap
+		delta = (double)((counter - last.counter) & UINT32_MAX);
+	} else if (counter_bits && counter_bits == last.counter_bits) {
+		if (counter < last.counter) {
+			// Discontinuity. Current sample is the new baseline
+			return false;
 		}
+		delta = (double)(counter - last.counter);
+	} else {
+		delta = value - last.value;
 	}
 
-	return libmatheval_vars;
-err:
-	delete_libmatheval_vars(libmatheval_vars);
-	return NULL;
+	*rate = delta / elapsed_s;
+	return true;
 }
 
-/** Do a monitor operation
-  @param f evaluator
-  @param libmatheval_vars prepared libmathevals with names and values
-  @param monitor Monitor operation belongs
-  @return New monitor value
+/** Replace a value with its per-second rate
+  @param prev Previous sample
+  @param mv Current value. Function takes ownership of it. Can be NULL.
+  @param elapsed_s Seconds since previous sample
+  @return Rate value, or NULL if it can't be computed
   */
 static struct monitor_value *
-rb_monitor_op_value0(void *f,
-		     struct libmatheval_vars *libmatheval_vars,
-		     const rb_monitor_t *monitor) {
+rb_monitor_rate_value(struct rb_monitor_rate_sample *prev,
+		      struct monitor_value *mv,
+		      double elapsed_s) {
+	double rate = 0;
+	const bool valid = mv && MONITOR_VALUE_T__DOUBLE == mv->type;
+	const bool rate_rc = rb_monitor_rate_sample(
+			prev,
+			valid,
+			valid ? mv->value.value_d : 0,
+			valid ? mv->value.counter_bits : 0,
+			valid ? mv->value.counter : 0,
+			elapsed_s,
+			&rate);
+	if (mv) {
+		rb_monitor_value_done(mv);
+	}
 
-	const char *operation = monitor->cmd_arg;
-	const double number = evaluator_evaluate(f,
-						 libmatheval_vars->count,
-						 libmatheval_vars->names,
-						 libmatheval_vars->values);
+	return rate_rc ? new_monitor_value_double(rate) : NULL;
+}
 
-	rdlog(LOG_DEBUG,
-	      "Result of operation [%s]: %lf",
-	      monitor->cmd_arg,
-	      number);
+/** Make room for rate samples of a vector. If vector length changes, previous
+  samples are discarded.
+  @param rate Rate state
+  @param count Vector length
+  @return true if success, false in other case
+  */
+static bool rb_monitor_rate_resize(struct rb_monitor_rate *rate,
+				   size_t count) {
+	if (count == rate->count) {
+		return true;
+	}
 
-	if (!isnormal(number)) {
+	struct rb_monitor_rate_sample *samples =
+			calloc(count ? count : 1, sizeof(samples[0]));
+	if (alloc_unlikely(NULL == samples)) {
+		return false;
+	}
+
+	free(rate->samples);
+	rate->samples = samples;
+	rate->count = count;
+	return true;
+}
+
+struct monitor_value *
+rb_monitor_rate(struct process_sensor_monitor_ctx *process_ctx,
+		const rb_monitor_t *monitor,
+		struct monitor_value *value) {
+	struct rb_monitor_rate *rate = monitor->rate;
+	if (NULL == rate) {
+		return value;
+	}
+
+	const uint64_t now_us = process_ctx->cycle_us;
+	const double elapsed_s = (double)(now_us - rate->ts_us) / 1000000;
+	rate->ts_us = now_us;
+
+	if (NULL == value || MONITOR_VALUE_T__ARRAY != value->type) {
+		rb_monitor_rate_resize(rate, 1);
+		return rb_monitor_rate_value(
+				&rate->samples[0], value, elapsed_s);
+	}
+
+	if (!rb_monitor_rate_resize(rate, value->array.count)) {
 		rdlog(LOG_ERR,
-		      "OP %s return a bad value: %lf. Skipping.",
-		      operation,
-		      number);
+		      "Couldn't allocate monitor %s rate samples (OOM?)",
+		      monitor->name);
+		rb_monitor_value_done(value);
 		return NULL;
 	}
 
-	return new_monitor_value(number);
+	if (value->array.index_hash != rate->index_hash) {
+		// Walk rows are not the same table rows than previous samples
+		memset(rate->samples,
+		       0,
+		       rate->count * sizeof(rate->samples[0]));
+		rate->index_hash = value->array.index_hash;
+	}
+
+	// Rates replace values in place, so vector elements will not be
+	// counters anymore
+	uint64_t *counters = value->array.counters;
+	const unsigned counter_bits = counters ? value->array.counter_bits : 0;
+	value->array.counters = NULL;
+	value->array.plain = true;
+
+	for (size_t i = 0; i < value->array.count; ++i) {
+		double i_rate = 0;
+		const bool rate_rc = rb_monitor_rate_sample(
+				&rate->samples[i],
+				monitor_value_vector_valid(value, i),
+				value->array.values[i],
+				counter_bits,
+				counters ? counters[i] : 0,
+				elapsed_s,
+				&i_rate);
+		if (rate_rc) {
+			monitor_value_vector_set(value, i, i_rate);
+		} else {
+			monitor_value_vector_unset(value, i);
+		}
+	}
+	free(counters);
+
+	// Split op need to be done over rates
+	if (value->array.split_op_result) {
+		rb_monitor_value_done(value->array.split_op_result);
+	}
+	value->array.split_op_result =
+			rb_monitor_split_op_result(process_ctx, monitor, value);
+
+	return value;
 }
 
-/** Do a monitor value operation, with no array involved
-  @param f Evaluator
-  @param op_vars Operations variables with names
-  @param monitor Montior this operation belongs
-  @return new monitor value with operation result
+/// Operation variables and result, in columns
+struct rb_monitor_op_columns {
+	size_t rows;	     ///< Rows of every column
+	double *values;      ///< Scalar variables values
+	const double **vars; ///< Variables columns
+	bool *scalars;	     ///< Variables that are scalars
+	double *result;      ///< Result of a scalar operation
+	void *scratch;	     ///< Expression evaluation stack
+};
+
+/** Create operation columns
+  @param arena Allocator of the columns
+  @param expr Operation expression
+  @param vars_count Number of variables
+  @param rows Rows of every column
+  @return New operation columns, valid until arena reset
   */
-static struct monitor_value *
-rb_monitor_op_value(void *f,
-		    rb_monitor_value_array_t *op_vars,
-		    struct libmatheval_vars *libmatheval_vars,
-		    const rb_monitor_t *monitor) {
+static struct rb_monitor_op_columns *
+rb_monitor_op_columns_new(struct rb_arena *arena,
+			  const struct rb_expr *expr,
+			  size_t vars_count,
+			  size_t rows) {
+	struct rb_monitor_op_columns *ret = NULL;
+	const size_t scratch_size = rb_expr_scratch_size(expr);
+	const size_t alloc_size = sizeof(*ret) + scratch_size +
+				  (vars_count + 1) * sizeof(double) +
+				  vars_count * sizeof(ret->vars[0]) +
+				  vars_count * sizeof(ret->scalars[0]);
+
+	ret = rb_arena_calloc(arena, 1, alloc_size);
+	if (alloc_unlikely(NULL == ret)) {
+		rdlog(LOG_ERR, "Couldn't allocate operation columns (OOM?)");
+		return NULL;
+	}
 
-	/* Foreach variable in operation, value */
-	for (size_t v = 0; v < op_vars->count; ++v) {
-		const struct monitor_value *mv_v =
-				rb_monitor_value_array_at(op_vars, v);
-		assert(mv_v);
-		assert(MONITOR_VALUE_T__ARRAY != mv_v->type);
-		libmatheval_vars->values[v] = monitor_value_double(mv_v);
+	ret->rows = rows;
+	// Scratch goes first, so it is aligned for doubles and pointers
+	ret->scratch = &ret[1];
+	ret->values = (void *)((char *)ret->scratch + scratch_size);
+	ret->result = &ret->values[vars_count];
+	ret->vars = (void *)&ret->result[1];
+	ret->scalars = (void *)&ret->vars[vars_count];
+
+	return ret;
+}
+
+/** Check that operation variables can be operated together: all vectors
+  must have the same size, and scalars will be broadcasted to all vectors
+  elements.
+  @param monitor Monitor operation belongs
+  @param op_vars Operation variables
+  @param rows Number of rows of variables: vectors size, or 1 if there are only
+  scalars
+  @param vector If result is a vector
+  @return true if variables can be operated, false in other case
+  */
+static bool rb_monitor_op_rows(const rb_monitor_t *monitor,
+			       rb_monitor_value_array_t *op_vars,
+			       size_t *rows,
+			       bool *vector) {
+	*rows = 1;
+	*vector = false;
+
+	for (size_t i = 0; i < op_vars->count; ++i) {
+		if (NULL == op_vars->elms[i]) {
+			// We don't have this value, so we can't do operation
+			return false;
+		}
+
+		const struct monitor_value *mv =
+				rb_monitor_value_array_at(op_vars, i);
+		if (MONITOR_VALUE_T__ARRAY != mv->type) {
+			continue;
+		}
+
+		if (!*vector) {
+			*vector = true;
+			*rows = mv->array.count;
+		} else if (mv->array.count != *rows) {
+			rdlog(LOG_ERR,
+			      "trying to operate on vectors of "
+			      "different size:"
+			      "[(previous size):%zu] != [%s:%zu]",
+			      *rows,
+			      rb_expr_var_name(monitor->op, i),
+			      mv->array.count);
+			return false;
+		}
 	}
 
-	return rb_monitor_op_value0(f, libmatheval_vars, monitor);
+	return *rows > 0;
 }
 
-/** Gets an operation result of vector position i
-  @param f evaluator
-  @param libmatheval_vars Libmatheval prepared variables
-  @param v_pos Vector position we want to evaluate
-  @param monitor Monitor this operation belongs
-  @return Montior value with vector index i of the result
-  @todo merge with rb_monitor_op_value
+/** Fill operation columns with variables values. Vectors are operated in
+  place, without copying them.
+  @param columns Operation columns
+  @param op_vars Operation variables
   */
-static struct monitor_value *
-rb_monitor_op_vector_i(void *f,
-		       rb_monitor_value_array_t *op_vars,
-		       struct libmatheval_vars *libmatheval_vars,
-		       size_t v_pos,
-		       const rb_monitor_t *monitor) {
-	/* Foreach variable in operation, use element i of vector */
+static void rb_monitor_op_columns_fill(struct rb_monitor_op_columns *columns,
+				       rb_monitor_value_array_t *op_vars) {
 	for (size_t v = 0; v < op_vars->count; ++v) {
-		const struct monitor_value *mv_v =
+		const struct monitor_value *mv =
 				rb_monitor_value_array_at(op_vars, v);
-		assert(mv_v);
-		assert(MONITOR_VALUE_T__ARRAY == mv_v->type);
 
-		const struct monitor_value *mv_v_i =
-				mv_v->array.children[v_pos];
-		if (NULL == mv_v_i) {
-			// We don't have this value, so we can't do operation
-			return NULL;
+		if (MONITOR_VALUE_T__ARRAY != mv->type) {
+			columns->scalars[v] = true;
+			columns->values[v] = monitor_value_double(mv);
+			columns->vars[v] = &columns->values[v];
+		} else {
+			columns->vars[v] = mv->array.values;
 		}
+	}
+}
 
-		assert(MONITOR_VALUE_T__ARRAY != mv_v_i->type);
+/** Create the monitor value of an operation result
+  @param monitor Monitor operation belongs
+  @param number Operation result
+  @return New monitor value, or NULL if result is not valid
+  */
+static struct monitor_value *rb_monitor_op_value(const rb_monitor_t *monitor,
+						 double number) {
+	rdlog(LOG_DEBUG,
+	      "Result of operation [%s]: %lf",
+	      monitor->cmd_arg,
+	      number);
 
-		libmatheval_vars->values[v] = monitor_value_double(mv_v_i);
+	if (!isnormal(number)) {
+		rdlog(LOG_ERR,
+		      "OP %s return a bad value: %lf. Skipping.",
+		      monitor->cmd_arg,
+		      number);
+		return NULL;
 	}
 
-	return rb_monitor_op_value0(f, libmatheval_vars, monitor);
+	return new_monitor_value(number);
 }
 
-/** Makes a vector operation
-  @param f libmatheval evaluator
-  @param op_vars Monitor values of operation variables
-  @param libmatheval_vars Libmatheval variables template
+/** Makes a vector operation result
+  @param process_ctx Process context
   @param monitor Monitor this operation belongs
-  @todo op_vars should be const
+  @param op_vars Operation variables
+  @param columns Operation columns
+  @return New vector monitor value
   */
 static struct monitor_value *
-rb_monitor_op_vector(void *f,
+rb_monitor_op_vector(struct process_sensor_monitor_ctx *process_ctx,
+		     const rb_monitor_t *monitor,
 		     rb_monitor_value_array_t *op_vars,
-		     struct libmatheval_vars *libmatheval_vars,
-		     const rb_monitor_t *monitor) {
-	double sum = 0;
-	size_t count = 0;
-	const struct monitor_value *mv_0 =
-			rb_monitor_value_array_at(op_vars, 0);
-	struct monitor_value *split_op = NULL;
-	struct monitor_value **children =
-			calloc(mv_0->array.children_count, sizeof(children[0]));
-	if (NULL == children) {
+		     const struct rb_monitor_op_columns *columns) {
+	const size_t rows = columns->rows;
+	struct monitor_value *ret = new_monitor_value_vector(rows);
+	if (NULL == ret) {
 		/* @todo Error treatment */
 		rdlog(LOG_ERR,
 		      "Couldn't create monitor value %s"
-		      " children (out of memory?)",
+		      " vector (out of memory?)",
 		      monitor->name);
 		return NULL;
 	}
 
-	// Foreach member of vector
-	for (size_t i = 0; i < mv_0->array.children_count; ++i) {
-		children[i] = rb_monitor_op_vector_i(
-				f, op_vars, libmatheval_vars, i, monitor);
+	// We don't have a row value if we miss any vector variable value in it
+	const size_t words = monitor_value_vector_valid_words(rows);
+	memset(ret->array.valid, 0xff, words * sizeof(ret->array.valid[0]));
+	if (rows % 64) {
+		ret->array.valid[words - 1] = (UINT64_C(1) << (rows % 64)) - 1;
+	}
 
-		if (NULL != children[i]) {
-			sum += monitor_value_double(children[i]);
-			count++;
+	for (size_t v = 0; v < op_vars->count; ++v) {
+		const struct monitor_value *mv =
+				rb_monitor_value_array_at(op_vars, v);
+		if (MONITOR_VALUE_T__ARRAY != mv->type) {
+			continue;
+		}
+
+		for (size_t w = 0; w < words; ++w) {
+			ret->array.valid[w] &= mv->array.valid[w];
 		}
-	} /* foreach member of vector */
+	}
 
-	if (monitor->splitop && count > 0) {
-		const double split_op_value =
-				0 == strcmp(monitor->splitop, "sum")
-						? sum
-						: sum / count;
+	rb_expr_eval(monitor->op,
+		     columns->vars,
+		     columns->scalars,
+		     rows,
+		     columns->scratch,
+		     ret->array.values);
 
-		split_op = new_monitor_value(split_op_value);
+	for (size_t i = 0; i < rows; ++i) {
+		if (!monitor_value_vector_valid(ret, i)) {
+			continue;
+		}
+
+		const double number = ret->array.values[i];
+		if (!isnormal(number)) {
+			rdlog(LOG_ERR,
+			      "OP %s return a bad value: %lf. Skipping.",
+			      monitor->cmd_arg,
+			      number);
+			monitor_value_vector_unset(ret, i);
+		}
 	}
 
-	return new_monitor_value_array(
-			mv_0->array.children_count, children, split_op);
+	ret->array.split_op_result =
+			rb_monitor_split_op_result(process_ctx, monitor, ret);
+	return ret;
 }
 
 /** Process an operation monitor
@@ -676,53 +1109,37 @@ static struct monitor_value *
 rb_monitor_get_op_result(const rb_monitor_t *monitor,
 			 struct process_sensor_monitor_ctx *process_ctx,
 			 rb_monitor_value_array_t *op_vars) {
-	(void)process_ctx;
-	struct monitor_value *ret = NULL;
-	const char *operation = monitor->cmd_arg;
-
-	struct {
-		char **vars;
-		int vars_len;
-	} f_vars;
+	size_t rows = 0;
+	bool vector = false;
 
 	/// @todo error treatment in this cases
-	if (NULL == op_vars) {
+	if (NULL == op_vars || 0 == op_vars->count) {
 		return NULL;
 	}
 
-	if (0 == op_vars->count) {
+	if (!rb_monitor_op_rows(monitor, op_vars, &rows, &vector)) {
 		return NULL;
 	}
 
-	void *const f = evaluator_create((char *)operation);
-	if (NULL == f) {
-		rdlog(LOG_ERR,
-		      "Couldn't create evaluator (invalid op [%s]?",
-		      operation);
+	struct rb_monitor_op_columns *columns = rb_monitor_op_columns_new(
+			process_ctx->arena, monitor->op, op_vars->count, rows);
+	if (NULL == columns) {
 		return NULL;
 	}
 
-	evaluator_get_variables(f, &f_vars.vars, &f_vars.vars_len);
-
-	struct libmatheval_vars *libmatheval_vars =
-			op_libmatheval_vars(op_vars, f_vars.vars);
-	if (NULL == libmatheval_vars) {
-		goto libmatheval_error;
+	rb_monitor_op_columns_fill(columns, op_vars);
+	if (vector) {
+		return rb_monitor_op_vector(
+				process_ctx, monitor, op_vars, columns);
 	}
 
-	const struct monitor_value *mv_0 =
-			rb_monitor_value_array_at(op_vars, 0);
-	if (mv_0) {
-		ret = ((MONITOR_VALUE_T__ARRAY == mv_0->type)
-				       ? rb_monitor_op_vector
-				       : rb_monitor_op_value)(
-				f, op_vars, libmatheval_vars, monitor);
-	}
-
-	delete_libmatheval_vars(libmatheval_vars);
-libmatheval_error:
-	evaluator_destroy(f);
-	return ret;
+	rb_expr_eval(monitor->op,
+		     columns->vars,
+		     columns->scalars,
+		     rows,
+		     columns->scratch,
+		     columns->result);
+	return rb_monitor_op_value(monitor, columns->result[0]);
 }
 
 struct monitor_value *
@@ -28,6 +28,7 @@
 
 /* FW declaration */
 struct rb_sensor_s;
+struct rb_split_ops;
 struct _worker_info;
 
 /// Single monitor
@@ -48,23 +49,44 @@ parse_rb_monitor(json_object *json_monitor, json_object *sensor_enrichment);
 rb_monitor_t *
 create_snmp_trap_rb_monitor(const char *name, json_object *enrichment);
 
+/** Create a monitor to report a sensor self-metric, like SNMP agent round
+  trip time. Its messages carry the sensor enrichment.
+  @param name Monitor name
+  @param unit Monitor unit. Can be NULL.
+  @param sensor_enrichment Sensor enrichment. It is copied.
+  @return New monitor, or NULL if error
+  */
+rb_monitor_t *
+create_sensor_self_rb_monitor(const char *name,
+			      const char *unit,
+			      const json_object *sensor_enrichment);
+
 /** Free resources allocated by a monitor
   @param monitor Monitor to free
   */
 void rb_monitor_done(rb_monitor_t *monitor);
 
+struct rb_arena;
+
 /** Creates a new monitor process ctx
-  @param monitors_count # of monitors
   @param snmp_sessp Session to make SNMP request
-  @return New monitor process ctx
+  @param cycle_us Polling cycle start, in monotonic microseconds. It is the
+  time base of rates.
+  @param arena Allocator for the temporaries of the cycle. Only the thread
+  that uses the context can use it.
+  @return New monitor process ctx, valid until arena reset
   */
 struct process_sensor_monitor_ctx *
-new_process_sensor_monitor_ctx(struct monitor_snmp_session *snmp_sessp);
+new_process_sensor_monitor_ctx(struct monitor_snmp_session *snmp_sessp,
+			       uint64_t cycle_us,
+			       struct rb_arena *arena);
 
-/** Destroy process sensor monitor context
-  @param ctx Context to free
+/** Gets process context cycle temporaries allocator
+  @param ctx Process context
+  @return requested data
   */
-void destroy_process_sensor_monitor_ctx(struct process_sensor_monitor_ctx *ctx);
+struct rb_arena *
+process_sensor_monitor_ctx_arena(struct process_sensor_monitor_ctx *ctx);
 
 /// @todo delete this FW declaration
 struct rb_sensor_s;
@@ -80,6 +102,34 @@ process_sensor_monitor(struct process_sensor_monitor_ctx *process_ctx,
 		       const rb_monitor_t *monitor,
 		       rb_monitor_value_array_t *op_vars);
 
+/** Transform a monitor value into its per-second rate since previous one, if
+  monitor reports rates. Elapsed time is taken from the process context cycle
+  start, so delays evaluating the monitor do not change the rate. Need to be
+  called only once per polling cycle, and by only one thread at a time.
+  @param process_ctx Process context
+  @param monitor Monitor value belongs
+  @param value Obtained value. Function takes ownership of it. It can be NULL
+  @return Rate value, value itself if monitor does not report rates, or NULL
+  if there is no previous sample yet
+  */
+struct monitor_value *
+rb_monitor_rate(struct process_sensor_monitor_ctx *process_ctx,
+		const rb_monitor_t *monitor,
+		struct monitor_value *value);
+
+/** Process a monitor external value (system or SNMP response) that has
+  already been obtained, splitting it if monitor needs so.
+  @param process_ctx Process context
+  @param monitor Monitor value belongs
+  @param value Obtained value. Function takes ownership of it. It can be NULL
+  @return Monitor value
+  */
+struct monitor_value *
+rb_monitor_process_external_value(
+		struct process_sensor_monitor_ctx *process_ctx,
+		const rb_monitor_t *monitor,
+		struct monitor_value *value);
+
 /** Gets monitor instance_prefix
   @param monitor Monitor to get data
   @return requested data
@@ -92,6 +142,12 @@ const char *rb_monitor_instance_prefix(const rb_monitor_t *monitor);
   */
 const char *rb_monitor_name_split_suffix(const rb_monitor_t *monitor);
 
+/** Gets monitor split operations
+  @param monitor Monitor to get data
+  @return requested data, NULL if monitor has no split operations
+  */
+const struct rb_split_ops *rb_monitor_split_ops(const rb_monitor_t *monitor);
+
 /** Gets monitor name
   @param monitor Monitor to get data
   @return requested data
@@ -104,6 +160,12 @@ const char *rb_monitor_name(const rb_monitor_t *monitor);
   */
 bool rb_monitor_is_integer(const rb_monitor_t *monitor);
 
+/** Checks if monitor values are sent as JSON numbers instead of strings
+  @param monitor Monitor
+  @return true if values are sent as JSON numbers
+  */
+bool rb_monitor_json_number(const rb_monitor_t *monitor);
+
 /** Gets monitor send variable
   @param monitor Monitor to get data
   @return requested data
@@ -117,12 +179,31 @@ bool rb_monitor_send(const rb_monitor_t *monitor);
  */
 const json_object *rb_monitor_enrichment(const rb_monitor_t *monitor);
 
+/** Get monitor messages template
+  @param monitor Monitor
+  @return Messages immutable parts
+  */
+const struct monitor_value_template *
+rb_monitor_template(const rb_monitor_t *monitor);
+
 /** Gets monitor operation (snmp, system, op...) param
   @param monitor Monitor to get data
   @return requested data
   */
 const char *rb_monitor_get_cmd_data(const rb_monitor_t *monitor);
 
+/** Checks if monitor is a SNMP oid monitor
+  @param monitor Monitor
+  @return true if monitor type is oid
+  */
+bool rb_monitor_is_oid(const rb_monitor_t *monitor);
+
+/** Gets monitor SNMP oid
+  @param monitor Monitor
+  @return Resolved oid, or NULL if monitor is not an oid monitor
+  */
+const struct snmp_oid *rb_monitor_oid(const rb_monitor_t *monitor);
+
 /** Gets monitor operation needed variables
   @param monitor Monitor to get data
   @param vars Char array to store vars
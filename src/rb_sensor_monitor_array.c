@@ -18,13 +18,18 @@
 */
 
 #include "rb_sensor_monitor_array.h"
+#include "rb_arena.h"
 #include "rb_sensor.h"
+#include "rb_snmp_engine.h"
 
 #include "utils.h"
 
 #include <librd/rdfloat.h>
 #include <librd/rdlog.h>
 
+#include <pthread.h>
+#include <sys/queue.h>
+
 #define rb_monitors_array_new(count) rb_array_new(count)
 #define rb_monitors_array_full(array) rb_array_full(array)
 /** @note Doing with a function provides type safety */
@@ -68,10 +73,12 @@ rb_monitors_array_t *parse_rb_monitors(json_object *monitors_array_json,
 /** Process a monitor value
   @param monitor Monitor this monitor value is related
   @param monitor_value Monitor value to process
+  @param ts Messages timestamp
   @param ret Message list to report
   */
 static void process_monitor_value(const rb_monitor_t *monitor,
 				  const monitor_value *t_monitor_value,
+				  const struct monitor_timestamp *ts,
 				  rb_message_list *ret) {
 	assert(monitor);
 	assert(t_monitor_value);
@@ -81,56 +88,637 @@ static void process_monitor_value(const rb_monitor_t *monitor,
 	}
 
 	rb_message_array_t *msgs =
-			print_monitor_value(t_monitor_value, monitor);
+			print_monitor_value(t_monitor_value, monitor, ts);
 	if (msgs) {
 		rb_message_list_push(ret, msgs);
 	}
 }
 
+/// Evaluation of a sensor monitors following its dependency graph
+struct monitors_dag_run {
+	pthread_mutex_t lock; ///< Run lock
+	pthread_cond_t cond;  ///< New monitors ready or run finished
+
+	rb_monitors_array_t *monitors;
+	ssize_t **monitors_deps;
+	const struct rb_monitors_dag *dag;
+	rb_monitor_value_array_t *monitor_values;
+	/// SNMP responses of oid monitors, obtained in batch before the run.
+	/// NULL if oid monitors need to ask for their own oid.
+	struct monitor_value **snmp_values;
+
+	size_t *pending_deps; ///< Dependencies not evaluated yet
+	size_t *ready;	///< Monitors ready to evaluate
+	size_t ready_head;    ///< Next ready monitor to evaluate
+	size_t ready_tail;    ///< Ready monitors end
+	size_t done;	  ///< Evaluated monitors
+	size_t helpers;       ///< Runners given to the pool and not finished
+};
+
+/** Evaluate a monitor
+  @param process_ctx Process context
+  @param run Current run
+  @param i Monitor to evaluate
+  @return Monitor value
+  */
+static struct monitor_value *
+evaluate_monitor(struct process_sensor_monitor_ctx *process_ctx,
+		 struct monitors_dag_run *run,
+		 size_t i) {
+	const rb_monitor_t *monitor =
+			rb_monitors_array_elm_at(run->monitors, i);
+
+	if (run->snmp_values && rb_monitor_is_oid(monitor)) {
+		struct monitor_value *snmp_value = run->snmp_values[i];
+		run->snmp_values[i] = NULL;
+		return rb_monitor_rate(process_ctx,
+				       monitor,
+				       rb_monitor_process_external_value(
+						       process_ctx,
+						       monitor,
+						       snmp_value));
+	}
+
+	rb_monitor_value_array_t *op_vars = rb_monitor_value_array_select(
+			process_sensor_monitor_ctx_arena(process_ctx),
+			run->monitor_values,
+			run->monitors_deps[i]);
+
+	struct monitor_value *ret =
+			process_sensor_monitor(process_ctx, monitor, op_vars);
+
+	return rb_monitor_rate(process_ctx, monitor, ret);
+}
+
+/** Oids of all oid monitors
+  @param monitors Monitors array
+  @param oids Oids of monitors. Need to have room for monitors->count.
+  @param oids_pos Monitor of each oid. Need to have room for monitors->count.
+  @return Number of oids
+  */
+static size_t monitors_snmp_oids(rb_monitors_array_t *monitors,
+				 const struct snmp_oid **oids,
+				 size_t *oids_pos) {
+	size_t oids_count = 0;
+	for (size_t i = 0; i < monitors->count; ++i) {
+		const rb_monitor_t *monitor =
+				rb_monitors_array_elm_at(monitors, i);
+		if (rb_monitor_is_oid(monitor)) {
+			oids[oids_count] = rb_monitor_oid(monitor);
+			oids_pos[oids_count] = i;
+			oids_count++;
+		}
+	}
+
+	return oids_count;
+}
+
+/** Ask for all oid monitors of a sensor in as few SNMP requests as possible
+  @param sensor Sensor
+  @param run Run to store SNMP responses
+  @param arena Allocator for the temporaries of the cycle
+  */
+static void monitors_snmp_prefetch(rb_sensor_t *sensor,
+				   struct monitors_dag_run *run,
+				   struct rb_arena *arena) {
+	const size_t monitors_count = run->monitors->count;
+	const size_t max_oids_per_pdu = rb_sensor_max_oids_per_pdu(sensor);
+	const struct snmp_oid **oids = NULL;
+	size_t *oids_pos = NULL;
+	struct monitor_value **oids_values = NULL;
+
+	if (max_oids_per_pdu <= 1) {
+		// Every monitor will ask for its own oid
+		return;
+	}
+
+	oids = rb_arena_alloc(arena, monitors_count * sizeof(oids[0]));
+	oids_pos = rb_arena_alloc(arena, monitors_count * sizeof(oids_pos[0]));
+	oids_values = rb_arena_calloc(
+			arena, monitors_count, sizeof(oids_values[0]));
+	run->snmp_values = calloc(monitors_count, sizeof(run->snmp_values[0]));
+	if (alloc_unlikely(NULL == oids || NULL == oids_pos ||
+			   NULL == oids_values || NULL == run->snmp_values)) {
+		rdlog(LOG_ERR,
+		      "Couldn't allocate SNMP batch request, asking for oids "
+		      "one by one (OOM?)");
+		free(run->snmp_values);
+		run->snmp_values = NULL;
+		return;
+	}
+
+	const size_t oids_count =
+			monitors_snmp_oids(run->monitors, oids, oids_pos);
+	snmp_query_responses(rb_sensor_snmp_session(sensor, 0),
+			     oids,
+			     oids_count,
+			     max_oids_per_pdu,
+			     oids_values);
+
+	for (size_t i = 0; i < oids_count; ++i) {
+		run->snmp_values[oids_pos[i]] = oids_values[i];
+	}
+}
+
+/// Asynchronous SNMP request of all oid monitors of a sensor
+struct monitors_snmp_async {
+	const struct snmp_oid **oids;	    ///< Oids of oid monitors
+	size_t *oids_pos;		    ///< Monitor of each oid
+	struct monitor_value **oids_values; ///< Response of each oid
+	size_t oids_count;		    ///< Number of oids
+	struct monitor_value **snmp_values; ///< Response of each monitor
+	void (*cb)(void *opaque);	   ///< User callback
+	void *opaque;			    ///< User callback opaque
+};
+
+static void monitors_snmp_async_done(struct monitors_snmp_async *async) {
+	free(async->oids);
+	free(async->oids_pos);
+	free(async->oids_values);
+	free(async);
+}
+
+/** SNMP engine callback, called when all oids have been answered
+  @param vasync Asynchronous request
+  */
+static void monitors_snmp_async_cb(void *vasync) {
+	struct monitors_snmp_async *async = vasync;
+	void (*cb)(void *opaque) = async->cb;
+	void *opaque = async->opaque;
+
+	for (size_t i = 0; i < async->oids_count; ++i) {
+		async->snmp_values[async->oids_pos[i]] = async->oids_values[i];
+	}
+
+	monitors_snmp_async_done(async);
+	cb(opaque);
+}
+
+bool monitors_snmp_async_prefetch(struct rb_sensor_s *sensor,
+				  rb_monitors_array_t *monitors,
+				  struct rb_snmp_engine *engine,
+				  struct monitor_value **snmp_values,
+				  void (*cb)(void *opaque),
+				  void *opaque) {
+	const size_t monitors_count = monitors->count;
+	const size_t max_oids_per_pdu = rb_sensor_max_oids_per_pdu(sensor);
+
+	if (max_oids_per_pdu <= 1) {
+		// Every monitor will ask for its own oid
+		return false;
+	}
+
+	struct monitors_snmp_async *async = calloc(1, sizeof(*async));
+	if (alloc_unlikely(NULL == async)) {
+		goto alloc_err;
+	}
+
+	async->oids = calloc(monitors_count, sizeof(async->oids[0]));
+	async->oids_pos = calloc(monitors_count, sizeof(async->oids_pos[0]));
+	async->oids_values =
+			calloc(monitors_count, sizeof(async->oids_values[0]));
+	if (alloc_unlikely(NULL == async->oids || NULL == async->oids_pos ||
+			   NULL == async->oids_values)) {
+		goto oids_err;
+	}
+
+	async->oids_count = monitors_snmp_oids(
+			monitors, async->oids, async->oids_pos);
+	if (0 == async->oids_count) {
+		monitors_snmp_async_done(async);
+		return false;
+	}
+
+	async->snmp_values = snmp_values;
+	async->cb = cb;
+	async->opaque = opaque;
+
+	const bool get_rc = rb_snmp_engine_get(
+			engine,
+			rb_sensor_snmp_session(sensor, 0),
+			async->oids,
+			async->oids_count,
+			max_oids_per_pdu,
+			async->oids_values,
+			monitors_snmp_async_cb,
+			async);
+	if (!get_rc) {
+		monitors_snmp_async_done(async);
+	}
+
+	return get_rc;
+
+oids_err:
+	monitors_snmp_async_done(async);
+alloc_err:
+	rdlog(LOG_ERR,
+	      "Couldn't allocate SNMP asynchronous request, asking for oids "
+	      "synchronously (OOM?)");
+	return false;
+}
+
+/// Evaluator of monitors of a run
+struct monitors_dag_runner {
+	struct monitors_dag_run *run;
+	struct process_sensor_monitor_ctx *process_ctx;
+	TAILQ_ENTRY(monitors_dag_runner) entry; ///< Pool queue entry
+	bool queued; ///< Runner is waiting in pool queue
+};
+
+/// Threads that help workers to evaluate monitors of the same sensor in
+/// parallel. They are kept between polling cycles, so a run does not need to
+/// create threads. The pool grows when runners are queued and there are not
+/// enough idle threads, so it has as many threads as the parallel runs ever
+/// needed at the same time.
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond; ///< New runners queued, or pool stopping
+	/// Runners waiting for a thread
+	TAILQ_HEAD(, monitors_dag_runner) queue;
+	size_t queued;	///< Runners in queue
+	size_t idle;	  ///< Threads not running a runner
+	size_t threads_count; ///< Number of threads
+	size_t threads_size;  ///< Capacity of threads
+	pthread_t *threads;   ///< Pool threads
+	bool stop;	    ///< Threads need to exit
+} monitors_dag_pool = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.queue = TAILQ_HEAD_INITIALIZER(monitors_dag_pool.queue),
+};
+
+/** Mark a monitor as ready to evaluate. Need to hold run lock.
+  @param run Run
+  @param i Monitor
+  */
+static void monitors_dag_run_ready(struct monitors_dag_run *run, size_t i) {
+	run->ready[run->ready_tail++] = i;
+}
+
+/** Evaluate ready monitors until all monitors of the run are evaluated
+  @param vrunner Runner
+  @return NULL
+  */
+static void *monitors_dag_runner(void *vrunner) {
+	struct monitors_dag_runner *runner = vrunner;
+	struct monitors_dag_run *run = runner->run;
+	const struct rb_monitors_dag *dag = run->dag;
+
+	pthread_mutex_lock(&run->lock);
+	while (run->done < dag->count) {
+		if (run->ready_head == run->ready_tail) {
+			pthread_cond_wait(&run->cond, &run->lock);
+			continue;
+		}
+
+		const size_t i = run->ready[run->ready_head++];
+		pthread_mutex_unlock(&run->lock);
+
+		struct monitor_value *value =
+				evaluate_monitor(runner->process_ctx, run, i);
+
+		pthread_mutex_lock(&run->lock);
+		run->monitor_values->elms[i] = value;
+		run->done++;
+		for (size_t d = dag->dependents_pos[i];
+		     d < dag->dependents_pos[i + 1];
+		     ++d) {
+			const size_t dependent = dag->dependents[d];
+			if (0 == --run->pending_deps[dependent]) {
+				monitors_dag_run_ready(run, dependent);
+			}
+		}
+		pthread_cond_broadcast(&run->cond);
+	}
+	pthread_mutex_unlock(&run->lock);
+
+	return NULL;
+}
+
+/** A pool runner has finished
+  @param run Runner run
+  */
+static void monitors_dag_run_helper_done(struct monitors_dag_run *run) {
+	pthread_mutex_lock(&run->lock);
+	run->helpers--;
+	pthread_cond_broadcast(&run->cond);
+	pthread_mutex_unlock(&run->lock);
+}
+
+/** Pool thread main loop
+  @param unused Unused
+  @return NULL
+  */
+static void *monitors_dag_pool_thread(void *unused) {
+	(void)unused;
+
+	pthread_mutex_lock(&monitors_dag_pool.lock);
+	while (!monitors_dag_pool.stop) {
+		struct monitors_dag_runner *runner =
+				TAILQ_FIRST(&monitors_dag_pool.queue);
+		if (NULL == runner) {
+			pthread_cond_wait(&monitors_dag_pool.cond,
+					  &monitors_dag_pool.lock);
+			continue;
+		}
+
+		TAILQ_REMOVE(&monitors_dag_pool.queue, runner, entry);
+		runner->queued = false;
+		monitors_dag_pool.queued--;
+		monitors_dag_pool.idle--;
+		pthread_mutex_unlock(&monitors_dag_pool.lock);
+
+		monitors_dag_runner(runner);
+		monitors_dag_run_helper_done(runner->run);
+
+		pthread_mutex_lock(&monitors_dag_pool.lock);
+		monitors_dag_pool.idle++;
+	}
+	pthread_mutex_unlock(&monitors_dag_pool.lock);
+
+	return NULL;
+}
+
+/** Add a thread to the pool. Need to hold pool lock.
+  @return true if success, false in other case
+  */
+static bool monitors_dag_pool_grow(void) {
+	const size_t threads_size = monitors_dag_pool.threads_size;
+	if (monitors_dag_pool.threads_count == threads_size) {
+		const size_t new_size = threads_size ? 2 * threads_size : 4;
+		pthread_t *threads = realloc(monitors_dag_pool.threads,
+					     new_size * sizeof(threads[0]));
+		if (alloc_unlikely(NULL == threads)) {
+			rdlog(LOG_ERR,
+			      "Couldn't allocate monitors thread (OOM?)");
+			return false;
+		}
+
+		monitors_dag_pool.threads = threads;
+		monitors_dag_pool.threads_size = new_size;
+	}
+
+	const size_t i = monitors_dag_pool.threads_count;
+	const int create_rc = pthread_create(&monitors_dag_pool.threads[i],
+					     NULL,
+					     monitors_dag_pool_thread,
+					     NULL);
+	if (unlikely(0 != create_rc)) {
+		rdlog(LOG_ERR,
+		      "Couldn't create monitors thread: %s",
+		      gnu_strerror_r(create_rc));
+		return false;
+	}
+
+	monitors_dag_pool.threads_count++;
+	monitors_dag_pool.idle++;
+	return true;
+}
+
+/** Queue runners in the pool, so pool threads evaluate monitors with them
+  @param runners Runners
+  @param count Number of runners
+  */
+static void monitors_dag_pool_push(struct monitors_dag_runner *runners,
+				   size_t count) {
+	pthread_mutex_lock(&runners[0].run->lock);
+	runners[0].run->helpers += count;
+	pthread_mutex_unlock(&runners[0].run->lock);
+
+	pthread_mutex_lock(&monitors_dag_pool.lock);
+	for (size_t i = 0; i < count; ++i) {
+		runners[i].queued = true;
+		TAILQ_INSERT_TAIL(&monitors_dag_pool.queue, &runners[i], entry);
+	}
+	monitors_dag_pool.queued += count;
+
+	// If it can't grow, the worker will evaluate all monitors by itself
+	while (monitors_dag_pool.idle < monitors_dag_pool.queued &&
+	       monitors_dag_pool_grow()) {
+		;
+	}
+
+	pthread_cond_broadcast(&monitors_dag_pool.cond);
+	pthread_mutex_unlock(&monitors_dag_pool.lock);
+}
+
+/** Take back runners that no pool thread has started yet, and wait for the
+  ones that have been started to finish
+  @param runners Runners
+  @param count Number of runners
+  */
+static void monitors_dag_pool_cancel(struct monitors_dag_runner *runners,
+				     size_t count) {
+	size_t cancelled = 0;
+
+	pthread_mutex_lock(&monitors_dag_pool.lock);
+	for (size_t i = 0; i < count; ++i) {
+		if (runners[i].queued) {
+			TAILQ_REMOVE(&monitors_dag_pool.queue,
+				     &runners[i],
+				     entry);
+			runners[i].queued = false;
+			cancelled++;
+		}
+	}
+	monitors_dag_pool.queued -= cancelled;
+	pthread_mutex_unlock(&monitors_dag_pool.lock);
+
+	struct monitors_dag_run *run = runners[0].run;
+	pthread_mutex_lock(&run->lock);
+	run->helpers -= cancelled;
+	while (run->helpers > 0) {
+		pthread_cond_wait(&run->cond, &run->lock);
+	}
+	pthread_mutex_unlock(&run->lock);
+}
+
+void rb_monitors_dag_pool_done(void) {
+	pthread_mutex_lock(&monitors_dag_pool.lock);
+	monitors_dag_pool.stop = true;
+	pthread_cond_broadcast(&monitors_dag_pool.cond);
+	pthread_mutex_unlock(&monitors_dag_pool.lock);
+
+	for (size_t i = 0; i < monitors_dag_pool.threads_count; ++i) {
+		pthread_join(monitors_dag_pool.threads[i], NULL);
+	}
+
+	free(monitors_dag_pool.threads);
+	monitors_dag_pool.threads = NULL;
+	monitors_dag_pool.threads_count = 0;
+	monitors_dag_pool.threads_size = 0;
+	monitors_dag_pool.idle = 0;
+}
+
+/** Evaluate all monitors following dependency graph, in parallel
+  @param sensor Sensor
+  @param run Run, with monitors and dag set
+  @param arena Allocator for the temporaries of the cycle. Every runner
+  uses its own arena, chained to this one.
+  @return true if success, false in other case
+  */
+static bool monitors_dag_run(rb_sensor_t *sensor,
+			     struct monitors_dag_run *run,
+			     struct rb_arena *arena) {
+	const struct rb_monitors_dag *dag = run->dag;
+	size_t runners_size = rb_sensor_max_parallel_monitors(sensor);
+	if (runners_size > dag->count) {
+		runners_size = dag->count;
+	}
+	if (0 == runners_size) {
+		return true;
+	}
+
+	size_t runners_count = runners_size;
+	struct monitors_dag_runner *runners = rb_arena_calloc(
+			arena, runners_size, sizeof(runners[0]));
+	run->pending_deps = rb_arena_alloc(
+			arena, dag->count * sizeof(run->pending_deps[0]));
+	run->ready = rb_arena_alloc(arena, dag->count * sizeof(run->ready[0]));
+	if (alloc_unlikely(NULL == runners || NULL == run->pending_deps ||
+			   NULL == run->ready)) {
+		rdlog(LOG_ERR, "Couldn't allocate monitors run (OOM?)");
+		return false;
+	}
+
+	memcpy(run->pending_deps,
+	       dag->deps_count,
+	       dag->count * sizeof(run->pending_deps[0]));
+	for (size_t i = 0; i < dag->count; ++i) {
+		if (0 == run->pending_deps[i]) {
+			monitors_dag_run_ready(run, i);
+		}
+	}
+
+	pthread_mutex_init(&run->lock, NULL);
+	pthread_cond_init(&run->cond, NULL);
+
+	struct rb_arena *runner_arena = arena;
+	for (size_t i = 0; i < runners_count; ++i) {
+		if (i > 0 && runner_arena) {
+			runner_arena = rb_arena_next(runner_arena);
+		}
+
+		runners[i].run = run;
+		runners[i].process_ctx = new_process_sensor_monitor_ctx(
+				rb_sensor_snmp_session(sensor, i),
+				rb_sensor_cycle_start_us(sensor),
+				runner_arena);
+	}
+
+	for (size_t i = 0; i < runners_count; ++i) {
+		if (unlikely(NULL == runners[i].process_ctx)) {
+			// Can't evaluate monitors with this one or next ones
+			runners_count = i;
+			break;
+		}
+	}
+
+	// Runner 0 is this thread, the rest go to the pool
+	if (runners_count > 1) {
+		monitors_dag_pool_push(&runners[1], runners_count - 1);
+	}
+
+	if (runners_count > 0) {
+		monitors_dag_runner(&runners[0]);
+	}
+
+	if (runners_count > 1) {
+		monitors_dag_pool_cancel(&runners[1], runners_count - 1);
+	}
+
+	pthread_cond_destroy(&run->cond);
+	pthread_mutex_destroy(&run->lock);
+
+	return runners_count > 0;
+}
+
+/** Evaluate all monitors sequentially, in array order
+  @param sensor Sensor
+  @param run Run, with monitors set
+  @param arena Allocator for the temporaries of the cycle
+  @return true if success, false in other case
+  */
+static bool monitors_sequential_run(rb_sensor_t *sensor,
+				    struct monitors_dag_run *run,
+				    struct rb_arena *arena) {
+	struct process_sensor_monitor_ctx *process_ctx =
+			new_process_sensor_monitor_ctx(
+					rb_sensor_snmp_session(sensor, 0),
+					rb_sensor_cycle_start_us(sensor),
+					arena);
+	if (unlikely(NULL == process_ctx)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < run->monitors->count; ++i) {
+		run->monitor_values->elms[i] =
+				evaluate_monitor(process_ctx, run, i);
+	}
+
+	return true;
+}
+
 bool process_monitors_array(rb_sensor_t *sensor,
 			    rb_monitors_array_t *monitors,
 			    ssize_t **monitors_deps,
+			    const struct rb_monitors_dag *monitors_dag,
+			    struct monitor_value **snmp_values,
+			    struct rb_arena *arena,
+			    const struct monitor_timestamp *ts,
 			    rb_message_list *ret) {
-	struct process_sensor_monitor_ctx *process_ctx = NULL;
 	const size_t monitors_count = monitors->count;
-	rb_monitor_value_array_t *monitor_values =
-			rb_monitor_value_array_new(monitors_count);
-	if (alloc_unlikely(!monitor_values)) {
+	struct monitors_dag_run run = {
+			.monitors = monitors,
+			.monitors_deps = monitors_deps,
+			.dag = monitors_dag,
+			.monitor_values = rb_monitor_value_array_arena_new(
+					arena, monitors_count),
+			.snmp_values = snmp_values,
+	};
+	bool run_rc = false;
+
+	if (alloc_unlikely(!run.monitor_values)) {
 		rdlog(LOG_ERR, "Couldn't allocate monitors values array");
-		return false;
+		goto monitor_values_err;
 	}
 
-	monitor_snmp_session *snmp_sess = rb_sensor_snmp_session(sensor);
-	process_ctx = new_process_sensor_monitor_ctx(snmp_sess);
-
-	for (size_t i = 0; i < monitors->count; ++i) {
-		rb_monitor_value_array_t *op_vars =
-				rb_monitor_value_array_select(monitor_values,
-							      monitors_deps[i]);
+	if (NULL == run.snmp_values) {
+		monitors_snmp_prefetch(sensor, &run, arena);
+	}
 
-		const rb_monitor_t *monitor =
-				rb_monitors_array_elm_at(monitors, i);
-		monitor_values->elms[i] = process_sensor_monitor(
-				process_ctx, monitor, op_vars);
-		if (likely(NULL != monitor_values->elms[i])) {
-			process_monitor_value(
-					monitor, monitor_values->elms[i], ret);
+	run_rc = monitors_dag ? monitors_dag_run(sensor, &run, arena)
+			      : monitors_sequential_run(sensor, &run, arena);
+
+	// Report in monitors order, no matter evaluation order
+	for (size_t i = 0; i < monitors_count; ++i) {
+		if (likely(NULL != run.monitor_values->elms[i])) {
+			process_monitor_value(rb_monitors_array_elm_at(
+							      monitors, i),
+					      run.monitor_values->elms[i],
+					      ts,
+					      ret);
 		}
-
-		rb_monitor_value_array_done(op_vars);
 	}
 
-	if (process_ctx) {
-		destroy_process_sensor_monitor_ctx(process_ctx);
+	for (size_t i = 0; i < monitors_count; ++i) {
+		if (run.monitor_values->elms[i]) {
+			rb_monitor_value_done(run.monitor_values->elms[i]);
+		}
 	}
-	for (size_t i = 0; i < monitors->count; ++i) {
-		if (monitor_values->elms[i]) {
-			rb_monitor_value_done(monitor_values->elms[i]);
+
+monitor_values_err:
+	if (run.snmp_values) {
+		// Responses of monitors that could not be evaluated
+		for (size_t i = 0; i < monitors_count; ++i) {
+			if (run.snmp_values[i]) {
+				rb_monitor_value_done(run.snmp_values[i]);
+			}
 		}
+		free(run.snmp_values);
 	}
-	rb_monitor_value_array_done(monitor_values);
 
-	return true;
+	return run_rc;
 }
 
 /** Get a monitor position
@@ -216,6 +804,117 @@ void free_monitors_dependencies(ssize_t **deps, size_t count) {
 	free(deps);
 }
 
+struct rb_monitors_dag *
+rb_monitors_dag_new(const rb_monitors_array_t *monitors_array,
+		    ssize_t **monitors_deps) {
+	const size_t count = monitors_array->count;
+	size_t edges = 0;
+	size_t *pending = NULL, *ready = NULL;
+
+	for (size_t i = 0; i < count; ++i) {
+		const ssize_t *i_deps = monitors_deps[i];
+		for (size_t d = 0; i_deps && -1 != i_deps[d]; ++d) {
+			edges++;
+		}
+	}
+
+	struct rb_monitors_dag *ret = calloc(1, sizeof(*ret));
+	if (alloc_unlikely(NULL == ret)) {
+		goto err;
+	}
+
+	ret->count = count;
+	ret->deps_count = calloc(count, sizeof(ret->deps_count[0]));
+	ret->dependents_pos = calloc(count + 1, sizeof(ret->dependents_pos[0]));
+	ret->dependents = calloc(edges + 1, sizeof(ret->dependents[0]));
+	pending = calloc(count + 1, sizeof(pending[0]));
+	ready = calloc(count + 1, sizeof(ready[0]));
+	if (alloc_unlikely(NULL == ret->deps_count ||
+			   NULL == ret->dependents_pos ||
+			   NULL == ret->dependents || NULL == pending ||
+			   NULL == ready)) {
+		goto err;
+	}
+
+	// Count dependents of each monitor, and compute its start position
+	for (size_t i = 0; i < count; ++i) {
+		const ssize_t *i_deps = monitors_deps[i];
+		for (size_t d = 0; i_deps && -1 != i_deps[d]; ++d) {
+			const size_t dep = (size_t)i_deps[d];
+			ret->deps_count[i]++;
+			ret->dependents_pos[dep + 1]++;
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		ret->dependents_pos[i + 1] += ret->dependents_pos[i];
+	}
+
+	// pending is used as insertion position here
+	memcpy(pending, ret->dependents_pos, count * sizeof(pending[0]));
+	for (size_t i = 0; i < count; ++i) {
+		const ssize_t *i_deps = monitors_deps[i];
+		for (size_t d = 0; i_deps && -1 != i_deps[d]; ++d) {
+			const size_t dep = (size_t)i_deps[d];
+			ret->dependents[pending[dep]++] = i;
+		}
+	}
+
+	// Check there are no cycles, or we will never evaluate some monitors
+	size_t ready_head = 0, ready_tail = 0;
+	memcpy(pending, ret->deps_count, count * sizeof(pending[0]));
+	for (size_t i = 0; i < count; ++i) {
+		if (0 == pending[i]) {
+			ready[ready_tail++] = i;
+		}
+	}
+
+	while (ready_head < ready_tail) {
+		const size_t i = ready[ready_head++];
+		for (size_t d = ret->dependents_pos[i];
+		     d < ret->dependents_pos[i + 1];
+		     ++d) {
+			if (0 == --pending[ret->dependents[d]]) {
+				ready[ready_tail++] = ret->dependents[d];
+			}
+		}
+	}
+
+	if (ready_tail != count) {
+		for (size_t i = 0; i < count; ++i) {
+			if (pending[i]) {
+				rdlog(LOG_WARNING,
+				      "Monitor %s is in a dependency cycle, "
+				      "monitors will be evaluated "
+				      "sequentially",
+				      rb_monitor_name(monitors_array->elms[i]));
+			}
+		}
+		goto cycle_err;
+	}
+
+	free(pending);
+	free(ready);
+	return ret;
+
+err:
+	rdlog(LOG_ERR, "Couldn't allocate monitors dependency graph (OOM?)");
+cycle_err:
+	free(pending);
+	free(ready);
+	if (ret) {
+		rb_monitors_dag_done(ret);
+	}
+	return NULL;
+}
+
+void rb_monitors_dag_done(struct rb_monitors_dag *dag) {
+	free(dag->deps_count);
+	free(dag->dependents_pos);
+	free(dag->dependents);
+	free(dag);
+}
+
 void rb_monitors_array_done(rb_monitors_array_t *monitors_array) {
 	for (size_t i = 0; i < monitors_array->count; ++i) {
 		rb_monitor_done(rb_monitors_array_elm_at(monitors_array, i));
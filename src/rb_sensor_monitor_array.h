@@ -47,17 +47,62 @@ struct rb_sensor_s;
   */
 rb_monitor_t *rb_monitors_array_elm_at(rb_monitors_array_t *array, size_t i);
 
-/** Process all monitors in sensor, returning result in ret
+/// Monitors dependency graph
+struct rb_monitors_dag {
+	size_t count;		 ///< Number of monitors
+	size_t *deps_count;      ///< Number of dependencies of each monitor
+	size_t *dependents_pos;  ///< Monitor i dependents start position
+	size_t *dependents;      ///< Monitors that depends on each monitor
+};
+
+/** Process all monitors in sensor, returning result in ret. If a dependency
+  graph is provided, monitors will be evaluated in up to
+  rb_sensor_max_parallel_monitors threads (this one plus threads of a shared
+  pool), and each operation will be evaluated when all its variables are
+  ready.
   @param sensor Current sensor
   @param monitors Array of monitors to ask
   @param monitors_deps Monitor dependencies
+  @param monitors_dag Monitors dependency graph. If NULL, monitors will be
+  evaluated sequentially in array order.
+  @param snmp_values SNMP responses of oid monitors, obtained with
+  monitors_snmp_async_prefetch. If NULL, oids will be asked synchronously.
+  This function takes ownership of the array.
+  @param arena Allocator for the temporaries of the cycle. Caller needs to
+  reset it when the function returns.
+  @param ts Timestamp of all messages of the cycle
   @param ret Message returning function
   */
 bool process_monitors_array(struct rb_sensor_s *sensor,
 			    rb_monitors_array_t *monitors,
 			    ssize_t **monitors_deps,
+			    const struct rb_monitors_dag *monitors_dag,
+			    struct monitor_value **snmp_values,
+			    struct rb_arena *arena,
+			    const struct monitor_timestamp *ts,
 			    rb_message_list *ret);
 
+struct rb_snmp_engine;
+
+/** Ask for all oid monitors of a sensor using the asynchronous SNMP engine
+  @param sensor Sensor
+  @param monitors Array of monitors to ask
+  @param engine SNMP engine
+  @param snmp_values Array of monitors->count elements to store responses.
+  It will be filled when cb is called.
+  @param cb Callback called from engine thread when all responses are in
+  snmp_values
+  @param opaque Callback opaque
+  @return true if requests are in flight, false if there is nothing to ask
+  for asynchronously. If false, cb will not be called.
+  */
+bool monitors_snmp_async_prefetch(struct rb_sensor_s *sensor,
+				  rb_monitors_array_t *monitors,
+				  struct rb_snmp_engine *engine,
+				  struct monitor_value **snmp_values,
+				  void (*cb)(void *opaque),
+				  void *opaque);
+
 /** Given an array of monitors, return all monitor's internal dependency.
   In the return, each element of the array contains another array:
     NULL if this monitor has no dependency
@@ -73,6 +118,26 @@ ssize_t **get_monitors_dependencies(const rb_monitors_array_t *monitors_array);
   */
 void free_monitors_dependencies(ssize_t **deps, size_t count);
 
+/** Build the dependency graph of a monitors array
+  @param monitors_array Array of monitors
+  @param monitors_deps Dependencies, from get_monitors_dependencies
+  @return New graph, or NULL if error or if dependencies have a cycle. Need to
+  free it with rb_monitors_dag_done.
+  */
+struct rb_monitors_dag *
+rb_monitors_dag_new(const rb_monitors_array_t *monitors_array,
+		    ssize_t **monitors_deps);
+
+/** Release a monitors dependency graph
+  @param dag Graph
+  */
+void rb_monitors_dag_done(struct rb_monitors_dag *dag);
+
+/** Stop the threads that evaluate monitors in parallel. Need to be called
+  when no sensor is being processed.
+  */
+void rb_monitors_dag_pool_done(void);
+
 /** Free array allocated with parse_rb_monitors
   @param array Array
   */
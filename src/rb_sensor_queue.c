@@ -19,11 +19,328 @@
 
 #include <rb_sensor_queue.h>
 
-void sensor_queue_init(sensor_queue_t *queue) {
-	memset(queue, 0, sizeof(*queue)); // Needed even with init()
-	rd_fifoq_init(queue);
+#include "utils.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <errno.h>
+#include <time.h>
+
+/// Initial capacity of each worker deque
+#define SENSOR_WORKER_QUEUE_INITIAL_SIZE 64
+
+static void sensor_worker_queue_init(struct sensor_worker_queue *wqueue) {
+	memset(wqueue, 0, sizeof(*wqueue));
+	pthread_mutex_init(&wqueue->lock, NULL);
+}
+
+static void sensor_worker_queue_done(struct sensor_worker_queue *wqueue) {
+	for (size_t i = 0; i < wqueue->count; ++i) {
+		rb_sensor_put(wqueue->elms[(wqueue->head + i) % wqueue->size]);
+	}
+	free(wqueue->elms);
+	pthread_mutex_destroy(&wqueue->lock);
+}
+
+/** Double worker deque capacity. Need to hold deque lock.
+  @param wqueue Worker deque
+  @return true if success, false in other case
+  */
+static bool sensor_worker_queue_grow(struct sensor_worker_queue *wqueue) {
+	const size_t new_size = wqueue->size
+					? 2 * wqueue->size
+					: SENSOR_WORKER_QUEUE_INITIAL_SIZE;
+	rb_sensor_t **new_elms = malloc(new_size * sizeof(new_elms[0]));
+	if (alloc_unlikely(NULL == new_elms)) {
+		return false;
+	}
+
+	for (size_t i = 0; i < wqueue->count; ++i) {
+		new_elms[i] = wqueue->elms[(wqueue->head + i) % wqueue->size];
+	}
+
+	free(wqueue->elms);
+	wqueue->elms = new_elms;
+	wqueue->size = new_size;
+	wqueue->head = 0;
+	return true;
+}
+
+/** Push a sensor at the back of a worker deque
+  @param wqueue Worker deque
+  @param sensor Sensor to push
+  @return true if success, false in other case
+  */
+static bool sensor_worker_queue_push(struct sensor_worker_queue *wqueue,
+				     rb_sensor_t *sensor) {
+	bool ret = true;
+
+	pthread_mutex_lock(&wqueue->lock);
+	if (wqueue->count == wqueue->size) {
+		ret = sensor_worker_queue_grow(wqueue);
+	}
+
+	if (likely(ret)) {
+		const size_t pos =
+				(wqueue->head + wqueue->count) % wqueue->size;
+		wqueue->elms[pos] = sensor;
+		wqueue->count++;
+	}
+	pthread_mutex_unlock(&wqueue->lock);
+
+	return ret;
+}
+
+/** Pop a sensor of a worker deque
+  @param wqueue Worker deque
+  @param front Pop from front (owner) or back (thief)
+  @return Popped sensor, or NULL if deque was empty
+  */
+static rb_sensor_t *sensor_worker_queue_pop(struct sensor_worker_queue *wqueue,
+					    bool front) {
+	rb_sensor_t *ret = NULL;
+
+	pthread_mutex_lock(&wqueue->lock);
+	if (wqueue->count > 0) {
+		if (front) {
+			ret = wqueue->elms[wqueue->head];
+			wqueue->head = (wqueue->head + 1) % wqueue->size;
+		} else {
+			const size_t pos = (wqueue->head + wqueue->count - 1) %
+					   wqueue->size;
+			ret = wqueue->elms[pos];
+		}
+		wqueue->count--;
+	}
+	pthread_mutex_unlock(&wqueue->lock);
+
+	return ret;
+}
+
+/// Work stealing backend of sensor_queue_init
+static bool work_stealing_queue_init(struct sensor_work_stealing_queue *queue,
+				     size_t workers_count) {
+	assert(workers_count > 0);
+
+	memset(queue, 0, sizeof(*queue));
+	queue->workers = calloc(workers_count, sizeof(queue->workers[0]));
+	if (alloc_unlikely(NULL == queue->workers)) {
+		rdlog(LOG_CRIT, "Couldn't allocate workers queues (OOM?)");
+		return false;
+	}
+
+	queue->workers_count = workers_count;
+	for (size_t i = 0; i < workers_count; ++i) {
+		sensor_worker_queue_init(&queue->workers[i]);
+	}
+
+	pthread_mutex_init(&queue->idle_lock, NULL);
+	pthread_cond_init(&queue->idle_cond, NULL);
+	return true;
+}
+
+/// Work stealing backend of sensor_queue_done
+static void work_stealing_queue_done(struct sensor_work_stealing_queue *queue) {
+	for (size_t i = 0; i < queue->workers_count; ++i) {
+		sensor_worker_queue_done(&queue->workers[i]);
+	}
+	free(queue->workers);
+	pthread_cond_destroy(&queue->idle_cond);
+	pthread_mutex_destroy(&queue->idle_lock);
+}
+
+/// Work stealing backend of queue_sensor
+static bool work_stealing_queue_push(struct sensor_work_stealing_queue *queue,
+				     rb_sensor_t *sensor) {
+	size_t worker_id = rb_sensor_last_worker(sensor);
+	if (worker_id >= queue->workers_count) {
+		worker_id = ATOMIC_OP(fetch, add, &queue->next_worker, 1) %
+			    queue->workers_count;
+	}
+
+	const bool push_rc = sensor_worker_queue_push(
+			&queue->workers[worker_id], sensor);
+	if (unlikely(!push_rc)) {
+		rdlog(LOG_ERR,
+		      "Couldn't queue sensor %s (OOM?)",
+		      rb_sensor_name(sensor));
+		return false;
+	}
+
+	ATOMIC_OP(add, fetch, &queue->pending, 1);
+
+	// Idle workers announce themselves before checking pending, so one of
+	// both sides always sees the other one. Lock is only needed to wake up
+	// a worker.
+	if (ATOMIC_OP(add, fetch, &queue->idle_workers, 0) > 0) {
+		pthread_mutex_lock(&queue->idle_lock);
+		pthread_cond_signal(&queue->idle_cond);
+		pthread_mutex_unlock(&queue->idle_lock);
+	}
+
+	return true;
+}
+
+/** Try to pop a sensor from worker deque, or steal one from other workers
+  @param queue Sensors queue
+  @param worker_id Worker that pops
+  @return Sensor, or NULL if all deques were empty
+  */
+static rb_sensor_t *
+work_stealing_queue_try_pop(struct sensor_work_stealing_queue *queue,
+			    size_t worker_id) {
+	rb_sensor_t *ret = sensor_worker_queue_pop(&queue->workers[worker_id],
+						   true);
+
+	for (size_t i = 1; NULL == ret && i < queue->workers_count; ++i) {
+		const size_t victim = (worker_id + i) % queue->workers_count;
+		ret = sensor_worker_queue_pop(&queue->workers[victim], false);
+	}
+
+	if (ret) {
+		ATOMIC_OP(sub, fetch, &queue->pending, 1);
+		rb_sensor_set_last_worker(ret, worker_id);
+	}
+
+	return ret;
+}
+
+/// Work stealing backend of pop_sensor
+static rb_sensor_t *
+work_stealing_queue_pop(struct sensor_work_stealing_queue *queue,
+			size_t worker_id,
+			int tmo_ms) {
+	assert(worker_id < queue->workers_count);
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += tmo_ms / 1000;
+	deadline.tv_nsec += (tmo_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	bool timedout = false;
+	rb_sensor_t *ret = NULL;
+	while (NULL == (ret = work_stealing_queue_try_pop(queue, worker_id)) &&
+	       !timedout) {
+		pthread_mutex_lock(&queue->idle_lock);
+		ATOMIC_OP(add, fetch, &queue->idle_workers, 1);
+		if (0 == ATOMIC_OP(add, fetch, &queue->pending, 0)) {
+			timedout = ETIMEDOUT ==
+				   pthread_cond_timedwait(&queue->idle_cond,
+							  &queue->idle_lock,
+							  &deadline);
+		}
+		ATOMIC_OP(sub, fetch, &queue->idle_workers, 1);
+		pthread_mutex_unlock(&queue->idle_lock);
+	}
+
+	return ret;
+}
+
+bool sensor_queue_backend_parse(const char *str,
+				enum sensor_queue_backend *backend) {
+	static const struct {
+		const char *str;
+		enum sensor_queue_backend backend;
+	} backends[] = {
+			{"work_stealing", SENSOR_QUEUE_WORK_STEALING},
+			{"ring", SENSOR_QUEUE_RING},
+	};
+
+	for (size_t i = 0; str && i < RD_ARRAYSIZE(backends); ++i) {
+		if (0 == strcmp(str, backends[i].str)) {
+			*backend = backends[i].backend;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool sensor_queue_init(sensor_queue_t *queue,
+		       enum sensor_queue_backend backend,
+		       size_t workers_count,
+		       size_t ring_size) {
+	memset(queue, 0, sizeof(*queue));
+	queue->backend = backend;
+
+	switch (backend) {
+	case SENSOR_QUEUE_RING:
+		if (!rb_mpmc_ring_init(&queue->ring, ring_size)) {
+			rdlog(LOG_CRIT,
+			      "Couldn't allocate sensors ring (OOM?)");
+			return false;
+		}
+		return true;
+
+	case SENSOR_QUEUE_WORK_STEALING:
+	default:
+		return work_stealing_queue_init(&queue->work_stealing,
+						workers_count);
+	};
 }
 
 void sensor_queue_done(sensor_queue_t *queue) {
-	rd_fifoq_destroy(queue);
+	switch (queue->backend) {
+	case SENSOR_QUEUE_RING: {
+		rb_sensor_t *sensor = NULL;
+		while ((sensor = rb_mpmc_ring_pop(&queue->ring))) {
+			rb_sensor_put(sensor);
+		}
+		rb_mpmc_ring_done(&queue->ring);
+		break;
+	}
+
+	case SENSOR_QUEUE_WORK_STEALING:
+	default:
+		work_stealing_queue_done(&queue->work_stealing);
+		break;
+	};
+}
+
+bool queue_sensor(sensor_queue_t *queue, rb_sensor_t *sensor) {
+	assert_rb_sensor(sensor);
+
+	switch (queue->backend) {
+	case SENSOR_QUEUE_RING:
+		if (unlikely(!rb_mpmc_ring_push(&queue->ring, sensor))) {
+			rdlog(LOG_ERR,
+			      "Couldn't queue sensor %s: Sensors queue full "
+			      "(%zu sensors)",
+			      rb_sensor_name(sensor),
+			      rb_mpmc_ring_capacity(&queue->ring));
+			return false;
+		}
+		return true;
+
+	case SENSOR_QUEUE_WORK_STEALING:
+	default:
+		return work_stealing_queue_push(&queue->work_stealing, sensor);
+	};
+}
+
+rb_sensor_t *pop_sensor(sensor_queue_t *queue, size_t worker_id, int tmo_ms) {
+	rb_sensor_t *ret = NULL;
+
+	switch (queue->backend) {
+	case SENSOR_QUEUE_RING:
+		ret = rb_mpmc_ring_pop_wait(&queue->ring, tmo_ms);
+		break;
+
+	case SENSOR_QUEUE_WORK_STEALING:
+	default:
+		ret = work_stealing_queue_pop(
+				&queue->work_stealing, worker_id, tmo_ms);
+		break;
+	};
+
+	if (ret) {
+		assert_rb_sensor(ret);
+	}
+
+	return ret;
 }
@@ -19,46 +19,94 @@
 
 #pragma once
 
+#include "rb_mpmc_ring.h"
 #include "rb_sensor.h"
 
-#include <librd/rdqueue.h>
-#include <librd/rdthread.h>
+#include <pthread.h>
 
 #include <assert.h>
+#include <stdbool.h>
+
+/// Sensors queue implementation
+enum sensor_queue_backend {
+	/// Per-worker deques with work stealing
+	SENSOR_QUEUE_WORK_STEALING,
+	/// Lock-free bounded ring shared by all workers
+	SENSOR_QUEUE_RING,
+};
+
+/// Per-worker sensors deque
+struct sensor_worker_queue {
+	// Private data - Do not use directly
+	pthread_mutex_t lock; ///< Deque lock
+	rb_sensor_t **elms;   ///< Ring buffer of sensors
+	size_t size;	  ///< Ring buffer capacity
+	size_t head;	  ///< First element position
+	size_t count;	 ///< Number of elements
+};
+
+/// Work stealing queue. Each worker has its own deque, and it steals sensors
+/// from other workers' deques when it runs out of them.
+struct sensor_work_stealing_queue {
+	// Private data - Do not use directly
+	size_t workers_count;		     ///< Number of workers deques
+	struct sensor_worker_queue *workers; ///< Workers deques
+	size_t next_worker; ///< Round robin for sensors with no worker
+	size_t pending;     ///< Sensors in all deques
+
+	pthread_mutex_t idle_lock; ///< Idle workers lock
+	pthread_cond_t idle_cond;  ///< Idle workers condition
+	size_t idle_workers;       ///< Workers waiting for sensors (atomic)
+};
 
 /// Sensors queue
-typedef rd_fifoq_t sensor_queue_t;
+typedef struct sensor_queue_s {
+	// Private data - Do not use directly
+	enum sensor_queue_backend backend;
+	union {
+		struct sensor_work_stealing_queue work_stealing;
+		struct rb_mpmc_ring ring;
+	};
+} sensor_queue_t;
+
+/** Parse a sensor queue backend string
+  @param str Backend name ("work_stealing" or "ring")
+  @param backend Parsed backend
+  @return true if valid, false in other case
+  */
+bool sensor_queue_backend_parse(const char *str,
+				enum sensor_queue_backend *backend);
 
 /** Initialize a new sensor queue
   @param queue Queue to init
+  @param backend Queue implementation
+  @param workers_count Number of workers that will pop sensors
+  @param ring_size Max number of queued sensors in ring backend
+  @return true if success, false in other case
   */
-void sensor_queue_init(sensor_queue_t *queue);
-/** Destroy a sensor queue
+bool sensor_queue_init(sensor_queue_t *queue,
+		       enum sensor_queue_backend backend,
+		       size_t workers_count,
+		       size_t ring_size);
+
+/** Destroy a sensor queue. Releases remaining queued sensors.
   @param queue Queue to finish
   */
 void sensor_queue_done(sensor_queue_t *queue);
 
-/** Queue a sensor
+/** Queue a sensor. In work stealing backend, it will be queued in the worker
+  that processed it last time, if any.
   @param queue Queue
   @param sensor Sensor
+  @return true if queued, false in other case
   */
-#define queue_sensor rd_fifoq_add
+bool queue_sensor(sensor_queue_t *queue, rb_sensor_t *sensor);
 
-/** Pop a sensor from the queue sensor
+/** Pop a sensor from the queue sensor. In work stealing backend, worker will
+  search first in its own deque, and then it will try to steal from others.
   @param queue Queue of sensors
-  @tmo_ms Timeout in ms
+  @param worker_id Worker that pops, in [0, workers_count)
+  @param tmo_ms Timeout in ms
   @return Sensor extracted, or NULL if any
   */
-static rb_sensor_t *
-pop_sensor(sensor_queue_t *queue, int tmo_ms) __attribute__((unused));
-static rb_sensor_t *pop_sensor(sensor_queue_t *queue, int tmo_ms) {
-	rb_sensor_t *sensor = NULL;
-	rd_fifoq_elm_t *elm = rd_fifoq_pop_timedwait(queue, tmo_ms);
-	if (elm) {
-		sensor = elm->rfqe_ptr;
-		rd_fifoq_elm_release(queue, elm);
-		assert_rb_sensor(sensor);
-	}
-
-	return sensor;
-}
+rb_sensor_t *pop_sensor(sensor_queue_t *queue, size_t worker_id, int tmo_ms);
@@ -0,0 +1,179 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_sensor_scheduler.h"
+
+#include "utils.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+/** Convert milliseconds to scheduler ticks, rounding up
+  @param sched Scheduler
+  @param ms Milliseconds
+  @return Ticks
+  */
+static uint64_t ms_to_ticks(const struct rb_sensor_scheduler *sched,
+			    uint64_t ms) {
+	return (ms + sched->tick_ms - 1) / sched->tick_ms;
+}
+
+bool rb_sensor_scheduler_dispatch_mode_parse(
+		const char *str, enum rb_sensor_scheduler_dispatch_mode *mode) {
+	static const struct {
+		const char *str;
+		enum rb_sensor_scheduler_dispatch_mode mode;
+	} modes[] = {
+			{"burst", RB_SENSOR_SCHEDULER_DISPATCH_BURST},
+			{"spread", RB_SENSOR_SCHEDULER_DISPATCH_SPREAD},
+	};
+
+	for (size_t i = 0; str && i < RD_ARRAYSIZE(modes); ++i) {
+		if (0 == strcmp(str, modes[i].str)) {
+			*mode = modes[i].mode;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Stable offset of a sensor inside its interval. Uses sensor id if
+  available, and sensor name if not.
+  @param sensor Sensor
+  @param interval_ticks Sensor interval
+  @return Offset in ticks, in [0, interval_ticks)
+  */
+static uint64_t sensor_phase_ticks(const rb_sensor_t *sensor,
+				   uint64_t interval_ticks) {
+	const int64_t sensor_id = rb_sensor_id(sensor);
+	uint64_t hash = 0;
+
+	if (sensor_id > 0) {
+		hash = rb_fnv1a(RB_FNV1A_INIT, &sensor_id, sizeof(sensor_id));
+	} else {
+		const char *sensor_name = rb_sensor_name(sensor);
+		hash = rb_fnv1a(RB_FNV1A_INIT,
+				sensor_name,
+				strlen(sensor_name));
+	}
+
+	return hash % interval_ticks;
+}
+
+bool rb_sensor_scheduler_init(struct rb_sensor_scheduler *sched,
+			      rb_sensors_array_t *sensors,
+			      sensor_queue_t *queue,
+			      uint64_t tick_ms,
+			      uint64_t default_interval_ms,
+			      enum rb_sensor_scheduler_dispatch_mode mode,
+			      uint64_t now_ms) {
+	assert(tick_ms > 0);
+
+	memset(sched, 0, sizeof(*sched));
+	sched->queue = queue;
+	sched->tick_ms = tick_ms;
+	sched->entries = calloc(sensors->count, sizeof(sched->entries[0]));
+	if (alloc_unlikely(NULL == sched->entries)) {
+		rdlog(LOG_CRIT, "Couldn't allocate scheduler entries (OOM?)");
+		return false;
+	}
+
+	const uint64_t now_tick = now_ms / tick_ms;
+	rb_timer_wheel_init(&sched->wheel, now_tick);
+
+	for (size_t i = 0; i < sensors->count; ++i) {
+		struct rb_sensor_scheduler_entry *entry = &sched->entries[i];
+		const uint64_t sensor_interval_ms =
+				rb_sensor_poll_interval_ms(sensors->elms[i]);
+		const uint64_t interval_ms = sensor_interval_ms
+						     ? sensor_interval_ms
+						     : default_interval_ms;
+
+		entry->sensor = sensors->elms[i];
+		entry->interval_ticks = ms_to_ticks(sched, interval_ms);
+		if (0 == entry->interval_ticks) {
+			entry->interval_ticks = 1;
+		}
+
+		uint64_t first_tick = now_tick;
+		if (RB_SENSOR_SCHEDULER_DISPATCH_SPREAD == mode) {
+			first_tick += sensor_phase_ticks(entry->sensor,
+							 entry->interval_ticks);
+		}
+		rb_timer_wheel_add(&sched->wheel, &entry->timer, first_tick);
+	}
+
+	sched->count = sensors->count;
+	return true;
+}
+
+/** Queue a due sensor if its previous cycle has finished, and re-schedule it
+  for the next interval
+  @param timer Sensor entry timer
+  @param vsched Scheduler
+  */
+static void rb_sensor_scheduler_due(struct rb_timer_wheel_entry *timer,
+				    void *vsched) {
+	struct rb_sensor_scheduler *sched = vsched;
+	// timer is the first member of the entry
+	struct rb_sensor_scheduler_entry *entry =
+			(struct rb_sensor_scheduler_entry *)timer;
+	uint64_t next = rb_timer_wheel_entry_expires(timer) +
+			entry->interval_ticks;
+
+	if (rb_sensor_cycle_begin(entry->sensor)) {
+		rb_sensor_get(entry->sensor);
+		if (unlikely(!queue_sensor(sched->queue, entry->sensor))) {
+			rb_sensor_cycle_end(entry->sensor);
+			rb_sensor_put(entry->sensor);
+		}
+	}
+
+	if (next <= sched->now_tick) {
+		// Main thread has been delayed more than a whole interval. Skip
+		// lost cycles instead of queueing the sensor once per lost one
+		const uint64_t lost = (sched->now_tick - next) /
+						      entry->interval_ticks +
+				      1;
+		next += lost * entry->interval_ticks;
+	}
+
+	// Keep the sensor phase
+	rb_timer_wheel_add(&sched->wheel, &entry->timer, next);
+}
+
+size_t rb_sensor_scheduler_dispatch(struct rb_sensor_scheduler *sched,
+				    uint64_t now_ms) {
+	sched->now_tick = now_ms / sched->tick_ms;
+	return rb_timer_wheel_advance(&sched->wheel,
+				      sched->now_tick,
+				      rb_sensor_scheduler_due,
+				      sched);
+}
+
+uint64_t rb_sensor_scheduler_wait_ms(const struct rb_sensor_scheduler *sched,
+				     uint64_t now_ms) {
+	return sched->tick_ms - now_ms % sched->tick_ms;
+}
+
+void rb_sensor_scheduler_done(struct rb_sensor_scheduler *sched) {
+	free(sched->entries);
+	sched->entries = NULL;
+	sched->count = 0;
+}
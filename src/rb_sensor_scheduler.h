@@ -0,0 +1,105 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "rb_sensor.h"
+#include "rb_sensor_queue.h"
+#include "rb_timer_wheel.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// How to distribute sensors polling along their interval
+enum rb_sensor_scheduler_dispatch_mode {
+	/// All sensors with the same interval are dispatched at the same time
+	RB_SENSOR_SCHEDULER_DISPATCH_BURST,
+	/// Every sensor is dispatched at a stable offset of its interval
+	RB_SENSOR_SCHEDULER_DISPATCH_SPREAD,
+};
+
+/// Sensor scheduled in the timer wheel
+struct rb_sensor_scheduler_entry {
+	struct rb_timer_wheel_entry timer; ///< Timer wheel entry
+	rb_sensor_t *sensor;		   ///< Scheduled sensor
+	uint64_t interval_ticks;	   ///< Polling interval, in ticks
+};
+
+/// Dispatch sensors to the workers queue when they are due
+struct rb_sensor_scheduler {
+	// Private data - Do not use directly
+	struct rb_timer_wheel wheel;		   ///< Sensors timer wheel
+	sensor_queue_t *queue;			   ///< Workers queue
+	uint64_t tick_ms;			   ///< Wheel resolution
+	uint64_t now_tick;			   ///< Last dispatch tick
+	size_t count;				   ///< # of entries
+	struct rb_sensor_scheduler_entry *entries; ///< Scheduled sensors
+};
+
+/** Parse a dispatch mode string
+  @param str Dispatch mode ("burst" or "spread")
+  @param mode Parsed mode
+  @return true if valid, false in other case
+  */
+bool rb_sensor_scheduler_dispatch_mode_parse(
+		const char *str, enum rb_sensor_scheduler_dispatch_mode *mode);
+
+/** Initialize a sensor scheduler. In burst mode, all sensors will be due at
+  first dispatch. In spread mode, each sensor will be due at an offset of its
+  interval derived from a hash of its id (or name), so polling load is flat
+  along the interval.
+  @param sched Scheduler
+  @param sensors Sensors to schedule. Needs to be valid until
+  rb_sensor_scheduler_done
+  @param queue Queue to send due sensors
+  @param tick_ms Scheduler resolution in milliseconds
+  @param default_interval_ms Polling interval of the sensors that does not
+  specify its own one
+  @param mode Dispatch mode
+  @param now_ms Current monotonic time in milliseconds
+  @return true if success, false in other case
+  */
+bool rb_sensor_scheduler_init(struct rb_sensor_scheduler *sched,
+			      rb_sensors_array_t *sensors,
+			      sensor_queue_t *queue,
+			      uint64_t tick_ms,
+			      uint64_t default_interval_ms,
+			      enum rb_sensor_scheduler_dispatch_mode mode,
+			      uint64_t now_ms);
+
+/** Queue all sensors that are due at now_ms, and re-schedule them for their
+  next polling. Sensors whose previous cycle is still in flight are skipped.
+  @param sched Scheduler
+  @param now_ms Current monotonic time in milliseconds
+  @return Number of due sensors
+  */
+size_t rb_sensor_scheduler_dispatch(struct rb_sensor_scheduler *sched,
+				    uint64_t now_ms);
+
+/** Milliseconds until next scheduler tick
+  @param sched Scheduler
+  @param now_ms Current monotonic time in milliseconds
+  @return ms to wait
+  */
+uint64_t rb_sensor_scheduler_wait_ms(const struct rb_sensor_scheduler *sched,
+				     uint64_t now_ms);
+
+/** Release scheduler resources
+  @param sched Scheduler
+  */
+void rb_sensor_scheduler_done(struct rb_sensor_scheduler *sched);
@@ -17,6 +17,8 @@
   along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "config.h"
+
 #include "rb_snmp.h"
 #include "utils.h"
 
@@ -24,6 +26,11 @@
 #include <librd/rd.h>
 #include <librd/rdlog.h>
 
+#include <arpa/inet.h>
+
+#include <pthread.h>
+#include <search.h>
+
 bool new_snmp_session(struct monitor_snmp_session *ss,
 		      netsnmp_session *params) {
 
@@ -38,15 +45,192 @@ bool new_snmp_session(struct monitor_snmp_session *ss,
 	return ss->sessp != NULL;
 }
 
+uint64_t snmp_session_timeout_us(const struct monitor_snmp_session *ss) {
+	const long timeout = snmp_sess_session(ss->sessp)->timeout;
+	return timeout > 0 ? (uint64_t)timeout : 0;
+}
+
+/// Lowest timeout the RTT estimator can compute. It prevents that a few very
+/// fast responses make us drop a response that is only a bit slower.
+#define SNMP_RTT_MIN_RTO_US (50 * 1000)
+
+/// Max backoff shift after consecutive timeouts
+#define SNMP_RTT_MAX_BACKOFF 16
+
+void snmp_rtt_init(struct snmp_rtt *rtt, uint64_t max_rto_us) {
+	memset(rtt, 0, sizeof(*rtt));
+	pthread_mutex_init(&rtt->lock, NULL);
+	rtt->max_rto_us = max_rto_us;
+}
+
+void snmp_rtt_done(struct snmp_rtt *rtt) {
+	pthread_mutex_destroy(&rtt->lock);
+}
+
+uint64_t snmp_rtt_timeout_us(struct snmp_rtt *rtt) {
+	pthread_mutex_lock(&rtt->lock);
+	uint64_t ret = rtt->max_rto_us;
+	if (rtt->valid) {
+		uint64_t rto_us = rtt->srtt_us + 4 * rtt->rttvar_us;
+		if (rto_us < SNMP_RTT_MIN_RTO_US) {
+			rto_us = SNMP_RTT_MIN_RTO_US;
+		}
+		rto_us <<= rtt->backoff;
+		if (rto_us < ret) {
+			ret = rto_us;
+		}
+	}
+	pthread_mutex_unlock(&rtt->lock);
+
+	return ret;
+}
+
+void snmp_rtt_sample(struct snmp_rtt *rtt,
+		     uint64_t timeout_us,
+		     uint64_t elapsed_us) {
+	if (elapsed_us > timeout_us) {
+		// Karn's algorithm: The response could be the answer of any
+		// retry, so we can't know the real round trip time.
+		return;
+	}
+
+	pthread_mutex_lock(&rtt->lock);
+	if (!rtt->valid) {
+		rtt->srtt_us = elapsed_us;
+		rtt->rttvar_us = elapsed_us / 2;
+		rtt->valid = true;
+	} else {
+		const uint64_t delta = rtt->srtt_us > elapsed_us
+					       ? rtt->srtt_us - elapsed_us
+					       : elapsed_us - rtt->srtt_us;
+		rtt->rttvar_us = (3 * rtt->rttvar_us + delta) / 4;
+		rtt->srtt_us = (7 * rtt->srtt_us + elapsed_us) / 8;
+	}
+	rtt->backoff = 0;
+	pthread_mutex_unlock(&rtt->lock);
+}
+
+void snmp_rtt_timeout(struct snmp_rtt *rtt) {
+	pthread_mutex_lock(&rtt->lock);
+	if (rtt->backoff < SNMP_RTT_MAX_BACKOFF) {
+		rtt->backoff++;
+	}
+	pthread_mutex_unlock(&rtt->lock);
+}
+
+bool snmp_rtt_srtt_us(struct snmp_rtt *rtt, uint64_t *srtt_us) {
+	pthread_mutex_lock(&rtt->lock);
+	const bool ret = rtt->valid;
+	*srtt_us = rtt->srtt_us;
+	pthread_mutex_unlock(&rtt->lock);
+
+	return ret;
+}
+
+uint64_t snmp_session_request_timeout(struct monitor_snmp_session *session) {
+	if (NULL == session->rtt) {
+		return snmp_session_timeout_us(session);
+	}
+
+	const uint64_t ret = snmp_rtt_timeout_us(session->rtt);
+	snmp_sess_session(session->sessp)->timeout = (long)ret;
+	return ret;
+}
+
+void snmp_session_request_done(struct monitor_snmp_session *session,
+			       uint64_t timeout_us,
+			       uint64_t sent_us,
+			       bool answered) {
+	if (session->stats) {
+		ATOMIC_OP(add,
+			  fetch,
+			  answered ? &session->stats->answered
+				   : &session->stats->timeouts,
+			  1);
+	}
+
+	if (NULL == session->rtt) {
+		return;
+	}
+
+	if (answered) {
+		snmp_rtt_sample(session->rtt,
+				timeout_us,
+				rb_monotonic_us() - sent_us);
+	} else {
+		snmp_rtt_timeout(session->rtt);
+	}
+}
+
+/** Synchronous SNMP request, using the session adaptive timeout
+  @param session SNMP session
+  @param pdu PDU to send. It is consumed.
+  @param response SNMP response
+  @return net-snmp status
+  */
+static int snmp_session_synch_response(struct monitor_snmp_session *session,
+				       struct snmp_pdu *pdu,
+				       struct snmp_pdu **response) {
+	const uint64_t timeout_us = snmp_session_request_timeout(session);
+	const uint64_t sent_us = rb_monotonic_us();
+	const int ret = snmp_sess_synch_response(session->sessp, pdu, response);
+	if (STAT_SUCCESS == ret || STAT_TIMEOUT == ret) {
+		snmp_session_request_done(session,
+					  timeout_us,
+					  sent_us,
+					  STAT_SUCCESS == ret);
+	}
+	return ret;
+}
+
 monitor_value *snmp_solve_variable(const struct variable_list *var) {
 	// See in /usr/include/net-snmp/types.h
 	monitor_value *ret = NULL;
 
 	switch (var->type) {
 	case ASN_GAUGE:
+		ret = new_monitor_value_double((uint32_t)*var->val.integer);
+		break;
 	case ASN_INTEGER:
 		ret = new_monitor_value(*var->val.integer);
 		break;
+	case ASN_COUNTER:
+		ret = new_monitor_value_counter((uint32_t)*var->val.integer,
+						32);
+		break;
+	case ASN_TIMETICKS:
+		// Only go back if the agent restarts
+		ret = new_monitor_value_counter((uint32_t)*var->val.integer,
+						64);
+		break;
+	case ASN_COUNTER64: {
+		const uint64_t counter =
+				(uint64_t)(uint32_t)var->val.counter64->high
+						<< 32 |
+				(uint32_t)var->val.counter64->low;
+		ret = new_monitor_value_counter(counter, 64);
+		break;
+	}
+	case ASN_IPADDRESS: {
+		char ip_str[INET_ADDRSTRLEN];
+		if (unlikely(var->val_len != 4 ||
+			     NULL == inet_ntop(AF_INET,
+					       var->val.string,
+					       ip_str,
+					       sizeof(ip_str)))) {
+			rdlog(LOG_WARNING,
+			      "Invalid IpAddress in SNMP response");
+			break;
+		}
+
+		char *mv_string = strdup(ip_str);
+		if (alloc_unlikely(!mv_string)) {
+			goto err;
+		}
+
+		ret = new_monitor_value_strn(mv_string, strlen(mv_string));
+		break;
+	}
 	case ASN_OCTET_STR: {
 		if (unlikely(var->val_len == 0)) {
 			// No return at all
@@ -75,18 +259,139 @@ err:
 	return ret;
 }
 
-monitor_value *snmp_query_response(const char *oid_string,
+/// Cached oid resolution
+struct snmp_oid_cache_entry {
+	char *str;	 ///< Oid string
+	size_t name_len;   ///< Resolved oid length
+	oid name[];	///< Resolved oid
+};
+
+/// Process-wide cache of oid resolutions, shared by all sensors
+static struct {
+	pthread_mutex_t lock; ///< Cache lock
+	void *root;	   ///< tsearch tree of snmp_oid_cache_entry
+} snmp_oid_cache = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int snmp_oid_cache_entry_cmp(const void *a, const void *b) {
+	const struct snmp_oid_cache_entry *entry_a = a, *entry_b = b;
+	return strcmp(entry_a->str, entry_b->str);
+}
+
+/** Resolve an oid string, using the cache if possible
+  @param oid_string Oid string
+  @param name Resolved oid. Need to have room for MAX_OID_LEN elements
+  @param name_len Resolved oid length
+  @return true if success, false in other case
+  */
+static bool snmp_oid_resolve(const char *oid_string,
+			     oid *name,
+			     size_t *name_len) {
+	union {
+		const char *cstr;
+		char *str;
+	} key_str = {.cstr = oid_string};
+	const struct snmp_oid_cache_entry key = {.str = key_str.str};
+	const struct snmp_oid_cache_entry *entry = NULL;
+	bool ret = true;
+
+	pthread_mutex_lock(&snmp_oid_cache.lock);
+	void *node = tfind(&key,
+			   &snmp_oid_cache.root,
+			   snmp_oid_cache_entry_cmp);
+	if (node) {
+		entry = *(const struct snmp_oid_cache_entry **)node;
+		memcpy(name, entry->name, entry->name_len * sizeof(name[0]));
+		*name_len = entry->name_len;
+		goto unlock;
+	}
+
+	// Only resolved oids reach the cache, so users can fix them loading
+	// the missing MIB
+	*name_len = MAX_OID_LEN;
+	if (!read_objid(oid_string, name, name_len)) {
+		ret = false;
+		goto unlock;
+	}
+
+	const size_t new_entry_size =
+			sizeof(struct snmp_oid_cache_entry) +
+			*name_len * sizeof(name[0]);
+	struct snmp_oid_cache_entry *new_entry = malloc(new_entry_size);
+	char *new_entry_str = strdup(oid_string);
+	if (alloc_unlikely(NULL == new_entry || NULL == new_entry_str)) {
+		// We can still return resolved oid
+		free(new_entry);
+		free(new_entry_str);
+		goto unlock;
+	}
+
+	new_entry->str = new_entry_str;
+	new_entry->name_len = *name_len;
+	memcpy(new_entry->name, name, *name_len * sizeof(name[0]));
+	if (NULL == tsearch(new_entry,
+			    &snmp_oid_cache.root,
+			    snmp_oid_cache_entry_cmp)) {
+		free(new_entry->str);
+		free(new_entry);
+	}
+
+unlock:
+	pthread_mutex_unlock(&snmp_oid_cache.lock);
+	return ret;
+}
+
+static void snmp_oid_cache_entry_done(void *ventry) {
+	struct snmp_oid_cache_entry *entry = ventry;
+	free(entry->str);
+	free(entry);
+}
+
+void snmp_oid_cache_done(void) {
+	pthread_mutex_lock(&snmp_oid_cache.lock);
+	tdestroy(snmp_oid_cache.root, snmp_oid_cache_entry_done);
+	snmp_oid_cache.root = NULL;
+	pthread_mutex_unlock(&snmp_oid_cache.lock);
+}
+
+bool snmp_oid_init(struct snmp_oid *snmp_oid, const char *oid_string) {
+	oid name[MAX_OID_LEN];
+	size_t name_len = 0;
+
+	memset(snmp_oid, 0, sizeof(*snmp_oid));
+	if (!snmp_oid_resolve(oid_string, name, &name_len)) {
+		rdlog(LOG_ERR, "Couldn't parse SNMP OID %s", oid_string);
+		return false;
+	}
+
+	snmp_oid->name = malloc(name_len * sizeof(name[0]));
+	if (alloc_unlikely(NULL == snmp_oid->name)) {
+		rdlog(LOG_ERR,
+		      "Couldn't allocate SNMP OID %s (OOM?)",
+		      oid_string);
+		return false;
+	}
+
+	memcpy(snmp_oid->name, name, name_len * sizeof(name[0]));
+	snmp_oid->name_len = name_len;
+	snmp_oid->str = oid_string;
+	return true;
+}
+
+void snmp_oid_done(struct snmp_oid *snmp_oid) {
+	free(snmp_oid->name);
+	memset(snmp_oid, 0, sizeof(*snmp_oid));
+}
+
+monitor_value *snmp_query_response(const struct snmp_oid *snmp_oid,
 				   struct monitor_snmp_session *session) {
 	struct snmp_pdu *pdu = snmp_pdu_create(SNMP_MSG_GET);
 	struct snmp_pdu *response = NULL;
 	monitor_value *ret = NULL;
 
-	oid entry_oid[MAX_OID_LEN];
-	size_t entry_oid_len = MAX_OID_LEN;
-	read_objid(oid_string, entry_oid, &entry_oid_len);
-	snmp_add_null_var(pdu, entry_oid, entry_oid_len);
-	const int status = snmp_sess_synch_response(
-			session->sessp, pdu, &response);
+	snmp_add_null_var(pdu, snmp_oid->name, snmp_oid->name_len);
+	const int status = snmp_session_synch_response(session, pdu, &response);
 
 	if (status != STAT_SUCCESS) {
 		rdlog(LOG_ERR,
@@ -103,7 +408,7 @@ monitor_value *snmp_query_response(const char *oid_string,
 
 	rdlog(LOG_DEBUG,
 	      "SNMP OID %s response type %d",
-	      oid_string,
+	      snmp_oid->str,
 	      response->variables->type);
 
 	/// @todo for(vars=response->variables; vars; vars=vars->next_variable)
@@ -116,6 +421,320 @@ err:
 	return ret;
 }
 
+struct snmp_pdu *snmp_get_pdu_new(const struct snmp_oid *const *oids,
+				  size_t count) {
+	struct snmp_pdu *pdu = snmp_pdu_create(SNMP_MSG_GET);
+	if (alloc_unlikely(NULL == pdu)) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP PDU (OOM?)");
+		return NULL;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		snmp_add_null_var(pdu, oids[i]->name, oids[i]->name_len);
+	}
+
+	return pdu;
+}
+
+bool snmp_get_response_process(const struct snmp_pdu *response,
+			       const struct snmp_oid *const *oids,
+			       size_t count,
+			       monitor_value **values,
+			       struct snmp_get_retry *retry) {
+	if (SNMP_ERR_TOOBIG == response->errstat && count > 1) {
+		rdlog(LOG_DEBUG,
+		      "SNMP response too big for %zu oids, splitting request",
+		      count);
+		retry->split = count / 2;
+		retry->skip = 0;
+		return true;
+	}
+
+	if (SNMP_ERR_NOERROR != response->errstat) {
+		const long errindex = response->errindex;
+		rdlog(LOG_ERR,
+		      "SNMP error in response: %s",
+		      snmp_errstring((int)response->errstat));
+		if (SNMP_ERR_TOOBIG != response->errstat && errindex > 0 &&
+		    (size_t)errindex <= count) {
+			// Retry without the failed variable
+			const size_t bad_pos = (size_t)errindex - 1;
+			rdlog(LOG_ERR,
+			      "Discarding SNMP OID %s of request",
+			      oids[bad_pos]->str);
+			retry->split = bad_pos;
+			retry->skip = 1;
+			return true;
+		}
+		return false;
+	}
+
+	// Varbinds are returned in the same order they were requested
+	const struct variable_list *var = response->variables;
+	for (size_t i = 0; var && i < count; ++i, var = var->next_variable) {
+		rdlog(LOG_DEBUG,
+		      "SNMP OID %s response type %d",
+		      oids[i]->str,
+		      var->type);
+		values[i] = snmp_solve_variable(var);
+	}
+
+	return false;
+}
+
+/** Ask for a set of oids in a single SNMP GET PDU. If the agent answers
+  tooBig, the set is split in two halves. If the agent reports an error in a
+  specific variable (SNMPv1 noSuchName), that variable is discarded and the
+  rest are asked again.
+  @param session SNMP session
+  @param oids Oids to ask for
+  @param count Number of oids
+  @param values Returned values, in the same order of oids
+  */
+static void snmp_query_responses0(struct monitor_snmp_session *session,
+				  const struct snmp_oid *const *oids,
+				  size_t count,
+				  monitor_value **values) {
+	struct snmp_pdu *response = NULL;
+	struct snmp_get_retry retry;
+	bool retry_rc = false;
+
+	if (0 == count) {
+		return;
+	}
+
+	struct snmp_pdu *pdu = snmp_get_pdu_new(oids, count);
+	if (NULL == pdu) {
+		return;
+	}
+
+	const int status = snmp_session_synch_response(session, pdu, &response);
+	if (status != STAT_SUCCESS) {
+		rdlog(LOG_ERR,
+		      "Snmp error: %s",
+		      snmp_api_errstring(snmp_sess_session(session->sessp)
+							 ->s_snmp_errno));
+		goto err;
+	}
+
+	if (NULL == response) {
+		rdlog(LOG_ERR, "No SNMP response given.");
+		goto err;
+	}
+
+	retry_rc = snmp_get_response_process(
+			response, oids, count, values, &retry);
+
+err:
+	if (response) {
+		snmp_free_pdu(response);
+	}
+
+	if (retry_rc) {
+		const size_t next = retry.split + retry.skip;
+		snmp_query_responses0(session, oids, retry.split, values);
+		snmp_query_responses0(session,
+				      oids + next,
+				      count - next,
+				      values + next);
+	}
+}
+
+void snmp_query_responses(struct monitor_snmp_session *session,
+			  const struct snmp_oid *const *oids,
+			  size_t count,
+			  size_t max_oids_per_pdu,
+			  monitor_value **values) {
+	assert(max_oids_per_pdu > 0);
+
+	memset(values, 0, count * sizeof(values[0]));
+	for (size_t i = 0; i < count; i += max_oids_per_pdu) {
+		const size_t chunk = count - i < max_oids_per_pdu
+					     ? count - i
+					     : max_oids_per_pdu;
+		snmp_query_responses0(session, oids + i, chunk, values + i);
+	}
+}
+
+/** Set a walk row value. Only numeric rows have value in the vector.
+  @param vector Walk vector
+  @param i Row index
+  @param var SNMP variable of the row
+  */
+static void snmp_walk_set(monitor_value *vector,
+			  size_t i,
+			  const struct variable_list *var) {
+	switch (var->type) {
+	case ASN_GAUGE:
+		monitor_value_vector_set(
+				vector, i, (uint32_t)*var->val.integer);
+		break;
+	case ASN_INTEGER:
+		monitor_value_vector_set(vector, i, *var->val.integer);
+		break;
+	case ASN_COUNTER:
+		monitor_value_vector_set_counter(
+				vector, i, (uint32_t)*var->val.integer, 32);
+		break;
+	case ASN_TIMETICKS:
+		// Only go back if the agent restarts
+		monitor_value_vector_set_counter(
+				vector, i, (uint32_t)*var->val.integer, 64);
+		break;
+	case ASN_COUNTER64: {
+		const uint64_t counter =
+				(uint64_t)(uint32_t)var->val.counter64->high
+						<< 32 |
+				(uint32_t)var->val.counter64->low;
+		monitor_value_vector_set_counter(vector, i, counter, 64);
+		break;
+	}
+	default:
+		rdlog(LOG_DEBUG,
+		      "Skipping non numeric walk row %zu (type %d)",
+		      i,
+		      var->type);
+		break;
+	};
+}
+
+monitor_value *snmp_walk_response(const struct snmp_oid *snmp_oid,
+				  long max_repetitions,
+				  struct monitor_snmp_session *session) {
+	const char *oid_string = snmp_oid->str;
+	const oid *root_oid = snmp_oid->name;
+	const size_t root_oid_len = snmp_oid->name_len;
+	oid next_oid[MAX_OID_LEN];
+	size_t next_oid_len = root_oid_len;
+	monitor_value *ret = new_monitor_value_vector(0);
+	size_t count = 0;
+	bool walking = true;
+	uint64_t index_hash = RB_FNV1A_INIT;
+
+	if (alloc_unlikely(NULL == ret)) {
+		return NULL;
+	}
+
+	memcpy(next_oid, root_oid, root_oid_len * sizeof(root_oid[0]));
+
+	// SNMPv1 has no GETBULK
+	const bool getbulk = SNMP_VERSION_1 !=
+			     snmp_sess_session(session->sessp)->version;
+
+	while (walking) {
+		struct snmp_pdu *response = NULL;
+		struct snmp_pdu *pdu = snmp_pdu_create(
+				getbulk ? SNMP_MSG_GETBULK : SNMP_MSG_GETNEXT);
+		if (alloc_unlikely(NULL == pdu)) {
+			rdlog(LOG_ERR, "Couldn't allocate SNMP PDU (OOM?)");
+			goto err;
+		}
+
+		if (getbulk) {
+			pdu->non_repeaters = 0;
+			pdu->max_repetitions = max_repetitions;
+		}
+		snmp_add_null_var(pdu, next_oid, next_oid_len);
+
+		const int status = snmp_session_synch_response(
+				session, pdu, &response);
+		if (status != STAT_SUCCESS || NULL == response) {
+			rdlog(LOG_ERR,
+			      "Snmp error walking %s: %s",
+			      oid_string,
+			      snmp_api_errstring(
+					      snmp_sess_session(session->sessp)
+							      ->s_snmp_errno));
+			if (response) {
+				snmp_free_pdu(response);
+			}
+			goto err;
+		}
+
+		if (SNMP_ERR_NOSUCHNAME == response->errstat && !getbulk) {
+			// SNMPv1 end of MIB
+			walking = false;
+		} else if (SNMP_ERR_NOERROR != response->errstat) {
+			rdlog(LOG_ERR,
+			      "SNMP error walking %s: %s",
+			      oid_string,
+			      snmp_errstring((int)response->errstat));
+			snmp_free_pdu(response);
+			goto err;
+		}
+
+		const struct variable_list *var = response->variables;
+		for (; walking && var; var = var->next_variable) {
+			if (SNMP_ENDOFMIBVIEW == var->type ||
+			    SNMP_NOSUCHOBJECT == var->type ||
+			    SNMP_NOSUCHINSTANCE == var->type ||
+			    var->name_length > MAX_OID_LEN ||
+			    0 != netsnmp_oid_is_subtree(root_oid,
+							root_oid_len,
+							var->name,
+							var->name_length)) {
+				// Out of table column
+				walking = false;
+				break;
+			}
+
+			if (snmp_oid_compare(var->name,
+					     var->name_length,
+					     next_oid,
+					     next_oid_len) <= 0) {
+				rdlog(LOG_ERR,
+				      "SNMP agent returned a non-increasing "
+				      "OID walking %s",
+				      oid_string);
+				walking = false;
+				break;
+			}
+
+			if (count == ret->array.size) {
+				// Grow geometrically, and fit at the end
+				const size_t new_size = count ? 2 * count : 16;
+				monitor_value *grown =
+						monitor_value_vector_resize(
+								ret, new_size);
+				if (alloc_unlikely(NULL == grown)) {
+					snmp_free_pdu(response);
+					goto err;
+				}
+				ret = grown;
+			}
+
+			snmp_walk_set(ret, count++, var);
+
+			// Row index is the OID suffix after table column
+			const size_t index_len =
+					var->name_length - root_oid_len;
+			index_hash = rb_fnv1a(index_hash,
+					      &index_len,
+					      sizeof(index_len));
+			index_hash = rb_fnv1a(index_hash,
+					      &var->name[root_oid_len],
+					      index_len * sizeof(var->name[0]));
+
+			memcpy(next_oid,
+			       var->name,
+			       var->name_length * sizeof(var->name[0]));
+			next_oid_len = var->name_length;
+		}
+
+		if (NULL == response->variables) {
+			walking = false;
+		}
+		snmp_free_pdu(response);
+	}
+
+	ret->array.index_hash = index_hash;
+	return monitor_value_vector_resize(ret, count);
+
+err:
+	rb_monitor_value_done(ret);
+	return NULL;
+}
+
 int net_snmp_version(const char *string_version, const char *sensor_name) {
 	if (string_version) {
 		if (0 == strcmp(string_version, "1")) {
@@ -19,18 +19,93 @@
 
 #pragma once
 
+#include "rb_timer_wheel.h"
 #include "rb_value.h"
 
 #include <net-snmp/net-snmp-config.h>
 #include <net-snmp/net-snmp-includes.h>
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+/// Round trip time estimator of an SNMP agent, in the same way TCP computes
+/// its retransmission timeout (RFC 6298). It can be shared by many sessions.
+struct snmp_rtt {
+	// Private data - Do not use directly
+	pthread_mutex_t lock;  ///< Estimator lock
+	uint64_t max_rto_us;   ///< Configured timeout, upper bound of RTO
+	uint64_t srtt_us;      ///< Smoothed round trip time
+	uint64_t rttvar_us;    ///< Round trip time variation
+	unsigned backoff;      ///< Consecutive timeouts
+	bool valid;	       ///< srtt_us has at least one sample
+};
+
+/** Initialize an RTT estimator
+  @param rtt Estimator
+  @param max_rto_us Configured timeout. Timeouts computed by the estimator will
+  never be greater than this.
+  */
+void snmp_rtt_init(struct snmp_rtt *rtt, uint64_t max_rto_us);
+
+/** Release estimator resources
+  @param rtt Estimator
+  */
+void snmp_rtt_done(struct snmp_rtt *rtt);
+
+/** Timeout to use in the next request
+  @param rtt Estimator
+  @return Timeout, in microseconds
+  */
+uint64_t snmp_rtt_timeout_us(struct snmp_rtt *rtt);
+
+/** Account a request answered
+  @param rtt Estimator
+  @param timeout_us Timeout used in the request
+  @param elapsed_us Time since request was sent until response was received
+  */
+void snmp_rtt_sample(struct snmp_rtt *rtt,
+		     uint64_t timeout_us,
+		     uint64_t elapsed_us);
+
+/** Account a request timed out. Next timeouts will be doubled until a
+  request is answered on time.
+  @param rtt Estimator
+  */
+void snmp_rtt_timeout(struct snmp_rtt *rtt);
+
+/** Smoothed round trip time
+  @param rtt Estimator
+  @param srtt_us Smoothed round trip time, in microseconds
+  @return true if there is an estimation, false if no response has been
+  measured yet
+  */
+bool snmp_rtt_srtt_us(struct snmp_rtt *rtt, uint64_t *srtt_us);
+
+/// Outcome of SNMP requests, that can be shared by many sessions. Updated
+/// atomically.
+struct snmp_requests_stats {
+	uint64_t answered; ///< Requests answered by the agent
+	uint64_t timeouts; ///< Requests timed out
+};
 
 /// Structure to be able to safely pass-around net-snmp pointer
 typedef struct monitor_snmp_session {
 	// Private data - Do not use
 	void *sessp; ///< net-snmp session opaque pointer
+	/// Agent RTT estimator to derive requests timeout. NULL if session
+	/// timeout is static.
+	struct snmp_rtt *rtt;
+	/// Where to account requests outcome. Can be NULL.
+	struct snmp_requests_stats *stats;
+
+	/// Asynchronous engine state. Only accessed from engine thread.
+	struct {
+		size_t pending; ///< Requests in flight
+		/// Next request timeout, in engine timeouts wheel
+		struct rb_timer_wheel_entry timer;
+	} engine;
 } monitor_snmp_session;
 
 /** Creates a new net-snmp session based on config
@@ -39,21 +114,125 @@ typedef struct monitor_snmp_session {
   */
 bool new_snmp_session(struct monitor_snmp_session *ss, netsnmp_session *params);
 
+/** Configured timeout of a session
+  @param ss SNMP session
+  @return Timeout of each try, in microseconds
+  */
+uint64_t snmp_session_timeout_us(const struct monitor_snmp_session *ss);
+
+/** Prepare session timeout for a new request. If session has a RTT
+  estimator, timeout is derived from it.
+  @param session SNMP session
+  @return Timeout of each try of the request, in microseconds
+  */
+uint64_t snmp_session_request_timeout(struct monitor_snmp_session *session);
+
+/** Feed session RTT estimator and stats with the result of a request
+  @param session SNMP session
+  @param timeout_us Timeout returned by snmp_session_request_timeout
+  @param sent_us Time the request was sent (rb_monotonic_us)
+  @param answered true if agent answered, false if request timed out
+  */
+void snmp_session_request_done(struct monitor_snmp_session *session,
+			       uint64_t timeout_us,
+			       uint64_t sent_us,
+			       bool answered);
+
 /** Resolve SNMP variable to a monitor value
   @param var SNMP variable
   @return Monitor value return variable
   */
 monitor_value *snmp_solve_variable(const struct variable_list *var);
 
+/// SNMP oid resolved to its binary form
+struct snmp_oid {
+	const char *str; ///< Oid as user wrote it (numeric or symbolic)
+	oid *name;       ///< Resolved oid
+	size_t name_len; ///< Resolved oid length
+};
+
+/** Resolve an oid string. Resolutions are cached process-wide, so every
+  oid string goes through the MIB parser only once.
+  @param snmp_oid Oid to initialize
+  @param oid_string Oid string. It is borrowed, so it needs to be valid
+  while snmp_oid is in use.
+  @return true if success, false if oid can't be resolved
+  @note Need to free snmp_oid with snmp_oid_done
+  */
+bool snmp_oid_init(struct snmp_oid *snmp_oid, const char *oid_string);
+
+/** Release resources of an oid
+  @param snmp_oid Oid
+  */
+void snmp_oid_done(struct snmp_oid *snmp_oid);
+
+/// Release oid resolutions cache
+void snmp_oid_cache_done(void);
+
 /**
   SNMP request & response adaption.
-  @param oid_string String representing oid
+  @param snmp_oid   Oid to ask for
   @param session    SNMP session to use
   @return           New monitor value
  */
-monitor_value *snmp_query_response(const char *oid_string,
+monitor_value *snmp_query_response(const struct snmp_oid *snmp_oid,
 				   struct monitor_snmp_session *session);
 
+/** Create a SNMP GET PDU that asks for a set of oids
+  @param oids Oids to ask for
+  @param count Number of oids
+  @return New PDU, or NULL if error
+  */
+struct snmp_pdu *snmp_get_pdu_new(const struct snmp_oid *const *oids,
+				  size_t count);
+
+/// Oids that need to be asked again after a SNMP GET response
+struct snmp_get_retry {
+	size_t split; ///< Oids [0, split) need to be asked again
+	size_t skip;  ///< Oids [split + skip, count) need to be asked again
+};
+
+/** Store SNMP GET response variables in values. If the agent answers tooBig,
+  or reports an error in a specific variable, nothing is stored and oids need
+  to be asked again in two different requests.
+  @param response SNMP response
+  @param oids Asked oids
+  @param count Number of asked oids
+  @param values Returned values, in the same order of oids
+  @param retry Oids to ask again
+  @return true if oids need to be asked again following retry
+  */
+bool snmp_get_response_process(const struct snmp_pdu *response,
+			       const struct snmp_oid *const *oids,
+			       size_t count,
+			       monitor_value **values,
+			       struct snmp_get_retry *retry);
+
+/** Ask for many oids using as few SNMP GET requests as possible.
+  @param session SNMP session to use
+  @param oids Oids to ask for
+  @param count Number of oids
+  @param max_oids_per_pdu Max oids to ask for in the same request
+  @param values Returned values, in the same order than oids. NULL if
+  that oid could not be obtained.
+  */
+void snmp_query_responses(struct monitor_snmp_session *session,
+			  const struct snmp_oid *const *oids,
+			  size_t count,
+			  size_t max_oids_per_pdu,
+			  monitor_value **values);
+
+/** Walk a SNMP table column with GETBULK requests (GETNEXT in SNMPv1)
+  @param snmp_oid Column oid
+  @param max_repetitions Max rows asked in each request
+  @param session SNMP session to use
+  @return New vector monitor value, with an element per row. Rows that are
+  not numbers have no value. NULL if error.
+  */
+monitor_value *snmp_walk_response(const struct snmp_oid *snmp_oid,
+				  long max_repetitions,
+				  struct monitor_snmp_session *session);
+
 void destroy_snmp_session(struct monitor_snmp_session *);
 
 int net_snmp_version(const char *string_version, const char *sensor_name);
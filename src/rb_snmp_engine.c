@@ -0,0 +1,649 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include "rb_snmp_engine.h"
+
+#include "utils.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+
+/// Resolution of SNMP requests timeouts and retries
+#define RB_SNMP_ENGINE_TICK_MS 10
+#define RB_SNMP_ENGINE_TICK_US (RB_SNMP_ENGINE_TICK_MS * 1000)
+
+/// Max epoll events processed in the same loop iteration
+#define RB_SNMP_ENGINE_MAX_EVENTS 256
+
+/// Oids asked in the same rb_snmp_engine_get call
+struct rb_snmp_engine_batch {
+	TAILQ_ENTRY(rb_snmp_engine_batch) entry; ///< Engine list of the batch
+	struct rb_snmp_engine *engine;		 ///< Engine
+	struct monitor_snmp_session *session;    ///< Session to use
+	const struct snmp_oid *const *oids;      ///< Oids to ask for
+	size_t count;				 ///< Number of oids
+	size_t max_oids_per_pdu;		 ///< Max oids per request
+	monitor_value **values;			 ///< Returned values
+	size_t pending;				 ///< Requests in flight
+	void (*cb)(void *opaque);		 ///< Batch answered callback
+	void *opaque;				 ///< Callback opaque
+};
+
+/// SNMP GET request in flight
+struct rb_snmp_engine_request {
+	TAILQ_ENTRY(rb_snmp_engine_request) entry; ///< Engine requests list
+	/// Batch of the request. NULL if engine has been destroyed.
+	struct rb_snmp_engine_batch *batch;
+	size_t first;			    ///< First batch oid asked
+	size_t count;			    ///< Batch oids asked
+	uint64_t timeout_us;		    ///< Timeout of each try
+	uint64_t sent_us;		    ///< Time request was sent
+};
+
+struct rb_snmp_engine {
+	pthread_t thread; ///< Engine thread
+	int run;	  ///< Engine thread should keep running
+	int epoll_fd;     ///< Engine epoll
+	int event_fd;     ///< Wake up engine when new batches are submitted
+
+	pthread_mutex_t lock; ///< Submitted batches lock
+	/// Batches submitted by workers, waiting to be sent by engine thread
+	TAILQ_HEAD(, rb_snmp_engine_batch) submitted;
+
+	// Only accessed from engine thread
+	/// Next request timeout of sessions with requests in flight, in ticks
+	struct rb_timer_wheel timeouts;
+	size_t sessions_in_flight; ///< Sessions with requests in flight
+	/// Requests sent, waiting for responses
+	TAILQ_HEAD(, rb_snmp_engine_request) requests;
+	/// Batches sent, waiting for responses
+	TAILQ_HEAD(, rb_snmp_engine_batch) in_flight;
+	/// Batches completed in current loop iteration
+	TAILQ_HEAD(, rb_snmp_engine_batch) done;
+	netsnmp_large_fd_set read_fds; ///< net-snmp read fd set
+};
+
+/** Engine tick of a monotonic time
+  @param us Monotonic time, in microseconds
+  @return Engine tick
+  */
+static uint64_t snmp_engine_tick(uint64_t us) {
+	return us / RB_SNMP_ENGINE_TICK_US;
+}
+
+/** Socket of a session. It makes room for it in engine read fd set.
+  @param engine Engine
+  @param session Session
+  @return Session socket
+  */
+static int snmp_engine_session_fd(struct rb_snmp_engine *engine,
+				  struct monitor_snmp_session *session) {
+	const int fd = snmp_sess_transport(session->sessp)->sock;
+	if ((unsigned)fd >= engine->read_fds.lfs_setsize) {
+		netsnmp_large_fd_set_resize(&engine->read_fds, fd + 1);
+	}
+
+	return fd;
+}
+
+/** Account a new request in flight of a session. The first one registers the
+  session socket in engine epoll.
+  @param engine Engine
+  @param session Session
+  */
+static void snmp_engine_session_ref(struct rb_snmp_engine *engine,
+				    struct monitor_snmp_session *session) {
+	if (session->engine.pending++ > 0) {
+		return;
+	}
+
+	if (0 == engine->sessions_in_flight++) {
+		// Timeouts wheel is empty: Skip idle ticks instead of advancing
+		// through all of them
+		rb_timer_wheel_init(&engine->timeouts,
+				    snmp_engine_tick(rb_monotonic_us()));
+	}
+
+	struct epoll_event event = {
+			.events = EPOLLIN, .data.ptr = session,
+	};
+	const int fd = snmp_sess_transport(session->sessp)->sock;
+	if (0 != epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+		// Requests will only be able to time out
+		rdlog(LOG_ERR,
+		      "Couldn't add SNMP socket to engine: %s",
+		      gnu_strerror_r(errno));
+	}
+}
+
+/** Account a finished request of a session. The last one unregisters the
+  session socket, so the session can be destroyed after that without engine
+  noticing.
+  @param engine Engine
+  @param session Session
+  */
+static void snmp_engine_session_unref(struct rb_snmp_engine *engine,
+				      struct monitor_snmp_session *session) {
+	assert(session->engine.pending > 0);
+	if (--session->engine.pending > 0) {
+		return;
+	}
+
+	const int fd = snmp_sess_transport(session->sessp)->sock;
+	epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	rb_timer_wheel_del(&session->engine.timer);
+	engine->sessions_in_flight--;
+}
+
+/** Make session timer expire no later than a request deadline
+  @param engine Engine
+  @param session Session
+  @param deadline_us Request deadline, in monotonic microseconds
+  */
+static void snmp_engine_session_arm(struct rb_snmp_engine *engine,
+				    struct monitor_snmp_session *session,
+				    uint64_t deadline_us) {
+	struct rb_timer_wheel_entry *timer = &session->engine.timer;
+	// Round up, so request has expired when timer does
+	const uint64_t expires = snmp_engine_tick(
+			deadline_us + RB_SNMP_ENGINE_TICK_US - 1);
+
+	if (rb_timer_wheel_entry_armed(timer)) {
+		if (rb_timer_wheel_entry_expires(timer) <= expires) {
+			return;
+		}
+		rb_timer_wheel_del(timer);
+	}
+
+	rb_timer_wheel_add(&engine->timeouts, timer, expires);
+}
+
+static int snmp_engine_response(int op,
+				netsnmp_session *ss,
+				int reqid,
+				netsnmp_pdu *pdu,
+				void *vrequest);
+
+/** Send a SNMP GET request for a range of batch oids
+  @param batch Batch
+  @param first First oid to ask for
+  @param count Number of oids to ask for
+  */
+static void snmp_engine_send(struct rb_snmp_engine_batch *batch,
+			     size_t first,
+			     size_t count) {
+	void *sessp = batch->session->sessp;
+
+	if (0 == count) {
+		return;
+	}
+
+	struct rb_snmp_engine_request *request = calloc(1, sizeof(*request));
+	if (alloc_unlikely(NULL == request)) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP request (OOM?)");
+		return;
+	}
+
+	request->batch = batch;
+	request->first = first;
+	request->count = count;
+
+	struct snmp_pdu *pdu = snmp_get_pdu_new(batch->oids + first, count);
+	if (NULL == pdu) {
+		goto err;
+	}
+
+	request->timeout_us = snmp_session_request_timeout(batch->session);
+	request->sent_us = rb_monotonic_us();
+	if (0 == snmp_sess_async_send(sessp, pdu, snmp_engine_response,
+				      request)) {
+		rdlog(LOG_ERR,
+		      "Snmp error: %s",
+		      snmp_api_errstring(snmp_sess_session(sessp)
+							 ->s_snmp_errno));
+		snmp_free_pdu(pdu);
+		goto err;
+	}
+
+	TAILQ_INSERT_TAIL(&batch->engine->requests, request, entry);
+	batch->pending++;
+	snmp_engine_session_ref(batch->engine, batch->session);
+	snmp_engine_session_arm(batch->engine,
+				batch->session,
+				request->sent_us + request->timeout_us);
+	return;
+
+err:
+	free(request);
+}
+
+/** net-snmp callback of SNMP GET requests
+  @param op Callback operation
+  @param ss SNMP session (unused)
+  @param reqid Request id (unused)
+  @param pdu SNMP response
+  @param vrequest Request
+  @return 1, so net-snmp frees the response
+  */
+static int snmp_engine_response(int op,
+				netsnmp_session *ss,
+				int reqid,
+				netsnmp_pdu *pdu,
+				void *vrequest) {
+	struct rb_snmp_engine_request *request = vrequest;
+	struct rb_snmp_engine_batch *batch = request->batch;
+	struct snmp_get_retry retry;
+	bool retry_rc = false;
+	(void)ss;
+	(void)reqid;
+
+	if (NULL == batch) {
+		// Session closed after engine destruction
+		free(request);
+		return 1;
+	}
+
+	struct rb_snmp_engine *engine = batch->engine;
+	TAILQ_REMOVE(&engine->requests, request, entry);
+
+	switch (op) {
+	case NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE:
+		snmp_session_request_done(batch->session,
+					  request->timeout_us,
+					  request->sent_us,
+					  true);
+		retry_rc = snmp_get_response_process(
+				pdu,
+				batch->oids + request->first,
+				request->count,
+				batch->values + request->first,
+				&retry);
+		break;
+
+	case NETSNMP_CALLBACK_OP_TIMED_OUT:
+		snmp_session_request_done(batch->session,
+					  request->timeout_us,
+					  request->sent_us,
+					  false);
+		rdlog(LOG_ERR,
+		      "Timeout waiting for SNMP response of OID %s",
+		      batch->oids[request->first]->str);
+		break;
+
+	default:
+		rdlog(LOG_ERR, "SNMP request failed (operation %d)", op);
+		break;
+	};
+
+	if (retry_rc) {
+		// Send before accounting this request, so batch does not look
+		// answered
+		const size_t next = retry.split + retry.skip;
+		snmp_engine_send(batch, request->first, retry.split);
+		snmp_engine_send(batch,
+				 request->first + next,
+				 request->count - next);
+	}
+
+	snmp_engine_session_unref(engine, batch->session);
+	free(request);
+	if (0 == --batch->pending) {
+		TAILQ_REMOVE(&engine->in_flight, batch, entry);
+		TAILQ_INSERT_TAIL(&engine->done, batch, entry);
+	}
+
+	return 1;
+}
+
+/** Send all requests of a submitted batch
+  @param engine Engine
+  @param batch Batch
+  */
+static void snmp_engine_batch_start(struct rb_snmp_engine *engine,
+				    struct rb_snmp_engine_batch *batch) {
+	TAILQ_INSERT_TAIL(&engine->in_flight, batch, entry);
+	for (size_t i = 0; i < batch->count; i += batch->max_oids_per_pdu) {
+		const size_t chunk = batch->count - i < batch->max_oids_per_pdu
+					     ? batch->count - i
+					     : batch->max_oids_per_pdu;
+		snmp_engine_send(batch, i, chunk);
+	}
+
+	if (0 == batch->pending) {
+		// Nothing could be sent
+		TAILQ_REMOVE(&engine->in_flight, batch, entry);
+		TAILQ_INSERT_TAIL(&engine->done, batch, entry);
+	}
+}
+
+/** Start all batches submitted by workers
+  @param engine Engine
+  */
+static void snmp_engine_submitted(struct rb_snmp_engine *engine) {
+	uint64_t events = 0;
+	if (read(engine->event_fd, &events, sizeof(events)) < 0 &&
+	    errno != EAGAIN) {
+		rdlog(LOG_ERR,
+		      "Couldn't read SNMP engine event: %s",
+		      gnu_strerror_r(errno));
+	}
+
+	pthread_mutex_lock(&engine->lock);
+	struct rb_snmp_engine_batch *batch = NULL;
+	while ((batch = TAILQ_FIRST(&engine->submitted))) {
+		TAILQ_REMOVE(&engine->submitted, batch, entry);
+		pthread_mutex_unlock(&engine->lock);
+		snmp_engine_batch_start(engine, batch);
+		pthread_mutex_lock(&engine->lock);
+	}
+	pthread_mutex_unlock(&engine->lock);
+}
+
+/** Read pending responses of a session
+  @param engine Engine
+  @param session Session with data to read
+  */
+static void snmp_engine_read(struct rb_snmp_engine *engine,
+			     struct monitor_snmp_session *session) {
+	if (0 == session->engine.pending) {
+		// Already answered or timed out in this loop iteration
+		return;
+	}
+
+	const int fd = snmp_engine_session_fd(engine, session);
+	NETSNMP_LARGE_FD_SET(fd, &engine->read_fds);
+	snmp_sess_read2(session->sessp, &engine->read_fds);
+	NETSNMP_LARGE_FD_CLR(fd, &engine->read_fds);
+}
+
+/** Retransmit or time out expired requests of a session, and wait for the
+  next request to expire
+  @param timer Session timer
+  @param vengine Engine
+  */
+static void snmp_engine_session_timeout(struct rb_timer_wheel_entry *timer,
+					void *vengine) {
+	struct rb_snmp_engine *engine = vengine;
+	const size_t timer_offset =
+			offsetof(struct monitor_snmp_session, engine.timer);
+	struct monitor_snmp_session *session =
+			(void *)((char *)timer - timer_offset);
+
+	snmp_sess_timeout(session->sessp);
+	if (0 == session->engine.pending) {
+		// All requests timed out
+		return;
+	}
+
+	struct timeval timeout = {0};
+	int numfds = 0, block = 1;
+	const int fd = snmp_engine_session_fd(engine, session);
+	snmp_sess_select_info2(session->sessp,
+			       &numfds,
+			       &engine->read_fds,
+			       &timeout,
+			       &block);
+	NETSNMP_LARGE_FD_CLR(fd, &engine->read_fds);
+
+	// If net-snmp does not know the next timeout, check again next tick
+	const uint64_t timeout_us =
+			block ? 0
+			      : (uint64_t)timeout.tv_sec * 1000000 +
+						(uint64_t)timeout.tv_usec;
+	snmp_engine_session_arm(
+			engine, session, rb_monotonic_us() + timeout_us);
+}
+
+/** Call callbacks of completed batches. It is done at the end of the loop
+  iteration, since callbacks can release sessions that still have events
+  in current epoll events array.
+  @param engine Engine
+  */
+static void snmp_engine_batches_done(struct rb_snmp_engine *engine) {
+	struct rb_snmp_engine_batch *batch = NULL;
+	while ((batch = TAILQ_FIRST(&engine->done))) {
+		TAILQ_REMOVE(&engine->done, batch, entry);
+		batch->cb(batch->opaque);
+		free(batch);
+	}
+}
+
+/// Engine thread main loop
+static void *snmp_engine_thread(void *vengine) {
+	struct rb_snmp_engine *engine = vengine;
+	struct epoll_event events[RB_SNMP_ENGINE_MAX_EVENTS];
+
+	while (ATOMIC_OP(add, fetch, &engine->run, 0)) {
+		const int tmo_ms = 0 == engine->sessions_in_flight
+					   ? -1
+					   : RB_SNMP_ENGINE_TICK_MS;
+		const int nevents = epoll_wait(engine->epoll_fd,
+					       events,
+					       RD_ARRAYSIZE(events),
+					       tmo_ms);
+		if (nevents < 0 && errno != EINTR) {
+			rdlog(LOG_ERR,
+			      "Couldn't wait for SNMP responses: %s",
+			      gnu_strerror_r(errno));
+		}
+
+		for (int i = 0; i < nevents; ++i) {
+			if (NULL == events[i].data.ptr) {
+				snmp_engine_submitted(engine);
+			} else {
+				snmp_engine_read(engine, events[i].data.ptr);
+			}
+		}
+
+		rb_timer_wheel_advance(&engine->timeouts,
+				       snmp_engine_tick(rb_monotonic_us()),
+				       snmp_engine_session_timeout,
+				       engine);
+
+		snmp_engine_batches_done(engine);
+	}
+
+	return NULL;
+}
+
+/** Wake up engine thread
+  @param engine Engine
+  */
+static void snmp_engine_wakeup(struct rb_snmp_engine *engine) {
+	static const uint64_t event = 1;
+	if (write(engine->event_fd, &event, sizeof(event)) < 0) {
+		rdlog(LOG_ERR,
+		      "Couldn't wake up SNMP engine: %s",
+		      gnu_strerror_r(errno));
+	}
+}
+
+struct rb_snmp_engine *rb_snmp_engine_new(void) {
+	struct rb_snmp_engine *engine = calloc(1, sizeof(*engine));
+	if (alloc_unlikely(NULL == engine)) {
+		rdlog(LOG_CRIT, "Couldn't allocate SNMP engine (OOM?)");
+		return NULL;
+	}
+
+	pthread_mutex_init(&engine->lock, NULL);
+	TAILQ_INIT(&engine->submitted);
+	rb_timer_wheel_init(&engine->timeouts,
+			    snmp_engine_tick(rb_monotonic_us()));
+	TAILQ_INIT(&engine->requests);
+	TAILQ_INIT(&engine->in_flight);
+	TAILQ_INIT(&engine->done);
+	netsnmp_large_fd_set_init(&engine->read_fds, FD_SETSIZE);
+
+	engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (engine->epoll_fd < 0) {
+		rdlog(LOG_CRIT,
+		      "Couldn't create SNMP engine epoll: %s",
+		      gnu_strerror_r(errno));
+		goto epoll_err;
+	}
+
+	engine->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (engine->event_fd < 0) {
+		rdlog(LOG_CRIT,
+		      "Couldn't create SNMP engine eventfd: %s",
+		      gnu_strerror_r(errno));
+		goto eventfd_err;
+	}
+
+	struct epoll_event event = {
+			.events = EPOLLIN, .data.ptr = NULL,
+	};
+	if (0 != epoll_ctl(engine->epoll_fd,
+			   EPOLL_CTL_ADD,
+			   engine->event_fd,
+			   &event)) {
+		rdlog(LOG_CRIT,
+		      "Couldn't add eventfd to SNMP engine: %s",
+		      gnu_strerror_r(errno));
+		goto thread_err;
+	}
+
+	engine->run = 1;
+	const int create_rc = pthread_create(
+			&engine->thread, NULL, snmp_engine_thread, engine);
+	if (0 != create_rc) {
+		rdlog(LOG_CRIT,
+		      "Couldn't create SNMP engine thread: %s",
+		      gnu_strerror_r(create_rc));
+		goto thread_err;
+	}
+
+	return engine;
+
+thread_err:
+	close(engine->event_fd);
+eventfd_err:
+	close(engine->epoll_fd);
+epoll_err:
+	netsnmp_large_fd_set_cleanup(&engine->read_fds);
+	pthread_mutex_destroy(&engine->lock);
+	free(engine);
+	return NULL;
+}
+
+/** Complete a batch that will not be answered, discarding the values
+  already received
+  @param batch Batch
+  */
+static void snmp_engine_batch_discard(struct rb_snmp_engine_batch *batch) {
+	for (size_t i = 0; i < batch->count; ++i) {
+		if (batch->values[i]) {
+			rb_monitor_value_done(batch->values[i]);
+			batch->values[i] = NULL;
+		}
+	}
+
+	batch->cb(batch->opaque);
+	free(batch);
+}
+
+void rb_snmp_engine_done(struct rb_snmp_engine *engine) {
+	ATOMIC_OP(fetch, and, &engine->run, 0);
+	snmp_engine_wakeup(engine);
+	pthread_join(engine->thread, NULL);
+
+	// net-snmp will release requests in flight when their sessions are
+	// closed, so they can't point to engine anymore
+	struct rb_snmp_engine_request *request = NULL;
+	while ((request = TAILQ_FIRST(&engine->requests))) {
+		TAILQ_REMOVE(&engine->requests, request, entry);
+		rb_timer_wheel_del(&request->batch->session->engine.timer);
+		request->batch = NULL;
+	}
+
+	size_t discarded = 0;
+	struct rb_snmp_engine_batch *batch = NULL;
+	while ((batch = TAILQ_FIRST(&engine->in_flight))) {
+		TAILQ_REMOVE(&engine->in_flight, batch, entry);
+		snmp_engine_batch_discard(batch);
+		discarded++;
+	}
+
+	while ((batch = TAILQ_FIRST(&engine->submitted))) {
+		TAILQ_REMOVE(&engine->submitted, batch, entry);
+		snmp_engine_batch_discard(batch);
+		discarded++;
+	}
+
+	if (discarded > 0) {
+		rdlog(LOG_WARNING,
+		      "Discarded responses of %zu SNMP batches not answered",
+		      discarded);
+	}
+
+	close(engine->event_fd);
+	close(engine->epoll_fd);
+	netsnmp_large_fd_set_cleanup(&engine->read_fds);
+	pthread_mutex_destroy(&engine->lock);
+	free(engine);
+}
+
+bool rb_snmp_engine_get(struct rb_snmp_engine *engine,
+			struct monitor_snmp_session *session,
+			const struct snmp_oid *const *oids,
+			size_t count,
+			size_t max_oids_per_pdu,
+			monitor_value **values,
+			void (*cb)(void *opaque),
+			void *opaque) {
+	assert(max_oids_per_pdu > 0);
+
+	if (NULL == session->sessp) {
+		// Sensor without SNMP
+		return false;
+	}
+
+	struct rb_snmp_engine_batch *batch = calloc(1, sizeof(*batch));
+	if (alloc_unlikely(NULL == batch)) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP batch (OOM?)");
+		return false;
+	}
+
+	memset(values, 0, count * sizeof(values[0]));
+	batch->engine = engine;
+	batch->session = session;
+	batch->oids = oids;
+	batch->count = count;
+	batch->max_oids_per_pdu = max_oids_per_pdu;
+	batch->values = values;
+	batch->cb = cb;
+	batch->opaque = opaque;
+
+	pthread_mutex_lock(&engine->lock);
+	TAILQ_INSERT_TAIL(&engine->submitted, batch, entry);
+	pthread_mutex_unlock(&engine->lock);
+
+	snmp_engine_wakeup(engine);
+	return true;
+}
@@ -0,0 +1,68 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "rb_snmp.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Asynchronous SNMP engine. A single thread sends the requests of all
+/// sensors and waits for all responses in the same epoll loop, so workers
+/// don't block waiting for SNMP agents.
+struct rb_snmp_engine;
+
+/** Create an asynchronous SNMP engine and start its thread. Need to be called
+  after init_snmp.
+  @return New engine, or NULL if error. Need to free with rb_snmp_engine_done
+  */
+struct rb_snmp_engine *rb_snmp_engine_new(void);
+
+/** Stop engine thread and release engine resources. Batches not answered yet
+  are completed with all their values NULL, calling their callbacks from this
+  thread.
+  @param engine Engine
+  */
+void rb_snmp_engine_done(struct rb_snmp_engine *engine);
+
+/** Ask for many oids using as few SNMP GET requests as possible, without
+  waiting for the responses. Same as snmp_query_responses, but cb will be
+  called from engine thread when all oids have been answered or have timed
+  out.
+  @param engine Engine
+  @param session SNMP session to use. It can't be used by anybody else until
+  cb is called.
+  @param oids Oids to ask for. Need to be valid until cb is called.
+  @param count Number of oids
+  @param max_oids_per_pdu Max oids to ask for in the same request
+  @param values Returned values, in the same order than oids. NULL if that oid
+  could not be obtained. Need to be valid until cb is called.
+  @param cb Callback to call when all responses are stored in values
+  @param opaque Callback opaque
+  @return true if requests are queued, false in other case. If false, cb
+  will not be called.
+  */
+bool rb_snmp_engine_get(struct rb_snmp_engine *engine,
+			struct monitor_snmp_session *session,
+			const struct snmp_oid *const *oids,
+			size_t count,
+			size_t max_oids_per_pdu,
+			monitor_value **values,
+			void (*cb)(void *opaque),
+			void *opaque);
@@ -0,0 +1,269 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_split_op.h"
+
+#include "utils.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+/** Parse a split operation name
+  @param str Split operation name
+  @param op Split operation
+  @return true if valid, false in other case
+  */
+static bool split_op_parse(const char *str, struct rb_split_op *op) {
+	static const struct {
+		const char *name;
+		enum rb_split_op_type type;
+	} ops[] = {
+			{"sum", RB_SPLIT_OP_SUM},
+			{"mean", RB_SPLIT_OP_MEAN},
+			{"min", RB_SPLIT_OP_MIN},
+			{"max", RB_SPLIT_OP_MAX},
+			{"count", RB_SPLIT_OP_COUNT},
+			{"stddev", RB_SPLIT_OP_STDDEV},
+			{"median", RB_SPLIT_OP_MEDIAN},
+	};
+
+	for (size_t i = 0; i < RD_ARRAYSIZE(ops); ++i) {
+		if (0 == strcmp(ops[i].name, str)) {
+			op->type = ops[i].type;
+			return true;
+		}
+	}
+
+	// pNN percentile
+	if ('p' != str[0] || !isdigit((unsigned char)str[1])) {
+		return false;
+	}
+
+	char *endptr = NULL;
+	op->type = RB_SPLIT_OP_PERCENTILE;
+	op->percentile = strtod(&str[1], &endptr);
+	return '\0' == *endptr && op->percentile > 0 &&
+	       op->percentile <= 100;
+}
+
+struct rb_split_ops *rb_split_ops_parse(json_object *json_split_op,
+					const char *monitor_name) {
+	if (NULL == json_split_op) {
+		return NULL;
+	}
+
+	const bool named = json_object_is_type(json_split_op, json_type_array);
+	const size_t count = named ? (size_t)json_object_array_length(
+						     json_split_op)
+				   : 1;
+
+	struct rb_split_ops *ret =
+			calloc(1, sizeof(*ret) + count * sizeof(ret->ops[0]));
+	if (alloc_unlikely(NULL == ret)) {
+		rdlog(LOG_ERR, "Couldn't allocate split ops (OOM?)");
+		return NULL;
+	}
+
+	ret->named = named;
+	for (size_t i = 0; i < count; ++i) {
+		json_object *json_op =
+				named ? json_object_array_get_idx(json_split_op,
+								  (int)i)
+				      : json_split_op;
+		const char *str = json_object_get_string(json_op);
+		struct rb_split_op *op = &ret->ops[ret->count];
+
+		if (NULL == str || !split_op_parse(str, op)) {
+			rdlog(LOG_WARNING,
+			      "Invalid split op %s of monitor %s",
+			      str,
+			      monitor_name);
+			continue;
+		}
+
+		op->name = strdup(str);
+		if (alloc_unlikely(NULL == op->name)) {
+			rdlog(LOG_ERR, "Couldn't allocate split op (OOM?)");
+			continue;
+		}
+
+		ret->count++;
+	}
+
+	if (0 == ret->count) {
+		rb_split_ops_done(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+void rb_split_ops_done(struct rb_split_ops *ops) {
+	for (size_t i = 0; i < ops->count; ++i) {
+		free(ops->ops[i].name);
+	}
+	free(ops);
+}
+
+/** Select the k-th smallest value (Hoare's quickselect). Values before k
+  will be smaller or equal than it.
+  @param values Values. They will be reordered.
+  @param count Number of values
+  @param k Position to select
+  @return k-th smallest value
+  */
+static double split_op_select(double *values, size_t count, size_t k) {
+	ssize_t left = 0, right = (ssize_t)count - 1;
+	const ssize_t sk = (ssize_t)k;
+
+	while (left < right) {
+		const double pivot = values[left + (right - left) / 2];
+		ssize_t i = left, j = right;
+
+		while (i <= j) {
+			while (values[i] < pivot) {
+				i++;
+			}
+			while (values[j] > pivot) {
+				j--;
+			}
+			if (i <= j) {
+				const double aux = values[i];
+				values[i++] = values[j];
+				values[j--] = aux;
+			}
+		}
+
+		if (sk <= j) {
+			right = j;
+		} else if (sk >= i) {
+			left = i;
+		} else {
+			break;
+		}
+	}
+
+	return values[k];
+}
+
+/** Median of values
+  @param values Values. They will be reordered.
+  @param count Number of values
+  @return Median
+  */
+static double split_op_median(double *values, size_t count) {
+	const double upper = split_op_select(values, count, count / 2);
+	if (count % 2) {
+		return upper;
+	}
+
+	// Lower middle value is the greatest of the values before upper one
+	double lower = values[0];
+	for (size_t i = 1; i < count / 2; ++i) {
+		if (values[i] > lower) {
+			lower = values[i];
+		}
+	}
+
+	return (lower + upper) / 2;
+}
+
+/** Nearest rank percentile of values
+  @param values Values. They will be reordered.
+  @param count Number of values
+  @param percentile Percentile, in (0, 100]
+  @return Percentile
+  */
+static double
+split_op_percentile(double *values, size_t count, double percentile) {
+	size_t rank = (size_t)ceil(percentile / 100 * (double)count);
+	if (rank < 1) {
+		rank = 1;
+	} else if (rank > count) {
+		rank = count;
+	}
+
+	return split_op_select(values, count, rank - 1);
+}
+
+bool rb_split_ops_compute(const struct rb_split_ops *ops,
+			  double *values,
+			  size_t count,
+			  double *results) {
+	if (0 == count) {
+		return false;
+	}
+
+	// One pass for all accumulators, using Welford's method for variance
+	double sum = 0, min = values[0], max = values[0], mean = 0, m2 = 0;
+	for (size_t i = 0; i < count; ++i) {
+		const double value = values[i];
+		const double delta = value - mean;
+
+		sum += value;
+		if (value < min) {
+			min = value;
+		}
+		if (value > max) {
+			max = value;
+		}
+		mean += delta / (double)(i + 1);
+		m2 += delta * (value - mean);
+	}
+
+	for (size_t i = 0; i < ops->count; ++i) {
+		const struct rb_split_op *op = &ops->ops[i];
+
+		switch (op->type) {
+		case RB_SPLIT_OP_SUM:
+			results[i] = sum;
+			break;
+		case RB_SPLIT_OP_MEAN:
+			results[i] = sum / (double)count;
+			break;
+		case RB_SPLIT_OP_MIN:
+			results[i] = min;
+			break;
+		case RB_SPLIT_OP_MAX:
+			results[i] = max;
+			break;
+		case RB_SPLIT_OP_COUNT:
+			results[i] = (double)count;
+			break;
+		case RB_SPLIT_OP_STDDEV:
+			results[i] = sqrt(m2 / (double)count);
+			break;
+		case RB_SPLIT_OP_MEDIAN:
+			results[i] = split_op_median(values, count);
+			break;
+		case RB_SPLIT_OP_PERCENTILE:
+		default:
+			results[i] = split_op_percentile(
+					values, count, op->percentile);
+			break;
+		};
+	}
+
+	return true;
+}
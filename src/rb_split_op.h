@@ -0,0 +1,78 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <json-c/json.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Split operation: summary of all values of a vector
+struct rb_split_op {
+	enum rb_split_op_type {
+		RB_SPLIT_OP_SUM,
+		RB_SPLIT_OP_MEAN,
+		RB_SPLIT_OP_MIN,
+		RB_SPLIT_OP_MAX,
+		RB_SPLIT_OP_COUNT,
+		RB_SPLIT_OP_STDDEV, ///< Population standard deviation
+		RB_SPLIT_OP_MEDIAN,
+		RB_SPLIT_OP_PERCENTILE, ///< Nearest rank percentile
+	} type;
+	double percentile; ///< Percentile, if type is RB_SPLIT_OP_PERCENTILE
+	char *name;	   ///< Split operation name, as configured
+};
+
+/// Split operations of a monitor
+struct rb_split_ops {
+	/// Results need to be tagged with the split operation name, because
+	/// split operations were configured as an array
+	bool named;
+	size_t count;		  ///< Number of split operations
+	struct rb_split_op ops[]; ///< Split operations
+};
+
+/** Parse monitor split operations
+  @param json_split_op Split operation name ("sum", "mean", "min", "max",
+  "count", "stddev", "median" or "pNN"), or array of them. Can be NULL.
+  @param monitor_name Monitor name, for error messages
+  @return New split operations, or NULL if there are no valid split operations.
+  Need to be freed with rb_split_ops_done.
+  */
+struct rb_split_ops *rb_split_ops_parse(json_object *json_split_op,
+					const char *monitor_name);
+
+/** Release split operations
+  @param ops Split operations
+  */
+void rb_split_ops_done(struct rb_split_ops *ops);
+
+/** Compute all split operations in one pass over the vector values. Median
+  and percentiles use selection, not a full sort.
+  @param ops Split operations
+  @param values Vector values. They will be reordered.
+  @param count Number of values
+  @param results Results of every split operation, in ops order. Need to have
+  room for ops->count results.
+  @return true if results are computed, false if there are no values
+  */
+bool rb_split_ops_compute(const struct rb_split_ops *ops,
+			  double *values,
+			  size_t count,
+			  double *results);
@@ -0,0 +1,143 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_timer_wheel.h"
+
+#include <assert.h>
+
+#define RB_TIMER_WHEEL_MASK ((uint64_t)RB_TIMER_WHEEL_SLOTS - 1)
+
+/// Max delta (in ticks) an entry can be scheduled ahead
+#define RB_TIMER_WHEEL_MAX_DELTA                                               \
+	((UINT64_C(1) << (RB_TIMER_WHEEL_BITS * RB_TIMER_WHEEL_LEVELS)) - 1)
+
+/// Slot index of tick t in level l
+#define RB_TIMER_WHEEL_INDEX(t, l)                                             \
+	(((t) >> ((l)*RB_TIMER_WHEEL_BITS)) & RB_TIMER_WHEEL_MASK)
+
+void rb_timer_wheel_init(struct rb_timer_wheel *tw, uint64_t now) {
+	tw->current = now;
+	for (size_t l = 0; l < RB_TIMER_WHEEL_LEVELS; ++l) {
+		for (size_t s = 0; s < RB_TIMER_WHEEL_SLOTS; ++s) {
+			LIST_INIT(&tw->slots[l][s]);
+		}
+	}
+}
+
+/** Place an entry in the slot its expiration belongs, relative to current
+  wheel tick
+  @param tw Timer wheel
+  @param entry Entry to place
+  */
+static void rb_timer_wheel_place(struct rb_timer_wheel *tw,
+				 struct rb_timer_wheel_entry *entry) {
+	if (entry->expires < tw->current) {
+		// Already expired, process in next tick
+		entry->expires = tw->current;
+	} else if (entry->expires - tw->current > RB_TIMER_WHEEL_MAX_DELTA) {
+		entry->expires = tw->current + RB_TIMER_WHEEL_MAX_DELTA;
+	}
+
+	const uint64_t delta = entry->expires - tw->current;
+	size_t level = 0;
+	while (level < RB_TIMER_WHEEL_LEVELS - 1 &&
+	       delta >= (UINT64_C(1) << ((level + 1) * RB_TIMER_WHEEL_BITS))) {
+		level++;
+	}
+
+	const uint64_t slot = RB_TIMER_WHEEL_INDEX(entry->expires, level);
+	LIST_INSERT_HEAD(&tw->slots[level][slot], entry, link);
+	entry->armed = true;
+}
+
+void rb_timer_wheel_add(struct rb_timer_wheel *tw,
+			struct rb_timer_wheel_entry *entry,
+			uint64_t expires) {
+	assert(!entry->armed);
+	entry->expires = expires;
+	rb_timer_wheel_place(tw, entry);
+}
+
+void rb_timer_wheel_del(struct rb_timer_wheel_entry *entry) {
+	if (entry->armed) {
+		LIST_REMOVE(entry, link);
+		entry->armed = false;
+	}
+}
+
+/** Re-distribute all entries of an upper level slot into lower levels
+  @param tw Timer wheel
+  @param level Level to cascade
+  @return Index of cascaded slot
+  */
+static uint64_t rb_timer_wheel_cascade(struct rb_timer_wheel *tw,
+				       size_t level) {
+	const uint64_t index = RB_TIMER_WHEEL_INDEX(tw->current, level);
+	struct rb_timer_wheel_list *slot = &tw->slots[level][index];
+
+	while (!LIST_EMPTY(slot)) {
+		struct rb_timer_wheel_entry *entry = LIST_FIRST(slot);
+		LIST_REMOVE(entry, link);
+		rb_timer_wheel_place(tw, entry);
+	}
+
+	return index;
+}
+
+size_t rb_timer_wheel_advance(struct rb_timer_wheel *tw,
+			      uint64_t now,
+			      void (*cb)(struct rb_timer_wheel_entry *entry,
+					 void *opaque),
+			      void *opaque) {
+	size_t ret = 0;
+
+	while (tw->current <= now) {
+		struct rb_timer_wheel_list expired;
+		const uint64_t index = RB_TIMER_WHEEL_INDEX(tw->current, 0);
+
+		// Cascade upper levels when lower level wraps
+		for (size_t l = 1; l < RB_TIMER_WHEEL_LEVELS; ++l) {
+			if (0 != RB_TIMER_WHEEL_INDEX(tw->current, l - 1) ||
+			    0 != rb_timer_wheel_cascade(tw, l)) {
+				break;
+			}
+		}
+
+		// Move expired entries apart, so callback can re-add them
+		LIST_INIT(&expired);
+		while (!LIST_EMPTY(&tw->slots[0][index])) {
+			struct rb_timer_wheel_entry *entry =
+					LIST_FIRST(&tw->slots[0][index]);
+			LIST_REMOVE(entry, link);
+			LIST_INSERT_HEAD(&expired, entry, link);
+		}
+
+		tw->current++;
+
+		while (!LIST_EMPTY(&expired)) {
+			struct rb_timer_wheel_entry *entry =
+					LIST_FIRST(&expired);
+			LIST_REMOVE(entry, link);
+			entry->armed = false;
+			ret++;
+			cb(entry, opaque);
+		}
+	}
+
+	return ret;
+}
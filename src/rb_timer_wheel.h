@@ -0,0 +1,105 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+/// Bits of each wheel level
+#define RB_TIMER_WHEEL_BITS 6
+/// Slots of each wheel level
+#define RB_TIMER_WHEEL_SLOTS (1 << RB_TIMER_WHEEL_BITS)
+/// Number of levels. Max expiration is 2^(BITS*LEVELS) ticks
+#define RB_TIMER_WHEEL_LEVELS 4
+
+/// Timer wheel entry. Embed it in the struct you want to schedule.
+struct rb_timer_wheel_entry {
+	// Private data - Do not use directly
+	LIST_ENTRY(rb_timer_wheel_entry) link; ///< Slot list link
+	uint64_t expires; ///< Tick this entry will expire
+	bool armed;       ///< Entry is in a wheel slot
+};
+
+/// Hierarchical timer wheel
+struct rb_timer_wheel {
+	// Private data - Do not use directly
+	uint64_t current; ///< Next tick to process
+	LIST_HEAD(rb_timer_wheel_list, rb_timer_wheel_entry)
+	slots[RB_TIMER_WHEEL_LEVELS][RB_TIMER_WHEEL_SLOTS];
+};
+
+/** Initialize a timer wheel
+  @param tw Timer wheel
+  @param now Current tick
+  */
+void rb_timer_wheel_init(struct rb_timer_wheel *tw, uint64_t now);
+
+/** Add an entry to the timer wheel.
+  @param tw Timer wheel
+  @param entry Entry to add. It must not be armed.
+  @param expires Tick the entry will expire. If it is in the past, entry will
+  expire in the next advance.
+  */
+void rb_timer_wheel_add(struct rb_timer_wheel *tw,
+			struct rb_timer_wheel_entry *entry,
+			uint64_t expires);
+
+/** Remove an entry from the timer wheel, if it was armed
+  @param entry Entry to remove
+  */
+void rb_timer_wheel_del(struct rb_timer_wheel_entry *entry);
+
+/** Expiration tick of an entry
+  @param entry Entry
+  @return Tick the entry will (or did) expire
+  */
+static uint64_t
+rb_timer_wheel_entry_expires(const struct rb_timer_wheel_entry *entry)
+		__attribute__((unused));
+static uint64_t
+rb_timer_wheel_entry_expires(const struct rb_timer_wheel_entry *entry) {
+	return entry->expires;
+}
+
+/** Check if an entry is waiting to expire
+  @param entry Entry
+  @return true if entry is in a wheel slot
+  */
+static bool rb_timer_wheel_entry_armed(const struct rb_timer_wheel_entry *entry)
+		__attribute__((unused));
+static bool
+rb_timer_wheel_entry_armed(const struct rb_timer_wheel_entry *entry) {
+	return entry->armed;
+}
+
+/** Advance timer wheel up to now tick (inclusive), calling cb for every
+  expired entry. Callback is allowed to add the entry again.
+  @param tw Timer wheel
+  @param now Current tick
+  @param cb Callback to call with expired entries
+  @param opaque Opaque passed to callback
+  @return Number of expired entries
+  */
+size_t rb_timer_wheel_advance(struct rb_timer_wheel *tw,
+			      uint64_t now,
+			      void (*cb)(struct rb_timer_wheel_entry *entry,
+					 void *opaque),
+			      void *opaque);
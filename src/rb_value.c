@@ -21,14 +21,18 @@
 
 #include "rb_value.h"
 
+#include "rb_dtoa.h"
 #include "rb_sensor.h"
 #include "rb_sensor_monitor.h"
+#include "rb_split_op.h"
 
 #include <json-c/printbuf.h>
 #include <librd/rdlog.h>
 #include <librd/rdmem.h>
 
 #include <ctype.h>
+#include <float.h>
+#include <math.h>
 
 double monitor_value_double(const struct monitor_value *mv) {
 	switch (mv->type) {
@@ -71,6 +75,16 @@ monitor_value *new_monitor_value_double(double dbl) {
 	return new_monitor_value0(MONITOR_VALUE_T__DOUBLE, value_d, dbl);
 }
 
+monitor_value *new_monitor_value_counter(uint64_t counter, unsigned bits) {
+	monitor_value *ret = new_monitor_value_double((double)counter);
+	if (alloc_likely(NULL != ret)) {
+		ret->value.counter_bits = bits;
+		ret->value.counter = counter;
+	}
+
+	return ret;
+}
+
 monitor_value *new_monitor_value_strn(char *str, size_t str_len) {
 	// Check if we can transform string to a double
 	char *endptr;
@@ -130,64 +144,188 @@ monitor_value *new_monitor_value_fstream(FILE *stream) {
 	return new_monitor_value_strn(sread.buf, (size_t)bytes_read);
 }
 
-/** Count the number of elements of a vector response
-  @param haystack String of values
-  @param splittok Token that sepparate values
-  @return Number of elements
+/// Exact powers of ten in a double
+static const double vector_pow10[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+		1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/** Parse a plain decimal number ([+-]digits[.digits][e[+-]digits]) if it can
+  be done exactly with one double operation (Clinger's fast path): mantissa
+  fits in 53 bits and power of ten is exact.
+  @param str Number string
+  @param end End of number string
+  @param value Parsed value
+  @return true if parsed, false if number needs a full parser
   */
-static size_t vector_elements(const char *haystack, const char *splittok) {
-	size_t ret = 1;
-	for (ret = 1; (haystack = strstr(haystack, splittok));
-	     haystack += strlen(splittok), ++ret) {
-		;
+static bool
+vector_element_parse_fast(const char *str, const char *end, double *value) {
+	const bool negative = str < end && '-' == *str;
+	if (str < end && ('-' == *str || '+' == *str)) {
+		str++;
 	}
-	return ret;
-}
 
-/** strtod conversion plus set errno=EINVAL if no conversion is possible
-  @param str input string
-  @return double
-  */
-static double toDouble(const char *str) {
-	char *endPtr;
-	errno = 0;
-	double d = strtod(str, &endPtr);
-	return d;
+	// Significant digits. If there are more than 19, mantissa overflows.
+	int digits = 0, exponent = 0;
+	bool has_digits = false;
+	uint64_t mantissa = 0;
+	for (; str < end && isdigit((unsigned char)*str); ++str) {
+		mantissa = mantissa * 10 + (uint64_t)(*str - '0');
+		digits += mantissa > 0;
+		has_digits = true;
+	}
+
+	if (str < end && '.' == *str) {
+		for (str++; str < end && isdigit((unsigned char)*str); ++str) {
+			mantissa = mantissa * 10 + (uint64_t)(*str - '0');
+			digits += mantissa > 0;
+			has_digits = true;
+			exponent--;
+		}
+	}
+
+	if (!has_digits) {
+		return false;
+	}
+
+	if (str < end && ('e' == *str || 'E' == *str)) {
+		const char *exp_str = str + 1;
+		const bool exp_negative = exp_str < end && '-' == *exp_str;
+		if (exp_str < end && ('-' == *exp_str || '+' == *exp_str)) {
+			exp_str++;
+		}
+
+		int exp_value = 0;
+		const char *exp_digits = exp_str;
+		for (; exp_str < end && isdigit((unsigned char)*exp_str) &&
+		       exp_value < 1000;
+		     ++exp_str) {
+			exp_value = exp_value * 10 + (*exp_str - '0');
+		}
+
+		if (exp_str == exp_digits) {
+			return false;
+		}
+		exponent += exp_negative ? -exp_value : exp_value;
+		str = exp_str;
+	}
+
+	if (str != end || digits > 19 || mantissa > (UINT64_C(1) << 53) ||
+	    exponent < -22 || exponent > 22) {
+		return false;
+	}
+
+	double ret = (double)mantissa;
+	if (exponent < 0) {
+		ret /= vector_pow10[-exponent];
+	} else {
+		ret *= vector_pow10[exponent];
+	}
+
+	*value = negative ? -ret : ret;
+	return true;
 }
 
-/** Extract value of a vector
-  @param vector_values String to extract values from
-  @param splittok Split token
-  @return Next token to iterate
+/** Parse a vector element. Element must be a number, maybe surrounded by
+  blanks.
+  @param str Element string. It does not need to be NULL terminated.
+  @param end End of element string
+  @param value Parsed value
+  @return true if element is a number, false in other case
   */
-static bool extract_vector_value(const char *vector_values,
-				 const char *splittok,
-				 double *value) {
+static bool
+vector_element_parse(const char *str, const char *end, double *value) {
+	while (str < end && isspace((unsigned char)*str)) {
+		str++;
+	}
+	while (end > str && isspace((unsigned char)*(end - 1))) {
+		end--;
+	}
 
-	const char *end_token = strstr(vector_values, splittok);
-	if (NULL == end_token) {
-		end_token = vector_values + strlen(vector_values);
+	if (str == end) {
+		return false;
 	}
 
-	*value = toDouble(vector_values);
-	if (errno != 0) {
-		const char *perrbuf = gnu_strerror_r(errno);
-		rdlog(LOG_WARNING,
-		      "Invalid double: %.*s (%s). Not counting.",
-		      (int)(end_token - vector_values),
-		      vector_values,
-		      perrbuf);
+	if (likely(vector_element_parse_fast(str, end, value))) {
+		return true;
+	}
+
+	// Rare numbers (long, hexadecimal, inf...): strtod needs a NULL
+	// terminated copy
+	char buf[64];
+	const size_t len = (size_t)(end - str);
+	char *copy = len < sizeof(buf) ? buf : malloc(len + 1);
+	if (alloc_unlikely(NULL == copy)) {
 		return false;
 	}
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+
+	char *endptr = NULL;
+	*value = strtod(copy, &endptr);
+	const bool ret = endptr == &copy[len];
+	if (copy != buf) {
+		free(copy);
+	}
 
-	return true;
+	return ret;
+}
+
+/** Find the end of a vector element
+  @param str Vector string
+  @param end End of vector string
+  @param split_tok Split token
+  @param split_tok_len Split token length
+  @return Start of next split token, or end if there are no more tokens
+  */
+static const char *vector_element_end(const char *str,
+				      const char *end,
+				      const char *split_tok,
+				      size_t split_tok_len) {
+	// memchr is vectorized by libc, so it skips many bytes per cycle
+	while ((str = memchr(str, split_tok[0], (size_t)(end - str)))) {
+		if ((size_t)(end - str) >= split_tok_len &&
+		    0 == memcmp(str, split_tok, split_tok_len)) {
+			return str;
+		}
+		str++;
+	}
+
+	return end;
+}
+
+/** Place vector columns after the monitor value
+  @param mv Vector
+  @param size Number of elements vector can hold
+  */
+static void monitor_value_vector_columns(struct monitor_value *mv,
+					 size_t size) {
+	mv->array.size = size;
+	mv->array.values = (double *)&mv[1];
+	mv->array.valid = (uint64_t *)&mv->array.values[size];
 }
 
-monitor_value *new_monitor_value_array(size_t children_count,
-				       monitor_value **children,
-				       monitor_value *split_op_result) {
-	monitor_value *ret = calloc(1, sizeof(*ret));
+/** Allocation size of a vector
+  @param size Number of elements vector can hold
+  @return Allocation size, or 0 if it overflows
+  */
+static size_t monitor_value_vector_alloc_size(size_t size) {
+	const size_t words = monitor_value_vector_valid_words(size);
+	if (size > (SIZE_MAX - sizeof(monitor_value)) /
+				   (sizeof(double) + sizeof(uint64_t))) {
+		return 0;
+	}
+
+	return sizeof(monitor_value) + size * sizeof(double) +
+	       words * sizeof(uint64_t);
+}
+
+struct monitor_value *new_monitor_value_vector(size_t count) {
+	const size_t alloc_size = monitor_value_vector_alloc_size(count);
+	monitor_value *ret = alloc_size ? calloc(1, alloc_size) : NULL;
 	if (alloc_unlikely(!ret)) {
+		rdlog(LOG_ERR, "Couldn't allocate vector (OOM?)");
 		return NULL;
 	}
 #ifdef MONITOR_VALUE_MAGIC
@@ -195,91 +333,160 @@ monitor_value *new_monitor_value_array(size_t children_count,
 #endif
 
 	ret->type = MONITOR_VALUE_T__ARRAY;
-	ret->array.children_count = children_count;
-	ret->array.split_op_result = split_op_result;
-	ret->array.children = children;
+	ret->array.count = count;
+	monitor_value_vector_columns(ret, count);
 
 	return ret;
 }
 
-bool new_monitor_value_array_from_string(monitor_value *mv,
-					 const char *split_tok,
-					 const char *split_op) {
-	struct {
-		char *buf;
-		size_t size;
-	} src_str = {
-			.buf = mv->value.value_s.buf,
-			.size = mv->value.value_s.size,
-	};
+struct monitor_value *monitor_value_vector_resize(struct monitor_value *mv,
+						  size_t count) {
+	const size_t old_size = mv->array.size;
+	const size_t old_words = monitor_value_vector_valid_words(old_size);
 
-	if (unlikely(MONITOR_VALUE_T__STRING != mv->type)) {
-		rdlog(LOG_ERR,
-		      "Trying to process not-string result as a vector");
+	if (count <= old_size) {
+		// Forget values of removed elements
+		for (size_t i = count; i < mv->array.count; ++i) {
+			monitor_value_vector_unset(mv, i);
+		}
+		mv->array.count = count;
+		return mv;
+	}
+
+	const size_t alloc_size = monitor_value_vector_alloc_size(count);
+	monitor_value *ret = alloc_size ? realloc(mv, alloc_size) : NULL;
+	if (alloc_unlikely(!ret)) {
+		rdlog(LOG_ERR, "Couldn't resize vector (OOM?)");
 		return NULL;
 	}
 
-	memset(mv, 0, sizeof(*mv));
-#ifdef MONITOR_VALUE_MAGIC
-	mv->magic = MONITOR_VALUE_MAGIC;
-#endif
+	uint64_t *old_valid = (uint64_t *)&((double *)&ret[1])[old_size];
+	monitor_value_vector_columns(ret, count);
+	memmove(ret->array.valid, old_valid, old_words * sizeof(old_valid[0]));
+	memset(&ret->array.valid[old_words],
+	       0,
+	       (monitor_value_vector_valid_words(count) - old_words) *
+			       sizeof(old_valid[0]));
+	memset(&ret->array.values[old_size],
+	       0,
+	       (count - old_size) * sizeof(ret->array.values[0]));
+
+	if (ret->array.counters) {
+		uint64_t *counters = realloc(ret->array.counters,
+					     count * sizeof(counters[0]));
+		if (alloc_unlikely(NULL == counters)) {
+			// Keep values, but they are not counters anymore
+			free(ret->array.counters);
+			ret->array.counters = NULL;
+			ret->array.plain = true;
+		} else {
+			ret->array.counters = counters;
+		}
+	}
+
+	ret->array.count = count;
+	return ret;
+}
+
+/** Vector elements are not all counters anymore
+  @param mv Vector
+  */
+static void monitor_value_vector_plain(struct monitor_value *mv) {
+	free(mv->array.counters);
+	mv->array.counters = NULL;
+	mv->array.plain = true;
+}
 
-	mv->type = MONITOR_VALUE_T__ARRAY;
+void monitor_value_vector_set(struct monitor_value *mv,
+			      size_t i,
+			      double value) {
+	mv->array.values[i] = value;
+	mv->array.valid[i / 64] |= UINT64_C(1) << (i % 64);
+	if (!mv->array.plain) {
+		monitor_value_vector_plain(mv);
+	}
+}
 
-	mv->array.children_count = vector_elements(src_str.buf, split_tok);
-	const char *tok = NULL;
+void monitor_value_vector_set_counter(struct monitor_value *mv,
+				      size_t i,
+				      uint64_t counter,
+				      unsigned bits) {
+	mv->array.values[i] = (double)counter;
+	mv->array.valid[i / 64] |= UINT64_C(1) << (i % 64);
+	if (mv->array.plain) {
+		return;
+	}
 
-	mv->array.children = calloc(mv->array.children_count,
-				    sizeof(mv->array.children[0]));
-	if (alloc_unlikely(NULL == mv->array.children)) {
+	if (NULL == mv->array.counters) {
+		mv->array.counters = calloc(mv->array.size,
+					    sizeof(mv->array.counters[0]));
+		mv->array.counter_bits = bits;
+	}
+
+	if (alloc_unlikely(NULL == mv->array.counters) ||
+	    bits != mv->array.counter_bits) {
+		monitor_value_vector_plain(mv);
+		return;
+	}
+
+	mv->array.counters[i] = counter;
+}
+
+struct monitor_value *
+new_monitor_value_vector_from_string(const struct monitor_value *mv,
+				     const char *split_tok) {
+	if (unlikely(MONITOR_VALUE_T__STRING != mv->type)) {
 		rdlog(LOG_ERR,
-		      "Couldn't allocate vector children (out of memory?)");
+		      "Trying to process not-string result as a vector");
 		return NULL;
 	}
 
-	size_t mean_count = 0, count = 0;
-	double sum = 0;
-	for (count = 0, tok = src_str.buf; tok;
-	     tok = strstr(tok, split_tok), count++) {
-		if (count > 0) {
-			// Skip delimiter
-			tok += strlen(split_tok);
-		}
+	const size_t split_tok_len = strlen(split_tok);
+	if (unlikely(0 == split_tok_len)) {
+		rdlog(LOG_ERR, "Empty split token");
+		return NULL;
+	}
 
-		double i_value = 0;
+	const char *str = mv->value.value_s.buf;
+	const char *end = str + mv->value.value_s.size;
+	monitor_value *ret = new_monitor_value_vector(0);
+	if (alloc_unlikely(NULL == ret)) {
+		return NULL;
+	}
 
-		if (0 == strcmp(tok, split_tok)) {
-			// Empty token
-			rdlog(LOG_DEBUG, "Not seeing value %zu", count);
-			continue;
+	// Only one pass over the string: vector grows as we find elements
+	for (size_t count = 0;; ++count) {
+		const char *element_end = vector_element_end(
+				str, end, split_tok, split_tok_len);
+		double value = 0;
+
+		if (count == ret->array.size) {
+			monitor_value *grown = monitor_value_vector_resize(
+					ret, count ? 2 * count : 16);
+			if (alloc_unlikely(NULL == grown)) {
+				rb_monitor_value_done(ret);
+				return NULL;
+			}
+			ret = grown;
 		}
 
-		const bool get_value_rc =
-				extract_vector_value(tok, split_tok, &i_value);
-
-		if (false == get_value_rc) {
-			continue;
+		if (vector_element_parse(str, element_end, &value)) {
+			monitor_value_vector_set(ret, count, value);
+		} else if (str == element_end) {
+			rdlog(LOG_DEBUG, "Not seeing value %zu", count);
+		} else {
+			rdlog(LOG_WARNING,
+			      "Invalid double: %.*s. Not counting.",
+			      (int)(element_end - str),
+			      str);
 		}
 
-		mv->array.children[count] = new_monitor_value(i_value);
-		if (alloc_unlikely(!mv->array.children[count])) {
-			continue;
+		if (element_end == end) {
+			return monitor_value_vector_resize(ret, count + 1);
 		}
 
-		sum += i_value;
-		mean_count++;
+		str = element_end + split_tok_len;
 	}
-
-	// Last token reached. Do we have an operation to do?
-	if (NULL != split_op && mean_count > 0) {
-		const double result = (0 == strcmp("sum", split_op))
-						      ? sum
-						      : sum / mean_count;
-
-		mv->array.split_op_result = new_monitor_value(result);
-	}
-
-	return true;
 }
 
 static void print_monitor_value_enrichment_str(struct printbuf *buf,
@@ -366,52 +573,246 @@ print_monitor_value_enrichment(struct printbuf *buf,
 	}
 }
 
-#define NO_INSTANCE (-1)
-static void print_monitor_value0(rb_message *message,
-				 const struct monitor_value *t_monitor_value,
-				 const rb_monitor_t *monitor,
-				 int instance) {
+/// Kafka message key template
+static const char *monitor_value_key_template = NULL;
+
+void monitor_value_set_key_template(const char *key_template) {
+	monitor_value_key_template = key_template;
+}
+
+/** Print the kafka message key of a monitor
+  @param buf Buffer to print in
+  @param name Monitor name
+  @param const_enrichment Monitor enrichment. Can be NULL.
+  */
+static void print_monitor_value_key(struct printbuf *buf,
+				    const char *name,
+				    const json_object *const_enrichment) {
+	json_object *enrichment = (json_object *)const_enrichment;
+	const char *cursor = monitor_value_key_template;
+
+	while (cursor && *cursor) {
+		const char *field = strchr(cursor, '{');
+		const char *field_end = field ? strchr(field, '}') : NULL;
+		if (NULL == field_end) {
+			// No more fields
+			sprintbuf(buf, "%s", cursor);
+			break;
+		}
+
+		sprintbuf(buf, "%.*s", (int)(field - cursor), cursor);
+		cursor = field_end + 1;
+
+		char *field_name = strndup(field + 1,
+					   (size_t)(field_end - field - 1));
+		if (alloc_unlikely(NULL == field_name)) {
+			rdlog(LOG_ERR, "Couldn't allocate key field (OOM?)");
+			continue;
+		}
+
+		json_object *val = NULL;
+		if (0 == strcmp(field_name, "monitor")) {
+			sprintbuf(buf, "%s", name);
+		} else if (enrichment &&
+			   json_object_object_get_ex(
+					   enrichment, field_name, &val)) {
+			sprintbuf(buf, "%s", json_object_get_string(val));
+		}
+
+		free(field_name);
+	}
+}
+
+bool monitor_value_template_init(struct monitor_value_template *tmpl,
+				 const char *name,
+				 const char *name_split_suffix,
+				 const char *instance_prefix,
+				 const json_object *enrichment) {
 	struct printbuf *buf = printbuf_new();
 	if (alloc_unlikely((!buf))) {
 		rdlog(LOG_ERR, "Couldn't allocate print buffer (OOM?)");
-		return;
+		return false;
 	}
 
-	const char *monitor_instance_prefix =
-			rb_monitor_instance_prefix(monitor);
-	const char *monitor_name_split_suffix =
-			rb_monitor_name_split_suffix(monitor);
-	const struct json_object *monitor_enrichment =
-			rb_monitor_enrichment(monitor);
-	// @TODO use printbuf_memappend_fast instead!
-	sprintbuf(buf, "{");
-	sprintbuf(buf, "\"timestamp\":%tu", time(NULL));
-	if (NO_INSTANCE != instance && monitor_name_split_suffix) {
+	// Parts are rendered one after another, so part i ends where part
+	// i+1 starts
+	struct monitor_value_template_part *parts[] = {
+			&tmpl->monitor,
+			&tmpl->monitor_split,
+			&tmpl->instance,
+			&tmpl->tail,
+			&tmpl->key,
+	};
+	int ends[RD_ARRAYSIZE(parts)];
+
+	sprintbuf(buf, ",\"monitor\":\"%s\"", name);
+	ends[0] = buf->bpos;
+	if (name_split_suffix) {
 		sprintbuf(buf,
 			  ",\"monitor\":\"%s%s\"",
-			  rb_monitor_name(monitor),
-			  monitor_name_split_suffix);
-	} else {
-		sprintbuf(buf, ",\"monitor\":\"%s\"", rb_monitor_name(monitor));
+			  name,
+			  name_split_suffix);
+	}
+	ends[1] = buf->bpos;
+	if (instance_prefix) {
+		sprintbuf(buf, ",\"instance\":\"%s", instance_prefix);
+	}
+	ends[2] = buf->bpos;
+	if (enrichment) {
+		print_monitor_value_enrichment(buf, enrichment);
 	}
+	sprintbuf(buf, "}");
+	ends[3] = buf->bpos;
+	print_monitor_value_key(buf, name, enrichment);
+	ends[4] = buf->bpos;
 
-	if (NO_INSTANCE != instance && monitor_instance_prefix) {
-		sprintbuf(buf,
-			  ",\"instance\":\"%s%d\"",
-			  monitor_instance_prefix,
-			  instance);
+	tmpl->buf = buf->buf;
+	buf->buf = NULL;
+	printbuf_free(buf);
+
+	for (size_t i = 0; i < RD_ARRAYSIZE(parts); ++i) {
+		const int start = i ? ends[i - 1] : 0;
+		parts[i]->buf = &tmpl->buf[start];
+		parts[i]->len = (size_t)(ends[i] - start);
 	}
 
-	sprintbuf(buf, ",\"value\":");
+	return true;
+}
+
+void monitor_value_template_done(struct monitor_value_template *tmpl) {
+	free(tmpl->buf);
+}
+
+/** Print a double monitor value
+  @param buf Buffer, big enough for "%lf" output of any double
+  @param value Value to print
+  @param monitor Value monitor
+  @return Printed length, or 0 if value can't be printed as a JSON number
+  */
+static size_t print_monitor_value_double(char *buf,
+					 double value,
+					 const rb_monitor_t *monitor) {
+	if (!rb_monitor_json_number(monitor)) {
+		// Backwards compatible format
+		return (size_t)sprintf(buf, "%lf", value);
+	}
+
+	if (rb_monitor_is_integer(monitor) && isfinite(value) &&
+	    fabs(value) < 9223372036854775807.0) {
+		return rb_itoa(llround(value), buf);
+	}
+
+	return rb_dtoa(value, buf);
+}
+
+void monitor_timestamp_now(struct monitor_timestamp *ts,
+			   enum monitor_timestamp_precision precision) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	ts->len = rb_utoa((uint64_t)now.tv_sec, ts->buf);
+
+	unsigned digits = 0;
+	uint64_t fraction = 0;
+	switch (precision) {
+	case MONITOR_TIMESTAMP_MS:
+		digits = 3;
+		fraction = (uint64_t)now.tv_nsec / 1000000;
+		break;
+	case MONITOR_TIMESTAMP_US:
+		digits = 6;
+		fraction = (uint64_t)now.tv_nsec / 1000;
+		break;
+	case MONITOR_TIMESTAMP_S:
+	default:
+		return;
+	};
+
+	// Fraction with leading zeros
+	ts->buf[ts->len] = '.';
+	for (unsigned i = digits; i > 0; --i) {
+		ts->buf[ts->len + i] = (char)('0' + fraction % 10);
+		fraction /= 10;
+	}
+	ts->len += 1 + digits;
+}
+
+/** Append bytes to a message being printed
+  @param cursor Message position to append
+  @param buf Bytes to append
+  @param len Length of bytes
+  @return Message position after appended bytes
+  */
+static char *print_append(char *cursor, const void *buf, size_t len) {
+	memcpy(cursor, buf, len);
+	return cursor + len;
+}
+
+/// Append a string literal to a message being printed
+#define print_append_literal(cursor, literal)                                  \
+	print_append(cursor, literal, sizeof(literal) - 1)
+
+/// Append a template part to a message being printed
+#define print_append_part(cursor, part)                                        \
+	print_append(cursor, (part)->buf, (part)->len)
+
+#define NO_INSTANCE (-1)
+/** Print a monitor value in a message. Message is the monitor template plus
+  the timestamp, value and instance, so it only needs one allocation. Kafka
+  message key is stored in the same allocation, after the payload.
+  @param message Message to print in
+  @param t_monitor_value Value to print
+  @param monitor Value monitor
+  @param ts Message timestamp
+  @param instance Vector instance, or NO_INSTANCE
+  @param split_op Split op name that produced the value, if it has to be tagged
+  */
+static void print_monitor_value0(rb_message *message,
+				 const struct monitor_value *t_monitor_value,
+				 const rb_monitor_t *monitor,
+				 const struct monitor_timestamp *ts,
+				 int instance,
+				 const char *split_op) {
+	const struct monitor_value_template *tmpl =
+			rb_monitor_template(monitor);
+	const bool vector_element = NO_INSTANCE != instance;
+	const struct monitor_value_template_part *monitor_part =
+			vector_element && tmpl->monitor_split.len
+					? &tmpl->monitor_split
+					: &tmpl->monitor;
+	const bool print_instance = vector_element && tmpl->instance.len;
+	const size_t split_op_len = split_op ? strlen(split_op) : 0;
+
+	char instance_str[sizeof("-2147483648")];
+	const int instance_len =
+			print_instance ? snprintf(instance_str,
+						  sizeof(instance_str),
+						  "%d",
+						  instance)
+				       : 0;
+
+	// Biggest %lf output is DBL_MAX: 309 integer digits and 6 decimals
+	char value_d[sizeof("-.000000") + DBL_MAX_10_EXP + 1];
+	const char *value = NULL;
+	size_t value_len = 0;
+	bool quoted = true;
 	switch (t_monitor_value->type) {
 	case MONITOR_VALUE_T__DOUBLE:
-		sprintbuf(buf, "\"%lf\"", t_monitor_value->value.value_d);
+		value = value_d;
+		value_len = print_monitor_value_double(
+				value_d,
+				t_monitor_value->value.value_d,
+				monitor);
+		quoted = !rb_monitor_json_number(monitor);
+		if (0 == value_len) {
+			// Not finite, and JSON numbers can't say that
+			value = "null";
+			value_len = strlen(value);
+		}
 		break;
 	case MONITOR_VALUE_T__STRING:
-		sprintbuf(buf,
-			  "\"%.*s\"",
-			  t_monitor_value->value.value_s.size,
-			  t_monitor_value->value.value_s.buf);
+		value = t_monitor_value->value.value_s.buf;
+		value_len = t_monitor_value->value.value_s.size;
 		break;
 	case MONITOR_VALUE_T__BAD:
 	case MONITOR_VALUE_T__ARRAY:
@@ -419,27 +820,121 @@ static void print_monitor_value0(rb_message *message,
 		break;
 	};
 
-	if (monitor_enrichment) {
-		print_monitor_value_enrichment(buf, monitor_enrichment);
+	// clang-format off
+	const size_t len = strlen("{\"timestamp\":") + ts->len +
+		monitor_part->len +
+		(split_op ? strlen(",\"split_op\":\"\"") + split_op_len : 0) +
+		(print_instance ? tmpl->instance.len + (size_t)instance_len +
+				  strlen("\"") : 0) +
+		strlen(",\"value\":") +
+		(value ? value_len + (quoted ? strlen("\"\"") : 0) : 0) +
+		tmpl->tail.len;
+	// clang-format on
+
+	// NULL terminated, so it can be logged as a string
+	char *payload = malloc(len + 1 + tmpl->key.len);
+	if (alloc_unlikely(NULL == payload)) {
+		rdlog(LOG_ERR, "Couldn't allocate message (OOM?)");
+		return;
 	}
-	sprintbuf(buf, "}");
 
-	message->payload = buf->buf;
-	message->len = (size_t)buf->bpos;
+	char *cursor = print_append_literal(payload, "{\"timestamp\":");
+	cursor = print_append(cursor, ts->buf, ts->len);
+	cursor = print_append_part(cursor, monitor_part);
+	if (split_op) {
+		cursor = print_append_literal(cursor, ",\"split_op\":\"");
+		cursor = print_append(cursor, split_op, split_op_len);
+		cursor = print_append_literal(cursor, "\"");
+	}
+	if (print_instance) {
+		cursor = print_append_part(cursor, &tmpl->instance);
+		cursor = print_append(
+				cursor, instance_str, (size_t)instance_len);
+		cursor = print_append_literal(cursor, "\"");
+	}
+	cursor = print_append_literal(cursor, ",\"value\":");
+	if (value && quoted) {
+		cursor = print_append_literal(cursor, "\"");
+		cursor = print_append(cursor, value, value_len);
+		cursor = print_append_literal(cursor, "\"");
+	} else if (value) {
+		cursor = print_append(cursor, value, value_len);
+	}
+	cursor = print_append_part(cursor, &tmpl->tail);
+	*cursor = '\0';
+	assert((size_t)(cursor - payload) == len);
+
+	message->payload = payload;
+	message->len = len;
+	if (tmpl->key.len) {
+		// librdkafka copies the key, so it only needs to live until the
+		// message is produced
+		print_append_part(cursor + 1, &tmpl->key);
+		message->key = cursor + 1;
+		message->key_len = tmpl->key.len;
+	}
+}
 
-	buf->buf = NULL;
-	printbuf_free(buf);
+/** Print a vector element in a message
+  @param message Message to print in
+  @param value Element value
+  @param monitor Value monitor
+  @param ts Message timestamp
+  @param instance Vector instance, or NO_INSTANCE
+  @param split_op Split op name that produced the value, if it has to be tagged
+  */
+static void print_monitor_vector_value0(rb_message *message,
+					double value,
+					const rb_monitor_t *monitor,
+					const struct monitor_timestamp *ts,
+					int instance,
+					const char *split_op) {
+	const struct monitor_value element = {
+#ifdef MONITOR_VALUE_MAGIC
+			.magic = MONITOR_VALUE_MAGIC,
+#endif
+			.type = MONITOR_VALUE_T__DOUBLE,
+			.value.value_d = value,
+	};
+
+	print_monitor_value0(
+			message, &element, monitor, ts, instance, split_op);
+}
+
+/** Number of elements of a vector that have a value
+  @param mv Vector
+  @return Number of valid elements
+  */
+static size_t monitor_value_vector_valid_count(const struct monitor_value *mv) {
+	const size_t words = monitor_value_vector_valid_words(mv->array.count);
+	size_t ret = 0;
+	for (size_t w = 0; w < words; ++w) {
+		ret += (size_t)__builtin_popcountll(mv->array.valid[w]);
+	}
+	return ret;
 }
 
 rb_message_array_t *
 print_monitor_value(const struct monitor_value *t_monitor_value,
-		    const rb_monitor_t *monitor) {
-	// clang-format off
-	const size_t ret_size = (t_monitor_value->type == MONITOR_VALUE_T__ARRAY)
-		? t_monitor_value->array.children_count +
-		  (t_monitor_value->array.split_op_result ? 1 : 0)
-		: 1;
-	// clang-format on
+		    const rb_monitor_t *monitor,
+		    const struct monitor_timestamp *ts) {
+	const struct monitor_value *split_op_result =
+			(t_monitor_value->type == MONITOR_VALUE_T__ARRAY)
+					? t_monitor_value->array.split_op_result
+					: NULL;
+	// Named split ops results are a vector, one element per split op
+	const size_t split_op_results_count =
+			(NULL == split_op_result) ? 0
+			: (split_op_result->type == MONITOR_VALUE_T__ARRAY)
+					? split_op_result->array.count
+					: 1;
+
+	const size_t ret_size =
+			(t_monitor_value->type == MONITOR_VALUE_T__ARRAY)
+					? monitor_value_vector_valid_count(
+							  t_monitor_value) +
+							  split_op_results_count
+					: 1;
 
 	rb_message_array_t *ret = new_messages_array(ret_size);
 	if (ret == NULL) {
@@ -450,26 +945,44 @@ print_monitor_value(const struct monitor_value *t_monitor_value,
 	if (t_monitor_value->type == MONITOR_VALUE_T__ARRAY) {
 		size_t i_msgs = 0;
 		assert(t_monitor_value->type == MONITOR_VALUE_T__ARRAY);
-		for (size_t i = 0; i < t_monitor_value->array.children_count;
-		     ++i) {
-			if (t_monitor_value->array.children[i]) {
-				print_monitor_value0(
+		for (size_t i = 0; i < t_monitor_value->array.count; ++i) {
+			if (monitor_value_vector_valid(t_monitor_value, i)) {
+				print_monitor_vector_value0(
 						&ret->msgs[i_msgs++],
 						t_monitor_value->array
-								.children[i],
+								.values[i],
 						monitor,
-						i);
+						ts,
+						(int)i,
+						NULL);
 			}
 		}
 
-		if (t_monitor_value->array.split_op_result) {
+		if (split_op_result &&
+		    split_op_result->type == MONITOR_VALUE_T__ARRAY) {
+			const struct rb_split_ops *split_ops =
+					rb_monitor_split_ops(monitor);
+			for (size_t i = 0; i < split_op_results_count; ++i) {
+				rb_message *msg = &ret->msgs[i_msgs++];
+				assert(NULL == msg->payload);
+				print_monitor_vector_value0(
+						msg,
+						split_op_result->array
+								.values[i],
+						monitor,
+						ts,
+						NO_INSTANCE,
+						split_ops->ops[i].name);
+			}
+		} else if (split_op_result) {
 			rb_message *msg = &ret->msgs[i_msgs++];
 			assert(NULL == msg->payload);
-			print_monitor_value0(
-					msg,
-					t_monitor_value->array.split_op_result,
-					monitor,
-					NO_INSTANCE);
+			print_monitor_value0(msg,
+					     split_op_result,
+					     monitor,
+					     ts,
+					     NO_INSTANCE,
+					     NULL);
 		}
 
 		ret->count = i_msgs;
@@ -477,7 +990,9 @@ print_monitor_value(const struct monitor_value *t_monitor_value,
 		print_monitor_value0(&ret->msgs[0],
 				     t_monitor_value,
 				     monitor,
-				     NO_INSTANCE);
+				     ts,
+				     NO_INSTANCE,
+				     NULL);
 	}
 
 	return ret;
@@ -493,13 +1008,16 @@ static size_t pos_array_length(const ssize_t *pos) {
 }
 
 rb_monitor_value_array_t *
-rb_monitor_value_array_select(rb_monitor_value_array_t *array, ssize_t *pos) {
+rb_monitor_value_array_select(struct rb_arena *arena,
+			      rb_monitor_value_array_t *array,
+			      ssize_t *pos) {
 	if (NULL == pos || NULL == array) {
 		return NULL;
 	}
 
 	const size_t ret_size = pos_array_length(pos);
-	rb_monitor_value_array_t *ret = rb_monitor_value_array_new(ret_size);
+	rb_monitor_value_array_t *ret =
+			rb_monitor_value_array_arena_new(arena, ret_size);
 	if (NULL == ret) {
 		rdlog(LOG_ERR, "Couldn't allocate select return (OOM?)");
 		return NULL;
@@ -517,15 +1035,12 @@ rb_monitor_value_array_select(rb_monitor_value_array_t *array, ssize_t *pos) {
 
 void rb_monitor_value_done(struct monitor_value *mv) {
 	if (MONITOR_VALUE_T__ARRAY == mv->type) {
-		for (size_t i = 0; i < mv->array.children_count; ++i) {
-			if (mv->array.children[i]) {
-				rb_monitor_value_done(mv->array.children[i]);
-			}
-		}
 		if (mv->array.split_op_result) {
 			rb_monitor_value_done(mv->array.split_op_result);
 		}
-		free(mv->array.children);
+		free(mv->array.counters);
+	} else if (MONITOR_VALUE_T__STRING == mv->type) {
+		free(mv->value.value_s.buf);
 	}
 	free(mv);
 }
@@ -29,6 +29,7 @@
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct monitor_value {
 #ifndef NDEBUG
@@ -41,7 +42,7 @@ typedef struct monitor_value {
 		MONITOR_VALUE_T__BAD, ///< This is a bad array value
 		MONITOR_VALUE_T__DOUBLE,
 		MONITOR_VALUE_T__STRING,
-		MONITOR_VALUE_T__ARRAY, ///< This is an array of monitors values
+		MONITOR_VALUE_T__ARRAY, ///< This is a vector of numbers
 	} type;
 
 	// Private data - Do not use directly
@@ -56,11 +57,29 @@ typedef struct monitor_value {
 					char *buf;
 				} value_s;
 			};
+			/// If the value is a SNMP counter, its width (32 or
+			/// 64 bits, TimeTicks are 64). 0 in other case.
+			unsigned counter_bits;
+			uint64_t counter; ///< Counter exact value
 		} value;
+		/// Vector of numbers, stored in columns. Values and validity
+		/// bitmap are in the same allocation than the monitor value.
 		struct {
-			size_t children_count;
+			size_t count;	 ///< Number of elements
+			size_t size;	 ///< Elements vector can hold
+			double *values;  ///< Elements values
+			/// Bitmap of elements that have a value
+			uint64_t *valid;
+			/// Exact values of SNMP counters elements, or NULL if
+			/// vector elements are not counters
+			uint64_t *counters;
+			unsigned counter_bits; ///< Counters width
+			bool plain; ///< Some element is not a counter
+			/// Hash of the OID indexes of SNMP walk rows, to
+			/// know if rows are the same than in previous walks.
+			/// 0 if elements are not walk rows.
+			uint64_t index_hash;
 			struct monitor_value *split_op_result;
-			struct monitor_value **children;
 		} array;
 	};
 } monitor_value;
@@ -73,6 +92,14 @@ double monitor_value_double(const struct monitor_value *mv);
 monitor_value *new_monitor_value_int(long i);
 monitor_value *new_monitor_value_double(double dbl);
 
+/** Creates a new monitor value from a SNMP counter
+  @param counter Counter value
+  @param bits Counter width: 32 bits counters wrap around, a decrease of a 64
+  bits one is a discontinuity
+  @return New monitor value
+  */
+monitor_value *new_monitor_value_counter(uint64_t counter, unsigned bits);
+
 /// Creates a new monitor value in string format. The string value is borrowed.
 monitor_value *new_monitor_value_strn(char *str, size_t str_len);
 
@@ -86,20 +113,72 @@ monitor_value *new_monitor_value_fstream(FILE *stream);
 			 double: new_monitor_value_double)(t_value);
 // clang-format on
 
-/** Creates a new monitor value array from a string monitor value.
-  @param mv Source and destination monitor value.
+/** Creates a new vector monitor value from a string monitor value.
+  @param mv Source string monitor value. It is not modified.
   @param split_tok Token to split string
-  @param split_op Operation to do over result array ('sum' or 'mean')
+  @return New vector monitor value, or NULL if error
  */
-bool new_monitor_value_array_from_string(struct monitor_value *mv,
-					 const char *split_tok,
-					 const char *split_op);
-
-/** Creates a new monitor value from children and split operation result */
 struct monitor_value *
-new_monitor_value_array(size_t children_count,
-			struct monitor_value **children,
-			struct monitor_value *split_op_result);
+new_monitor_value_vector_from_string(const struct monitor_value *mv,
+				     const char *split_tok);
+
+/** Creates a new vector monitor value. All elements have no value.
+  @param count Number of elements
+  @return New vector monitor value, or NULL if OOM
+  */
+struct monitor_value *new_monitor_value_vector(size_t count);
+
+/** Change the number of elements of a vector. New elements have no value.
+  @param mv Vector. If it is moved, it is freed as realloc does.
+  @param count New number of elements
+  @return Resized vector, or NULL if OOM. In that case, mv is not touched.
+  */
+struct monitor_value *monitor_value_vector_resize(struct monitor_value *mv,
+						  size_t count);
+
+/// Number of 64 bits words of a vector validity bitmap
+#define monitor_value_vector_valid_words(count) (((count) + 63) / 64)
+
+/** Check if a vector element has a value
+  @param mv Vector
+  @param i Element
+  @return true if element has value
+  */
+static bool monitor_value_vector_valid(const struct monitor_value *mv,
+				       size_t i) RD_UNUSED;
+static bool monitor_value_vector_valid(const struct monitor_value *mv,
+				       size_t i) {
+	return mv->array.valid[i / 64] & (UINT64_C(1) << (i % 64));
+}
+
+/** Remove the value of a vector element
+  @param mv Vector
+  @param i Element
+  */
+static void monitor_value_vector_unset(struct monitor_value *mv,
+				       size_t i) RD_UNUSED;
+static void monitor_value_vector_unset(struct monitor_value *mv, size_t i) {
+	mv->array.valid[i / 64] &= ~(UINT64_C(1) << (i % 64));
+}
+
+/** Set the value of a vector element
+  @param mv Vector
+  @param i Element
+  @param value Element value
+  */
+void monitor_value_vector_set(struct monitor_value *mv, size_t i, double value);
+
+/** Set the value of a vector element from a SNMP counter
+  @param mv Vector
+  @param i Element
+  @param counter Counter value
+  @param bits Counter width: 32 bits counters wrap around, a decrease of a 64
+  bits one is a discontinuity
+  */
+void monitor_value_vector_set_counter(struct monitor_value *mv,
+				      size_t i,
+				      uint64_t counter,
+				      unsigned bits);
 
 /// Casts a void pointer to an rb_monitor_value one.
 #define rb_monitor_value_cast(t_mv)                                            \
@@ -121,6 +200,10 @@ typedef struct rb_array rb_monitor_value_array_t;
 /** Create a new array with count capacity */
 #define rb_monitor_value_array_new(sz) rb_array_new(sz)
 
+/** Create a new array with count capacity in an arena */
+#define rb_monitor_value_array_arena_new(arena, sz)                            \
+	rb_array_arena_new(arena, sz)
+
 /** Destroy a sensors array */
 #define rb_monitor_value_array_done(array) rb_array_done(array)
 
@@ -137,14 +220,16 @@ static void rb_monitor_value_array_add(rb_monitor_value_array_t *array,
 }
 
 /** Select individual positions of original array
+  @param arena Allocator of the returned array
   @param array Original array
   @param pos list of positions (-1 terminated)
-  @return New monitor array, that needs to be free with
-	  rb_monitor_value_array_done
+  @return New monitor array, valid until arena reset
   @note Monitors are from original array, so they should not be touched
   */
 rb_monitor_value_array_t *
-rb_monitor_value_array_select(rb_monitor_value_array_t *array, ssize_t *pos);
+rb_monitor_value_array_select(struct rb_arena *arena,
+			      rb_monitor_value_array_t *array,
+			      ssize_t *pos);
 
 /** Return monitor value of an array
   @param array Array
@@ -163,11 +248,86 @@ rb_monitor_value_array_at(rb_monitor_value_array_t *array, size_t i) {
 struct rb_monitor_s;
 struct rb_sensor_s;
 
+/// Piece of JSON message
+struct monitor_value_template_part {
+	const char *buf; ///< Piece bytes. Not NULL terminated.
+	size_t len;      ///< Piece length
+};
+
+/// JSON pieces of a monitor messages that never change, rendered only once
+struct monitor_value_template {
+	/// `,"monitor":"<name>"`
+	struct monitor_value_template_part monitor;
+	/// `,"monitor":"<name><name_split_suffix>"`, for vector elements. Empty
+	/// if monitor has no name split suffix.
+	struct monitor_value_template_part monitor_split;
+	/// `,"instance":"<instance_prefix>`, waiting for the instance number.
+	/// Empty if monitor has no instance prefix.
+	struct monitor_value_template_part instance;
+	/// Enrichment keys and closing brace
+	struct monitor_value_template_part tail;
+	/// Kafka message key. Empty if no key template has been set.
+	struct monitor_value_template_part key;
+	char *buf; ///< Memory of all parts
+};
+
+/** Set the kafka message key of every monitor message. The key template is
+  copied verbatim, except for `{field}` sequences, that are replaced by the
+  value of the enrichment field with that name, or by the monitor name if the
+  field is `monitor`. Need to be called before parsing sensors.
+  @param key_template Key template, like "{sensor_name}:{monitor}". NULL means
+  no key. It must be valid while sensors are parsed.
+  */
+void monitor_value_set_key_template(const char *key_template);
+
+/** Render the template of a monitor messages
+  @param tmpl Template
+  @param name Monitor name
+  @param name_split_suffix Monitor name suffix of vector elements. Can be NULL.
+  @param instance_prefix Instance prefix of vector elements. Can be NULL.
+  @param enrichment Enrichment of every message. Can be NULL.
+  @return true if success, false in other case
+  */
+bool monitor_value_template_init(struct monitor_value_template *tmpl,
+				 const char *name,
+				 const char *name_split_suffix,
+				 const char *instance_prefix,
+				 const json_object *enrichment);
+
+/** Release a monitor messages template
+  @param tmpl Template
+  */
+void monitor_value_template_done(struct monitor_value_template *tmpl);
+
+/// Precision of messages timestamp
+enum monitor_timestamp_precision {
+	MONITOR_TIMESTAMP_S,  ///< Seconds
+	MONITOR_TIMESTAMP_MS, ///< Seconds with 3 decimals
+	MONITOR_TIMESTAMP_US, ///< Seconds with 6 decimals
+};
+
+/// Messages timestamp, already printed. All messages of a sensor polling
+/// cycle share the same one.
+struct monitor_timestamp {
+	size_t len; ///< Printed length
+	/// Printed timestamp, not NULL terminated
+	char buf[sizeof("18446744073709551615.000000")];
+};
+
+/** Take current (real) time as messages timestamp
+  @param ts Timestamp
+  @param precision Timestamp precision
+  */
+void monitor_timestamp_now(struct monitor_timestamp *ts,
+			   enum monitor_timestamp_precision precision);
+
 /** Print a sensor value
   @param monitor_value Value to print
   @param monitor Value's monitor
+  @param ts Messages timestamp
   @return Message array with monitor value
   */
 rb_message_array_t *
 print_monitor_value(const struct monitor_value *monitor_value,
-		    const struct rb_monitor_s *monitor);
+		    const struct rb_monitor_s *monitor,
+		    const struct monitor_timestamp *ts);
@@ -303,7 +303,9 @@ static void send_snmp_trap_pdu(trap_handler *this, const netsnmp_pdu *pdu) {
 		goto err;
 	}
 
-	send_array = print_monitor_value(trap_value, monitor);
+	struct monitor_timestamp ts;
+	monitor_timestamp_now(&ts, MONITOR_TIMESTAMP_S);
+	send_array = print_monitor_value(trap_value, monitor, &ts);
 	if (alloc_unlikely(NULL == send_array)) {
 		rdlog(LOG_ERR, "Couldn't create send array (OOM?)");
 		goto err;
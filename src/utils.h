@@ -19,7 +19,9 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 /// [Un]likely failure of a malloc. It can be used to not compile some unused
 /// branch if system have memory overcommit.
@@ -41,3 +43,53 @@ static __attribute__((unused)) const char *gnu_strerror_r(int t_errno) {
 	return strerror_r(t_errno, buffer, sizeof(buffer));
 #endif
 }
+
+/// FNV-1a hash of an empty buffer
+#define RB_FNV1A_INIT UINT64_C(0xcbf29ce484222325)
+
+/** Add a buffer to a FNV-1a hash
+    @param hash Hash of previous buffers, or RB_FNV1A_INIT
+    @param buf Buffer
+    @param len Buffer length
+    @return Hash
+    */
+static __attribute__((unused)) uint64_t
+rb_fnv1a(uint64_t hash, const void *buf, size_t len) {
+	const unsigned char *cbuf = buf;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= cbuf[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+
+	return hash;
+}
+
+/** Current time of monotonic clock
+    @return Monotonic time, in milliseconds
+    */
+static __attribute__((unused)) uint64_t rb_monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/** Current time of monotonic clock
+    @return Monotonic time, in microseconds
+    */
+static __attribute__((unused)) uint64_t rb_monotonic_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/** Sleep for a given amount of milliseconds. It can be interrupted by a
+    signal.
+    @param ms Milliseconds to sleep
+    */
+static __attribute__((unused)) void rb_sleep_ms(uint64_t ms) {
+	const struct timespec ts = {
+			.tv_sec = (time_t)(ms / 1000),
+			.tv_nsec = (long)(ms % 1000) * 1000000,
+	};
+	nanosleep(&ts, NULL);
+}
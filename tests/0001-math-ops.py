@@ -42,7 +42,7 @@ class TestBasic(TestMonitor):
                                                eval_globals,
                                                eval_locals),
             } for operation in chain(
-                # Test all libmatheval supported binary operations
+                # Test all supported binary operations
                 ('var_n0' + operator + 'var_n1' for operator in '+-*/^'),
                 # Test operation on constants
                 iter(['100*var_n1', '-var_n1']),
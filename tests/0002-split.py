@@ -3,6 +3,8 @@
 from mon_test import TestMonitor, main
 from pysnmp.proto.api import v2c
 from itertools import chain, product
+from math import ceil
+from statistics import median, pstdev
 import pytest
 
 
@@ -15,12 +17,31 @@ def name_split_suffix(request):
 def instance_prefix(request):
     return request.param
 
-VALID_SPLIT_OPS = ['sum', 'mean']
+
+
+def percentile(p):
+    ''' Nearest rank percentile '''
+    return lambda x: sorted(x)[max(1, ceil(p * len(x) / 100)) - 1]
+
+SPLIT_OPS_FUNCTIONS = {
+    'sum': sum,
+    'mean': lambda x: float(sum(x))/len(x),
+    'min': min,
+    'max': max,
+    'count': len,
+    'stddev': pstdev,
+    'median': median,
+    'p95': percentile(95),
+}
+
+VALID_SPLIT_OPS = list(SPLIT_OPS_FUNCTIONS.keys())
 # TODO: VALID_OPERATORS = '+-*/^'
 VALID_OPERATORS = '+-*/'
 
 
-@pytest.fixture(params=[None, 'invalid'] + VALID_SPLIT_OPS)  # TODO mean
+# An array of split ops sends one message per split op, tagged with its name
+@pytest.fixture(params=[None, 'invalid'] + VALID_SPLIT_OPS +
+                       [['min', 'invalid', 'p95', 'count']])
 def split_op(request):
     return request.param
 
@@ -62,11 +83,11 @@ class TestSplit(TestMonitor):
         }
 
         operations = chain(
-            # Test all libmatheval supported binary operations and do all
+            # Test all supported binary operations and do all
             # operations on result
             product(('array_0' + str.replace(operator, '^', '**') + 'array_1'
                      for operator in VALID_OPERATORS),
-                    VALID_SPLIT_OPS),
+                    ('sum', 'mean')),
             # TODO
             # Test operation on constants
             # iter(['100*array_1', '-array_1']),
@@ -113,7 +134,17 @@ class TestSplit(TestMonitor):
 
         eval_globals = None
 
-        def average(x): return float(sum(x))/len(x) if len(x) > 0 else 0
+        # Split ops results messages, only if vector has any value
+        def split_op_results(x):
+            x = [v for v in x if v is not None]
+            if not x:
+                return []
+            if isinstance(split_op, list):
+                return [(op, SPLIT_OPS_FUNCTIONS[op](x)) for op in split_op
+                        if op in SPLIT_OPS_FUNCTIONS]
+            if split_op in SPLIT_OPS_FUNCTIONS:
+                return [(None, SPLIT_OPS_FUNCTIONS[split_op](x))]
+            return []
 
         # Kafka messages per monitor
         kafka_messages = [
@@ -128,17 +159,15 @@ class TestSplit(TestMonitor):
                                                name_split_suffix or ''),
                 'value': '{:.6f}'.format(value)
              } for value_i, value in enumerate(test_array) if value is not None
-             ] + ([{
+             ] + [{
                 'type': 'system',
                 'sensor_id': 1,
                 'sensor_name': 'sensor-test-01',
                 'monitor': 'array_{}'.format(monitor_i),
                 'instance': None,
-                'value': '{:.6f}'.format(
-                    (sum if split_op == 'sum'
-                         else average)([x for x in test_array
-                                        if x is not None]))
-             }] if split_op in VALID_SPLIT_OPS else [])
+                'split_op': result_split_op,
+                'value': '{:.6f}'.format(result)
+             } for result_split_op, result in split_op_results(test_array)]
             for (monitor_i, test_array) in enumerate(tests_arrays)
         ] + [
             # Operations over arrays & result operations
@@ -165,8 +194,7 @@ class TestSplit(TestMonitor):
         # Filter operation kafka messages with 0 values, monitor will never
         # send them.
         kafka_messages = [m for m in kafka_messages
-                          if (m['type'] == 'system' and
-                              m['instance'] is not None) or
+                          if m['type'] == 'system' or
                           '0.000000' != m['value']]
         messages = [{'kafka_messages': kafka_messages}]
 
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+import pytest
+
+
+class TestBroadcast(TestMonitor):
+    ''' Test for operations between vectors and scalars '''
+    def test_broadcast(self,
+                       child,
+                       kafka_handler):
+        vector, scalar = [10, 20, None, 40], 4
+        instance_prefix, name_split_suffix = 'core-', '_per_core'
+        eval_globals = None
+
+        operations = ['100*vector/scalar',
+                      'vector*scalar+vector',
+                      'scalar-vector']
+
+        # Configuration in sensor/monitor that must be forwarded to kafka
+        # messages
+        sensor_config_base = {'sensor_id': 1,
+                              'sensor_name': 'sensor-test-01'}
+
+        monitors_config = [{
+                'name': 'vector',
+                'system': "echo -n '{}'".format(
+                                         ';'.join(str(i) if i is not None
+                                                  else ''
+                                                  for i in vector)),
+                'split': ';',
+                'send': 0,
+            }, {
+                'name': 'scalar',
+                'system': "echo -n '{}'".format(scalar),
+                'send': 0,
+            }] + [{
+                'name': 'op_' + operation,
+                'op': operation,
+                'instance_prefix': instance_prefix,
+                'name_split_suffix': name_split_suffix,
+            } for operation in operations
+        ]
+
+        sensor_config = {
+            **sensor_config_base,
+            'timeout': 100000000,
+            'community': 'public',
+            'monitors': monitors_config,
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        # Scalar is used with every vector element, and vector holes are not
+        # sent
+        kafka_messages = [{
+                **sensor_config_base,
+                'instance': '{}{}'.format(instance_prefix, value_i),
+                'type': 'op',
+                'monitor': 'op_{}{}'.format(operation, name_split_suffix),
+                'value': '{:.6f}'.format(eval(operation,
+                                              eval_globals,
+                                              {'vector': value,
+                                               'scalar': scalar})),
+            } for operation in operations
+            for value_i, value in enumerate(vector) if value is not None
+        ]
+
+        messages = [{'kafka_messages': kafka_messages}]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'messages']})
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+import pytest
+
+
+class TestJsonNumber(TestMonitor):
+    ''' Test for values sent as JSON numbers '''
+    def test_json_number(self,
+                         child,
+                         kafka_handler):
+        # (Monitor response, integer flag, expected value)
+        values = [('256', 0, 256),
+                  ('0.1', 0, 0.1),
+                  ('-3.25', 0, -3.25),
+                  ('123456789.123', 0, 123456789.123),
+                  ('1e21', 0, 1e21),
+                  ('0.0000001', 0, 1e-7),
+                  ('3.7', 1, 4),
+                  ('-3.7', 1, -4)]
+
+        # Configuration in sensor/monitor that must be forwarded to kafka
+        # messages
+        sensor_config_base = {'sensor_id': 1,
+                              'sensor_name': 'sensor-test-01'}
+
+        monitors_config = [{
+                'name': 'monitor_{}'.format(i),
+                'system': "echo -n '{}'".format(response),
+                'integer': integer,
+                'json_number': 1,
+            } for i, (response, integer, _) in enumerate(values)
+        ] + [{
+                # Old behaviour: quoted string with six decimals
+                'name': 'monitor_string',
+                'system': "echo -n '256'",
+            }
+        ]
+
+        sensor_config = {
+            **sensor_config_base,
+            'timeout': 100000000,
+            'community': 'public',
+            'monitors': monitors_config,
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        kafka_messages = [{
+                **sensor_config_base,
+                'type': 'system',
+                'monitor': 'monitor_{}'.format(i),
+                'value': expected,
+            } for i, (_, _, expected) in enumerate(values)
+        ] + [{
+                **sensor_config_base,
+                'type': 'system',
+                'monitor': 'monitor_string',
+                'value': '256.000000',
+            }
+        ]
+
+        messages = [{'kafka_messages': kafka_messages}]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'messages']})
+
+if __name__ == '__main__':
+    main()
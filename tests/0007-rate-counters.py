@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+
+from mon_test import TestBase, TestMonitor, main
+from pysnmp.proto.api import v2c
+import os
+import pytest
+
+
+class TestRateCounters(TestMonitor):
+    ''' Test for rate monitors over counters that wrap or are reset '''
+    def test_rate_counters(self,
+                           child,
+                           kafka_handler):
+        poll_interval_ms = 1000
+
+        # (Monitor name, SNMP type, responses in each polling cycle,
+        #  expected counter delta in 2nd and 3rd cycles. None if no message)
+        counters = [
+            # 32 bits counters wrap around, so a reset looks like a wrap
+            ('c32_wrap', v2c.Counter32, [2**32 - 500, 500, 1500],
+             [1000, 1000]),
+            ('c32_reset', v2c.Counter32, [1500, 500, 1500],
+             [2**32 - 1000, 1000]),
+            # 64 bits counters and time ticks going back are discontinuities
+            ('c64_wrap', v2c.Counter64, [2**64 - 500, 500, 1500],
+             [None, 1000]),
+            ('c64_reset', v2c.Counter64, [10**12, 500, 1500],
+             [None, 1000]),
+            ('ticks_reset', v2c.TimeTicks, [10**6, 500, 1500],
+             [None, 1000]),
+        ]
+
+        snmp_responses = {(0, i): [snmp_type(v) for v in responses]
+                          for i, (_, snmp_type, responses, _)
+                          in enumerate(counters)}
+
+        # Configuration in sensor/monitor that must be forwarded to kafka
+        # messages
+        sensor_config_base = {'sensor_id': 1,
+                              'sensor_name': 'sensor-test-01'}
+
+        sensor_config = {
+            **sensor_config_base,
+            'timeout': 100000000,
+            'community': 'public',
+            'poll_interval_ms': poll_interval_ms,
+            'monitors': [{
+                    'name': name,
+                    'oid': (0, i),
+                    'rate': 1,
+                } for i, (name, _, _, _) in enumerate(counters)
+            ],
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        def rate(delta):
+            ''' Expected rate check, allowing some scheduling jitter '''
+            expected = delta * 1000 / poll_interval_ms
+            return lambda value: abs(float(value) - expected) < 0.2 * expected
+
+        # First cycle has no previous sample, so it sends nothing
+        messages = [{'kafka_messages': [{
+                **sensor_config_base,
+                'type': 'snmp',
+                'monitor': name,
+                'value': rate(deltas[cycle]),
+            } for (name, _, _, deltas) in counters
+            if deltas[cycle] is not None]
+        } for cycle in range(2)]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'snmp_responses',
+                                                         'kafka_handler',
+                                                         'messages']})
+
+    def test_rate_delayed_evaluation(self,
+                                     child,
+                                     kafka_handler):
+        ''' Rates use the polling cycle start, so a monitor evaluated later
+        in some cycles than in others still reports the same rate '''
+        poll_interval_ms = 1000
+        delay_s = 0.6
+
+        # Every other cycle, a monitor evaluated before the rate one takes
+        # delay_s, while the SNMP value has already been fetched at cycle
+        # start
+        toggle_file = TestBase.random_resource_file('monitor', 'delay')
+        delay_cmd = "if [ -e {f} ]; then rm {f}; sleep {d}; " \
+                    "else touch {f}; fi; echo 0".format(f=toggle_file,
+                                                        d=delay_s)
+
+        snmp_responses = {(0, 0): [v2c.Counter64(v)
+                                   for v in (1000, 2000, 3000, 4000)]}
+
+        sensor_config_base = {'sensor_id': 1,
+                              'sensor_name': 'sensor-test-01'}
+
+        sensor_config = {
+            **sensor_config_base,
+            'timeout': 100000000,
+            'community': 'public',
+            'poll_interval_ms': poll_interval_ms,
+            'monitors': [
+                {'name': 'delay', 'system': delay_cmd, 'send': 0},
+                {'name': 'c64_rate', 'oid': (0, 0), 'rate': 1},
+            ],
+        }
+
+        base_config = {'conf': {'async_snmp': True},
+                       'sensors': [sensor_config]}
+
+        expected = 1000 * 1000 / poll_interval_ms
+        messages = [{'kafka_messages': [{
+                **sensor_config_base,
+                'type': 'snmp',
+                'monitor': 'c64_rate',
+                'value': lambda value: abs(float(value) - expected) <
+                                       0.2 * expected,
+            }]
+        } for cycle in range(2)]
+
+        t_locals = locals()
+        try:
+            self.base_test(child_argv_str=t_locals['child'],
+                           **{key: t_locals[key] for key in [
+                                                           'base_config',
+                                                           'snmp_responses',
+                                                           'kafka_handler',
+                                                           'messages']})
+        finally:
+            if os.path.exists(toggle_file):
+                os.remove(toggle_file)
+
+
+if __name__ == '__main__':
+    main()
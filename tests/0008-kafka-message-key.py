@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+import pytest
+
+
+class TestKafkaMessageKey(TestMonitor):
+    ''' Test for kafka messages keys template '''
+    def test_kafka_message_key(self,
+                               child,
+                               kafka_handler):
+        n_monitors = 3
+
+        # Configuration in sensor/monitor that must be forwarded to kafka
+        # messages
+        sensor_config_base = {'sensor_id': 1,
+                              'sensor_name': 'sensor-test-01'}
+
+        sensor_config = {
+            **sensor_config_base,
+            'timeout': 100000000,
+            'community': 'public',
+            'monitors': [{
+                    'name': 'monitor_{}'.format(i),
+                    'system': 'echo {}'.format(i),
+                } for i in range(n_monitors)
+            ],
+        }
+
+        base_config = {
+            'conf': {'kafka_message_key': '{sensor_name}:{monitor}'},
+            'sensors': [sensor_config],
+        }
+
+        kafka_messages = [{
+                **sensor_config_base,
+                'type': 'system',
+                'monitor': 'monitor_{}'.format(i),
+                'value': '{:.6f}'.format(i),
+            } for i in range(n_monitors)
+        ]
+
+        kafka_keys = ['sensor-test-01:monitor_{}'.format(i).encode()
+                      for i in range(n_monitors)]
+
+        messages = [{'kafka_messages': kafka_messages,
+                     'kafka_keys': kafka_keys}]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'messages']})
+
+if __name__ == '__main__':
+    main()
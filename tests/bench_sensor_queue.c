@@ -0,0 +1,190 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// Enqueue/dequeue throughput of rd_fifoq vs lock-free sensors ring.
+/// Usage: bench_sensor_queue [elements per producer]
+
+#include "config.h"
+
+#include "rb_mpmc_ring.h"
+#include "utils.h"
+
+#include <librd/rd.h>
+#include <librd/rdqueue.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/// Benchmark queue operations
+struct bench_queue_ops {
+	const char *name;
+	void (*push)(void *queue, void *elm);
+	void *(*pop)(void *queue, int tmo_ms);
+};
+
+/// Benchmark run
+struct bench_run {
+	const struct bench_queue_ops *ops;
+	void *queue;
+	size_t elements_per_producer;
+	size_t total_elements;
+	size_t consumed;
+};
+
+static void fifoq_push(void *queue, void *elm) {
+	rd_fifoq_add(queue, elm);
+}
+
+static void *fifoq_pop(void *queue, int tmo_ms) {
+	void *ret = NULL;
+	rd_fifoq_elm_t *elm = rd_fifoq_pop_timedwait(queue, tmo_ms);
+	if (elm) {
+		ret = elm->rfqe_ptr;
+		rd_fifoq_elm_release(queue, elm);
+	}
+	return ret;
+}
+
+static void ring_push(void *queue, void *elm) {
+	while (!rb_mpmc_ring_push(queue, elm)) {
+		sched_yield();
+	}
+}
+
+static void *ring_pop(void *queue, int tmo_ms) {
+	return rb_mpmc_ring_pop_wait(queue, tmo_ms);
+}
+
+static const struct bench_queue_ops fifoq_ops = {
+		.name = "rd_fifoq", .push = fifoq_push, .pop = fifoq_pop,
+};
+
+static const struct bench_queue_ops ring_ops = {
+		.name = "mpmc_ring", .push = ring_push, .pop = ring_pop,
+};
+
+static void *producer(void *vrun) {
+	struct bench_run *run = vrun;
+	for (size_t i = 0; i < run->elements_per_producer; ++i) {
+		// Never push NULL, since it means "empty" in pop
+		run->ops->push(run->queue, (void *)(i + 1));
+	}
+	return NULL;
+}
+
+static void *consumer(void *vrun) {
+	struct bench_run *run = vrun;
+	while (ATOMIC_OP(add, fetch, &run->consumed, 0) < run->total_elements) {
+		if (run->ops->pop(run->queue, 10)) {
+			ATOMIC_OP(add, fetch, &run->consumed, 1);
+		}
+	}
+	return NULL;
+}
+
+/** Run a benchmark
+  @param ops Queue operations
+  @param queue Queue
+  @param producers Number of producer threads
+  @param consumers Number of consumer threads
+  @param elements_per_producer Elements each producer pushes
+  @return Elements per second
+  */
+static double bench(const struct bench_queue_ops *ops,
+		    void *queue,
+		    size_t producers,
+		    size_t consumers,
+		    size_t elements_per_producer) {
+	pthread_t threads[producers + consumers];
+	struct bench_run run = {
+			.ops = ops,
+			.queue = queue,
+			.elements_per_producer = elements_per_producer,
+			.total_elements = producers * elements_per_producer,
+	};
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < consumers; ++i) {
+		pthread_create(&threads[i], NULL, consumer, &run);
+	}
+	for (size_t i = 0; i < producers; ++i) {
+		pthread_create(&threads[consumers + i], NULL, producer, &run);
+	}
+	for (size_t i = 0; i < producers + consumers; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	const double elapsed = (double)(end.tv_sec - start.tv_sec) +
+			       (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	return (double)run.total_elements / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+	static const struct {
+		size_t producers, consumers;
+	} scenarios[] = {
+			{1, 1}, {1, 4}, {1, 10}, {4, 4}, {4, 10},
+	};
+	const size_t elements_per_producer =
+			argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+	printf("%-10s %-10s %15s %15s %8s\n",
+	       "producers",
+	       "consumers",
+	       "rd_fifoq op/s",
+	       "mpmc_ring op/s",
+	       "speedup");
+	for (size_t i = 0; i < RD_ARRAYSIZE(scenarios); ++i) {
+		rd_fifoq_t fifoq;
+		struct rb_mpmc_ring ring;
+
+		memset(&fifoq, 0, sizeof(fifoq));
+		rd_fifoq_init(&fifoq);
+		if (!rb_mpmc_ring_init(&ring, 4096)) {
+			fprintf(stderr, "Couldn't allocate ring\n");
+			return 1;
+		}
+
+		const double fifoq_ops_s = bench(&fifoq_ops,
+						 &fifoq,
+						 scenarios[i].producers,
+						 scenarios[i].consumers,
+						 elements_per_producer);
+		const double ring_ops_s = bench(&ring_ops,
+						&ring,
+						scenarios[i].producers,
+						scenarios[i].consumers,
+						elements_per_producer);
+
+		printf("%-10zu %-10zu %15.0f %15.0f %7.2fx\n",
+		       scenarios[i].producers,
+		       scenarios[i].consumers,
+		       fifoq_ops_s,
+		       ring_ops_s,
+		       ring_ops_s / fifoq_ops_s);
+
+		rd_fifoq_destroy(&fifoq);
+		rb_mpmc_ring_done(&ring);
+	}
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// Split of vector strings: strstr + strtod two passes vs one pass parser.
+/// Usage: bench_vector_split [iterations] [elements]
+
+#include "config.h"
+
+#include "rb_value.h"
+
+#include <librd/rd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Build a vector string with a mix of integers, decimals and blanks
+  @param elements Number of elements
+  @param len Returned string length
+  @return New string
+  */
+static char *bench_vector_string(size_t elements, size_t *len) {
+	const size_t size = elements * 24 + 1;
+	char *ret = malloc(size);
+	if (NULL == ret) {
+		return NULL;
+	}
+
+	srand(0);
+	*len = 0;
+	for (size_t i = 0; i < elements; ++i) {
+		const int r = rand();
+		const char *sep = i ? ";" : "";
+		switch (i % 8) {
+		case 0:
+			// Blank element
+			*len += (size_t)snprintf(
+					&ret[*len], size - *len, "%s", sep);
+			break;
+		case 1:
+		case 2:
+		case 3:
+			*len += (size_t)snprintf(&ret[*len],
+						 size - *len,
+						 "%s%d",
+						 sep,
+						 r);
+			break;
+		default:
+			*len += (size_t)snprintf(&ret[*len],
+						 size - *len,
+						 "%s%d.%03d",
+						 sep,
+						 r % 100000,
+						 r % 1000);
+			break;
+		};
+	}
+
+	return ret;
+}
+
+/** Previous vector split: count elements with strstr, and then strtod every
+  one of them.
+  @param str Vector string
+  @param split_tok Split token
+  @param values Values of elements
+  @return Number of elements
+  */
+static size_t
+bench_strstr_strtod(const char *str, const char *split_tok, double *values) {
+	const size_t split_tok_len = strlen(split_tok);
+	size_t count = 1;
+	for (const char *tok = str; (tok = strstr(tok, split_tok));
+	     tok += split_tok_len) {
+		count++;
+	}
+
+	size_t i = 0;
+	for (const char *tok = str; tok; tok = strstr(tok, split_tok), i++) {
+		if (i > 0) {
+			tok += split_tok_len;
+		}
+		values[i] = strtod(tok, NULL);
+	}
+
+	return count;
+}
+
+/// Seconds since an arbitrary point
+static double bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	const size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+	const size_t elements = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+	size_t len = 0;
+
+	char *str = bench_vector_string(elements, &len);
+	double *values = calloc(elements, sizeof(values[0]));
+	if (NULL == str || NULL == values) {
+		fprintf(stderr, "Couldn't allocate vector string\n");
+		return 1;
+	}
+
+	// String monitor values take ownership of their buffer
+	monitor_value *mv = new_monitor_value_strn(strdup(str), len);
+
+	// Check that both parsers agree in every non blank element
+	monitor_value *vector = new_monitor_value_vector_from_string(mv, ";");
+	if (NULL == vector ||
+	    elements != bench_strstr_strtod(str, ";", values) ||
+	    elements != vector->array.count) {
+		fprintf(stderr, "Bad vector split\n");
+		return 1;
+	}
+	for (size_t i = 0; i < elements; ++i) {
+		const bool valid = monitor_value_vector_valid(vector, i);
+		if (valid != (i % 8 != 0) ||
+		    (valid && vector->array.values[i] != values[i])) {
+			fprintf(stderr, "Bad vector element %zu\n", i);
+			return 1;
+		}
+	}
+	rb_monitor_value_done(vector);
+
+	double start = bench_now();
+	for (size_t i = 0; i < iterations; ++i) {
+		bench_strstr_strtod(str, ";", values);
+	}
+	const double strtod_s = bench_now() - start;
+
+	start = bench_now();
+	for (size_t i = 0; i < iterations; ++i) {
+		rb_monitor_value_done(
+				new_monitor_value_vector_from_string(mv, ";"));
+	}
+	const double split_s = bench_now() - start;
+
+	printf("%zu elements, %zu bytes, %zu iterations\n",
+	       elements,
+	       len,
+	       iterations);
+	printf("%-15s %12s %12s\n", "parser", "vectors/s", "MB/s");
+	printf("%-15s %12.0f %12.1f\n",
+	       "strstr+strtod",
+	       (double)iterations / strtod_s,
+	       (double)(iterations * len) / strtod_s / 1e6);
+	printf("%-15s %12.0f %12.1f\n",
+	       "one pass",
+	       (double)iterations / split_s,
+	       (double)(iterations * len) / split_s / 1e6);
+	printf("speedup: %.2fx\n", strtod_s / split_s);
+
+	rb_monitor_value_done(mv);
+	free(values);
+	free(str);
+	return 0;
+}
@@ -60,9 +60,13 @@ class MonitorChild(Popen):
 class MonitorKafkaMessages(object):
     ''' Base SNMP message for testing '''
 
-    def __init__(self, topic_name, expected_kafka_messages):
+    def __init__(self,
+                 topic_name,
+                 expected_kafka_messages,
+                 expected_kafka_keys=None):
         self.__topic_name = topic_name
         self.__messages = expected_kafka_messages
+        self.__keys = expected_kafka_keys
 
     def test(self, kafka_handler):
         ''' Do the SNMP message test.
@@ -73,7 +77,8 @@ class MonitorKafkaMessages(object):
         kafka_handler.check_kafka_messages(
                      check_messages_callback=KafkaHandler.assert_messages_keys,
                      topic_name=self.__topic_name,
-                     messages=self.__messages)
+                     messages=self.__messages,
+                     keys=self.__keys)
 
 
 class SNMPTrapsDispatcher(AsyncoreDispatcher):
@@ -219,7 +224,8 @@ class TestMonitor(TestBase):
             if not present.
           - child_argv_str: Child string to execute. `-c <config> will be added
           - snmp_responses: Expected SNMP agent responses
-          - messages: kafka messages to expect
+          - messages: kafka messages to expect, and their kafka keys in
+            'kafka_keys' if they need to be checked
           - kafka_handler: Kafka handler to use
         '''
 
@@ -271,7 +277,8 @@ class TestMonitor(TestBase):
 
                         t_test = MonitorKafkaMessages(
                                 topic_name=kafka_topic,
-                                expected_kafka_messages=m['kafka_messages'])
+                                expected_kafka_messages=m['kafka_messages'],
+                                expected_kafka_keys=m.get('kafka_keys'))
                         t_test.test(kafka_handler=kafka_handler)
                     except KeyError:
                         pass  # No messages given
@@ -30,7 +30,8 @@ class KafkaHandler(object):
     def assert_messages_keys(expected_dimensions, received_messages):
         ''' Assert that expected_dimensions are in received_messages JSON for
         each message in received_messages. You can check that one dimension is
-        NOT included if expected_dimension[dim] is None'''
+        NOT included if expected_dimension[dim] is None, or check its value
+        with expected_dimension[dim] if it is callable'''
 
         assert(len(expected_dimensions) == len(received_messages))
         for dimensions, message in zip(expected_dimensions, received_messages):
@@ -40,14 +41,17 @@ class KafkaHandler(object):
             for dimension, value in dimensions.items():
                 if value is None:
                     assert(dimension not in message)
+                elif callable(value):
+                    assert(value(message[dimension]))
                 else:
                     assert(message[dimension] == value)
 
     def check_kafka_messages(self,
                              check_messages_callback,
                              topic_name,
-                             messages):
-        ''' Check kafka messages '''
+                             messages,
+                             keys=None):
+        ''' Check kafka messages, and their keys if keys is not None '''
         try:
             topic_name = topic_name.encode()
         except AttributeError:
@@ -57,6 +61,8 @@ class KafkaHandler(object):
         consumed_messages = list(itertools.islice(consumer, 0, len(messages)))
 
         check_messages_callback(messages, [m.value for m in consumed_messages])
+        if keys is not None:
+            assert(keys == [m.partition_key for m in consumed_messages])
 
     def assert_all_messages_consumed(self):
         num_consumers = len(self.__kafka_consumers)
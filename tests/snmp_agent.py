@@ -13,7 +13,9 @@ class SNMPAgentResponder(instrum.AbstractMibInstrumController):
 
     def __init__(self, port, responses):
         ''' Constructor. Arguments:
-        - responses: oid->response map'''
+        - responses: oid->response map. If response is a list, each request
+          of that oid is answered with the next element, and the last one is
+          repeated'''
         self.__port = port
         self.__responses = {
             SNMPAgentResponder.OID_PREFIX + key: response
@@ -21,7 +23,13 @@ class SNMPAgentResponder(instrum.AbstractMibInstrumController):
         }
 
     def readVars(self, vars, acInfo=(None, None)):
-        return [(oid, self.__responses[oid]) for oid, _ in vars]
+        return [(oid, self.__response(oid)) for oid, _ in vars]
+
+    def __response(self, oid):
+        response = self.__responses[oid]
+        if not isinstance(response, list):
+            return response
+        return response.pop(0) if len(response) > 1 else response[0]
 
 
 class SNMPAgent(Process):